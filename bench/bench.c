@@ -0,0 +1,127 @@
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+// times nyufile commands against an image built by mkimage
+//   ./bench nyufile image
+// every recovery runs against a fresh copy of the image (image.work)
+
+typedef struct ManifestLine {
+    char path[64];
+    char sha[41];
+    unsigned int size;
+    unsigned int clusters;
+    int fragmented;
+} ManifestLine;
+
+void printBenchUsage(){
+    fprintf(stderr, "Usage: ./bench nyufile image\n");
+    exit(1);
+}
+int copyImage(char* from, char* to){
+    int in = open(from, O_RDONLY);
+    int out = open(to, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(in == -1 || out == -1){
+        return 0;
+    }
+    static char buffer[1 << 20];
+    ssize_t count;
+    while((count = read(in, buffer, sizeof(buffer))) > 0){
+        if(write(out, buffer, count) != count){
+            count = -1;
+            break;
+        }
+    }
+    close(in);
+    close(out);
+    return count == 0;
+}
+// run one command, report wall time, bytes the command had to hash and the child's peak RSS
+void runCase(char* label, char** args, unsigned long long bytesHashed){
+    struct timespec start;
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    pid_t pid = fork();
+    if(pid == 0){
+        int devNull = open("/dev/null", O_WRONLY);
+        dup2(devNull, STDOUT_FILENO);
+        execv(args[0], args);
+        _exit(127);
+    }
+    int status;
+    struct rusage usage;
+    wait4(pid, &status, 0, &usage);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double wallMs = (end.tv_sec-start.tv_sec)*1e3+(end.tv_nsec-start.tv_nsec)/1e6;
+    printf("%-28s %10.2f %14llu %12ld%s\n", label, wallMs, bytesHashed, usage.ru_maxrss,
+    WIFEXITED(status) && WEXITSTATUS(status) == 0 ? "" : "  (failed)");
+    return;
+}
+int main(int argc, char* argv[]){
+    if(argc != 3){
+        printBenchUsage();
+    }
+    char* nyufile = argv[1];
+    char* image = argv[2];
+    char manifestName[4096];
+    char workName[4096];
+    snprintf(manifestName, sizeof(manifestName), "%s.manifest", image);
+    snprintf(workName, sizeof(workName), "%s.work", image);
+    FILE* manifest = fopen(manifestName, "r");
+    if(!manifest){
+        perror(manifestName);
+        return 1;
+    }
+    // the first contiguous and the first fragmented (short enough for -R) deleted file
+    ManifestLine line;
+    ManifestLine contiguous;
+    ManifestLine fragmented;
+    int haveContiguous = 0;
+    int haveFragmented = 0;
+    while(fscanf(manifest, "%63s %40s %u %u %d", line.path, line.sha, &line.size, &line.clusters, &line.fragmented) == 5){
+        if(!line.fragmented && !haveContiguous){
+            contiguous = line;
+            haveContiguous = 1;
+        }
+        if(line.fragmented && line.clusters <= 5 && !haveFragmented){
+            fragmented = line;
+            haveFragmented = 1;
+        }
+    }
+    fclose(manifest);
+    printf("%-28s %10s %14s %12s\n", "command", "wall ms", "bytes hashed", "peak RSS KB");
+    char* listArgs[] = {nyufile, image, "-l", NULL};
+    runCase("-l", listArgs, 0);
+    if(haveContiguous){
+        char label[128];
+        copyImage(image, workName);
+        char* recoverArgs[] = {nyufile, workName, "-r", contiguous.path, NULL};
+        snprintf(label, sizeof(label), "-r %s", contiguous.path);
+        runCase(label, recoverArgs, 0);
+        copyImage(image, workName);
+        char* shaArgs[] = {nyufile, workName, "-r", contiguous.path, "-s", contiguous.sha, NULL};
+        snprintf(label, sizeof(label), "-r %s -s", contiguous.path);
+        runCase(label, shaArgs, contiguous.size);
+    }
+    else{
+        printf("-r, -r -s: no contiguous deleted file in the image\n");
+    }
+    if(haveFragmented){
+        char label[128];
+        copyImage(image, workName);
+        char* nonContArgs[] = {nyufile, workName, "-R", fragmented.path, "-s", fragmented.sha, NULL};
+        snprintf(label, sizeof(label), "-R %s -s", fragmented.path);
+        runCase(label, nonContArgs, fragmented.size);
+    }
+    else{
+        printf("-R: no fragmented deleted file of at most 5 clusters in the image\n");
+    }
+    unlink(workName);
+    return 0;
+}
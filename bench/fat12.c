@@ -0,0 +1,120 @@
+#include <stdlib.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include "../nyufile.h"
+
+// FAT12 regression image: entries that share a byte, linked out of disk order by one recovery
+//   ./fat12 -o image       write it (HELLO.TXT live at cluster 2, deleted AAAA.TXT at 5 and BBBB.TXT at 3-4)
+//   ./fat12 -k image       after recovering both, check every FAT copy holds 2 -> EOC, 3 -> 4 -> EOC, 5 -> EOC
+// (AAAA.TXT is recovered first, so odd cluster 5 is queued before even cluster 4 it shares a byte with)
+
+#define BYTES_PER_SECTOR 512
+#define NUM_OF_FATS 2
+#define ROOT_ENTRIES 16
+#define DATA_CLUSTERS 100
+#define IMAGE_SIZE ((1+NUM_OF_FATS+1+DATA_CLUSTERS)*BYTES_PER_SECTOR)
+#define FAT_START BYTES_PER_SECTOR
+#define ROOT_START ((1+NUM_OF_FATS)*BYTES_PER_SECTOR)
+#define DATA_START (ROOT_START+BYTES_PER_SECTOR)
+
+void printFat12Usage(){
+    fprintf(stderr, "Usage: ./fat12 -o image | -k image\n");
+    exit(1);
+}
+void setFat12(unsigned char* fat, unsigned int clus, unsigned int value){
+    unsigned char* pair = &fat[clus*3/2];
+    if(clus & 1){
+        pair[0] = (unsigned char) ((pair[0] & 0x0f) | (value & 0x0f) << 4);
+        pair[1] = (unsigned char) (value >> 4);
+    }
+    else{
+        pair[0] = (unsigned char) value;
+        pair[1] = (unsigned char) ((pair[1] & 0xf0) | (value >> 8 & 0x0f));
+    }
+    return;
+}
+unsigned int getFat12(unsigned char* fat, unsigned int clus){
+    unsigned char* pair = &fat[clus*3/2];
+    return (clus & 1) ? (pair[0] >> 4 | pair[1] << 4) : (pair[0] | (pair[1] & 0x0f) << 8);
+}
+void fillEntry(DirEntry* entry, const char* name, unsigned int clus, unsigned int size){
+    memset(entry, 0, sizeof(DirEntry));
+    memcpy(entry->DIR_Name, name, 11);
+    entry->DIR_Attr = 0x20;
+    entry->DIR_WrtDate = 0x5a21;
+    entry->DIR_FstClusLO = (unsigned short) clus;
+    entry->DIR_FileSize = size;
+    return;
+}
+int writeImage(char* output){
+    static unsigned char disk[IMAGE_SIZE];
+    BootEntry* boot = (BootEntry*) disk;
+    memcpy(boot->BS_jmpBoot, "\xeb\x3c\x90", 3);
+    memcpy(boot->BS_OEMName, "FAT12REG", 8);
+    boot->BPB_BytsPerSec = BYTES_PER_SECTOR;
+    boot->BPB_SecPerClus = 1;
+    boot->BPB_RsvdSecCnt = 1;
+    boot->BPB_NumFATs = NUM_OF_FATS;
+    boot->BPB_RootEntCnt = ROOT_ENTRIES;
+    boot->BPB_TotSec16 = IMAGE_SIZE/BYTES_PER_SECTOR;
+    boot->BPB_Media = 0xf8;
+    boot->BPB_FATSz16 = 1;
+    disk[510] = 0x55;
+    disk[511] = 0xaa;
+    unsigned char* fat = &disk[FAT_START];
+    setFat12(fat, 0, 0xff8);
+    setFat12(fat, 1, 0xfff);
+    setFat12(fat, 2, 0xfff);
+    DirEntry* root = (DirEntry*) &disk[ROOT_START];
+    fillEntry(&root[0], "HELLO   TXT", 2, 12);
+    fillEntry(&root[1], "\xe5" "AAA    TXT", 5, 100);
+    fillEntry(&root[2], "\xe5" "BBB    TXT", 3, 700);
+    memcpy(&disk[DATA_START], "hello world\n", 12);
+    memset(&disk[DATA_START+3*BYTES_PER_SECTOR], 'A', 100);
+    memset(&disk[DATA_START+BYTES_PER_SECTOR], 'B', 700);
+    memcpy(&disk[FAT_START+BYTES_PER_SECTOR], fat, BYTES_PER_SECTOR);
+    FILE* image = fopen(output, "wb");
+    if(!image || fwrite(disk, IMAGE_SIZE, 1, image) != 1){
+        perror(output);
+        return 1;
+    }
+    fclose(image);
+    return 0;
+}
+int checkImage(char* input){
+    static unsigned char disk[IMAGE_SIZE];
+    FILE* image = fopen(input, "rb");
+    if(!image || fread(disk, IMAGE_SIZE, 1, image) != 1){
+        perror(input);
+        return 1;
+    }
+    fclose(image);
+    const unsigned int expected[7] = {0xff8, 0xfff, 0xfff, 4, 0xfff, 0xfff, 0};
+    int failures = 0;
+    for(unsigned int j = 0; j < NUM_OF_FATS; j++){
+        unsigned char* fat = &disk[FAT_START+j*BYTES_PER_SECTOR];
+        for(unsigned int c = 0; c < 7; c++){
+            unsigned int value = getFat12(fat, c);
+            // any end-of-chain marker will do
+            if(expected[c] >= 0xff8 ? value < 0xff8 : value != expected[c]){
+                printf("FAT %u: entry %u is 0x%03x, expected 0x%03x\n", j+1, c, value, expected[c]);
+                failures++;
+            }
+        }
+    }
+    printf("%s: %s\n", input, failures ? "FAIL" : "ok");
+    return failures ? 1 : 0;
+}
+int main(int argc, char* argv[]){
+    int opt;
+    while((opt = getopt(argc, argv, "o:k:")) != -1){
+        switch(opt){
+            case 'o': return writeImage(optarg);
+            case 'k': return checkImage(optarg);
+            default: printFat12Usage();
+        }
+    }
+    printFat12Usage();
+    return 1;
+}
@@ -0,0 +1,146 @@
+#include <stdlib.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include "../nyufile.h"
+
+// FAT12 regression image with long names that climb out of the extraction directory
+//   ./hostile -o image      write it (deleted "../../ESCAPE.TXT" in the root, deleted ONE.TXT in a directory named "..")
+//   ./hostile -k dir        after -q -a -x dir (which restores ONE.TXT as _NE.TXT), check both landed inside dir and nowhere above it
+
+#define BYTES_PER_SECTOR 512
+#define NUM_OF_FATS 2
+#define ROOT_ENTRIES 16
+#define DATA_CLUSTERS 100
+#define IMAGE_SIZE ((1+NUM_OF_FATS+1+DATA_CLUSTERS)*BYTES_PER_SECTOR)
+#define FAT_START BYTES_PER_SECTOR
+#define ROOT_START ((1+NUM_OF_FATS)*BYTES_PER_SECTOR)
+#define DATA_START (ROOT_START+BYTES_PER_SECTOR)
+#define CLUSTER_AT(c) (DATA_START+((c)-2)*BYTES_PER_SECTOR)
+
+void printHostileUsage(){
+    fprintf(stderr, "Usage: ./hostile -o image | -k dir\n");
+    exit(1);
+}
+void setFat12(unsigned char* fat, unsigned int clus, unsigned int value){
+    unsigned char* pair = &fat[clus*3/2];
+    if(clus & 1){
+        pair[0] = (unsigned char) ((pair[0] & 0x0f) | (value & 0x0f) << 4);
+        pair[1] = (unsigned char) (value >> 4);
+    }
+    else{
+        pair[0] = (unsigned char) value;
+        pair[1] = (unsigned char) ((pair[1] & 0xf0) | (value >> 8 & 0x0f));
+    }
+    return;
+}
+void fillEntry(DirEntry* entry, const char* name, unsigned char attr, unsigned int clus, unsigned int size){
+    memset(entry, 0, sizeof(DirEntry));
+    memcpy(entry->DIR_Name, name, 11);
+    entry->DIR_Attr = attr;
+    entry->DIR_WrtDate = 0x5a21;
+    entry->DIR_FstClusLO = (unsigned short) clus;
+    entry->DIR_FileSize = size;
+    return;
+}
+// the long name entries for longName, in disk order (last part first); deleted ones lose their order byte
+unsigned int fillLongName(DirEntry* entries, const char* longName, const char* shortName, int deleted){
+    static const unsigned char charOffsets[13] = {1, 3, 5, 7, 9, 14, 16, 18, 20, 22, 24, 28, 30};
+    unsigned char sum = 0;
+    for(unsigned int i = 0; i < 11; i++){
+        sum = (unsigned char) (((sum & 1) << 7)+(sum >> 1)+(unsigned char) shortName[i]);
+    }
+    unsigned int length = strlen(longName);
+    unsigned int parts = length/13+1;
+    for(unsigned int p = 0; p < parts; p++){
+        unsigned int part = parts-1-p;
+        unsigned char* raw = (unsigned char*) &entries[p];
+        memset(raw, 0, sizeof(DirEntry));
+        raw[0] = deleted ? 0xe5 : (unsigned char) ((part+1) | (p == 0 ? 0x40 : 0));
+        raw[11] = ATTR_LONG_NAME;
+        raw[13] = sum;
+        for(unsigned int k = 0; k < 13; k++){
+            unsigned int at = part*13+k;
+            unsigned short c = at < length ? (unsigned char) longName[at] : at == length ? 0x0000 : 0xffff;
+            raw[charOffsets[k]] = (unsigned char) c;
+            raw[charOffsets[k]+1] = (unsigned char) (c >> 8);
+        }
+    }
+    return parts;
+}
+int writeImage(char* output){
+    static unsigned char disk[IMAGE_SIZE];
+    BootEntry* boot = (BootEntry*) disk;
+    memcpy(boot->BS_jmpBoot, "\xeb\x3c\x90", 3);
+    memcpy(boot->BS_OEMName, "HOSTILE ", 8);
+    boot->BPB_BytsPerSec = BYTES_PER_SECTOR;
+    boot->BPB_SecPerClus = 1;
+    boot->BPB_RsvdSecCnt = 1;
+    boot->BPB_NumFATs = NUM_OF_FATS;
+    boot->BPB_RootEntCnt = ROOT_ENTRIES;
+    boot->BPB_TotSec16 = IMAGE_SIZE/BYTES_PER_SECTOR;
+    boot->BPB_Media = 0xf8;
+    boot->BPB_FATSz16 = 1;
+    disk[510] = 0x55;
+    disk[511] = 0xaa;
+    unsigned char* fat = &disk[FAT_START];
+    setFat12(fat, 0, 0xff8);
+    setFat12(fat, 1, 0xfff);
+    setFat12(fat, 2, 0xfff);
+    setFat12(fat, 3, 0xfff);
+    DirEntry* root = (DirEntry*) &disk[ROOT_START];
+    unsigned int n = 0;
+    fillEntry(&root[n++], "HELLO   TXT", 0x20, 2, 12);
+    n += fillLongName(&root[n], "../../ESCAPE.TXT", "ESCAPE  TXT", TRUE);
+    fillEntry(&root[n++], "\xe5" "SCAPE  TXT", 0x20, 5, 20);
+    n += fillLongName(&root[n], "..", "DOTDOT     ", FALSE);
+    fillEntry(&root[n++], "DOTDOT     ", ATTR_DIRECTORY, 3, 0);
+    DirEntry* sub = (DirEntry*) &disk[CLUSTER_AT(3)];
+    fillEntry(&sub[0], ".          ", ATTR_DIRECTORY, 3, 0);
+    fillEntry(&sub[1], "..         ", ATTR_DIRECTORY, 0, 0);
+    fillEntry(&sub[2], "\xe5" "NE     TXT", 0x20, 4, 10);
+    memcpy(&disk[CLUSTER_AT(2)], "hello world\n", 12);
+    memset(&disk[CLUSTER_AT(4)], 'O', 10);
+    memset(&disk[CLUSTER_AT(5)], 'E', 20);
+    memcpy(&disk[FAT_START+BYTES_PER_SECTOR], fat, BYTES_PER_SECTOR);
+    FILE* image = fopen(output, "wb");
+    if(!image || fwrite(disk, IMAGE_SIZE, 1, image) != 1){
+        perror(output);
+        return 1;
+    }
+    fclose(image);
+    return 0;
+}
+int checkOutput(char* dir){
+    // where the names point, and where they must end up instead
+    const char* escapes[2] = {"../_NE.TXT", "../../ESCAPE.TXT"};
+    const char* inside[2] = {"_../_NE.TXT", ".._.._ESCAPE.TXT"};
+    int failures = 0;
+    for(unsigned int i = 0; i < 2; i++){
+        char path[4096];
+        snprintf(path, sizeof(path), "%s/%s", dir, escapes[i]);
+        if(access(path, F_OK) == 0){
+            printf("%s: written outside %s\n", path, dir);
+            failures++;
+        }
+        snprintf(path, sizeof(path), "%s/%s", dir, inside[i]);
+        if(access(path, F_OK) != 0){
+            printf("%s: missing\n", path);
+            failures++;
+        }
+    }
+    printf("%s: %s\n", dir, failures ? "FAIL" : "ok");
+    return failures ? 1 : 0;
+}
+int main(int argc, char* argv[]){
+    int opt;
+    while((opt = getopt(argc, argv, "o:k:")) != -1){
+        switch(opt){
+            case 'o': return writeImage(optarg);
+            case 'k': return checkOutput(optarg);
+            default: printHostileUsage();
+        }
+    }
+    printHostileUsage();
+    return 1;
+}
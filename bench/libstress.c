@@ -0,0 +1,145 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include "../libnyufile.h"
+
+// libnyufile under contention: reader threads list and read every entry of a bench/fat12 image over and
+// over while the main thread recovers its two deleted files in place through the same handle
+//   ./libstress image       (then ./fat12 -k image checks the FAT the recoveries wrote)
+
+#define READER_THREADS 4
+#define READER_ROUNDS 200               // rounds each reader makes after the recoveries
+#define READ_CHUNK 61                   // odd-sized reads so they straddle sector and cluster boundaries
+
+#define TRUE 1
+#define FALSE 0
+
+typedef struct Reader {
+    NyuVolume* volume;
+    int* recovered;                     // set once both files are back
+    unsigned int* rounds;               // rounds made by all readers, for the main thread to wait on
+    unsigned int failures;
+} Reader;
+
+// what every byte of an entry must be, by the end of its path (the first character may still be lost)
+int expectedByte(const char* path, unsigned long long offset){
+    size_t length = strlen(path);
+    if(length >= 9 && strcmp(&path[length-9], "HELLO.TXT") == 0){
+        return "hello world\n"[offset];
+    }
+    if(length >= 7 && strcmp(&path[length-7], "AAA.TXT") == 0){
+        return 'A';
+    }
+    if(length >= 7 && strcmp(&path[length-7], "BBB.TXT") == 0){
+        return 'B';
+    }
+    return -1;
+}
+unsigned int checkEntry(NyuVolume* volume, NyuEntry* entry){
+    char path[64];
+    snprintf(path, sizeof(path), "%s", entry->path);
+    unsigned char chunk[READ_CHUNK];
+    unsigned int failures = 0;
+    for(unsigned long long offset = 0; offset < entry->size;){
+        size_t bytesRead;
+        int status = nyuReadEntry(volume, entry, offset, chunk, READ_CHUNK, &bytesRead);
+        if(status != NYU_OK || bytesRead == 0){
+            fprintf(stderr, "%s: read at %llu: %s\n", path, offset, nyuStatusText(status));
+            return failures+1;
+        }
+        for(size_t b = 0; b < bytesRead; b++){
+            if(expectedByte(path, offset+b) != chunk[b]){
+                fprintf(stderr, "%s: byte %llu is 0x%02x\n", path, offset+b, chunk[b]);
+                return failures+1;
+            }
+        }
+        offset += bytesRead;
+    }
+    // the path handed out must not change under the caller, recovered or not
+    if(strcmp(path, entry->path) != 0){
+        fprintf(stderr, "%s: became %s while it was read\n", path, entry->path);
+        failures++;
+    }
+    return failures;
+}
+void* readerThread(void* arg){
+    Reader* reader = (Reader*) arg;
+    unsigned int after = 0;
+    while(after < READER_ROUNDS){
+        if(__atomic_load_n(reader->recovered, __ATOMIC_ACQUIRE)){
+            after++;
+        }
+        NyuIterator iterator;
+        NyuEntry entry;
+        unsigned int entryCount = 0;
+        nyuBeginEntries(reader->volume, NYU_LIVE | NYU_DELETED, &iterator);
+        while(nyuNextEntry(&iterator, &entry) == NYU_OK){
+            reader->failures += checkEntry(reader->volume, &entry);
+            entryCount++;
+        }
+        if(entryCount != 3){
+            fprintf(stderr, "listed %u entries, expected 3\n", entryCount);
+            reader->failures++;
+        }
+        __atomic_fetch_add(reader->rounds, 1, __ATOMIC_ACQ_REL);
+    }
+    return NULL;
+}
+int main(int argc, char* argv[]){
+    if(argc != 2){
+        fprintf(stderr, "Usage: ./libstress image\n");
+        return 1;
+    }
+    NyuVolume* volume;
+    int status = nyuOpenVolume(argv[1], TRUE, &volume);
+    if(status != NYU_OK){
+        fprintf(stderr, "%s: %s\n", argv[1], nyuStatusText(status));
+        return 1;
+    }
+    int recovered = FALSE;
+    unsigned int rounds = 0;
+    pthread_t threads[READER_THREADS];
+    Reader readers[READER_THREADS];
+    for(unsigned int i = 0; i < READER_THREADS; i++){
+        readers[i].volume = volume;
+        readers[i].recovered = &recovered;
+        readers[i].rounds = &rounds;
+        readers[i].failures = 0;
+        pthread_create(&threads[i], NULL, readerThread, &readers[i]);
+    }
+    // recover while every reader is busy (AAAA.TXT first: its cluster shares a FAT12 byte with BBBB.TXT's)
+    while(__atomic_load_n(&rounds, __ATOMIC_ACQUIRE) < READER_THREADS*10){
+        sched_yield();
+    }
+    unsigned int failures = 0;
+    const char* names[2] = {"AAAA.TXT", "BBBB.TXT"};
+    for(unsigned int i = 0; i < 2; i++){
+        status = nyuRecoverFile(volume, names[i], NULL, NULL);
+        if(status != NYU_OK){
+            fprintf(stderr, "%s: %s\n", names[i], nyuStatusText(status));
+            failures++;
+        }
+    }
+    __atomic_store_n(&recovered, TRUE, __ATOMIC_RELEASE);
+    for(unsigned int i = 0; i < READER_THREADS; i++){
+        pthread_join(threads[i], NULL);
+        failures += readers[i].failures;
+    }
+    // both are live now, under their own names
+    NyuIterator iterator;
+    NyuEntry entry;
+    unsigned int liveCount = 0;
+    nyuBeginEntries(volume, NYU_LIVE, &iterator);
+    while(nyuNextEntry(&iterator, &entry) == NYU_OK){
+        liveCount += strcmp(entry.path, "HELLO.TXT") == 0 || strcmp(entry.path, "AAAA.TXT") == 0 || strcmp(entry.path, "BBBB.TXT") == 0;
+    }
+    if(liveCount != 3){
+        fprintf(stderr, "%u of 3 files live after the recoveries\n", liveCount);
+        failures++;
+    }
+    nyuCloseVolume(volume);
+    printf("%s: %s\n", argv[1], failures ? "FAIL" : "ok");
+    return failures ? 1 : 0;
+}
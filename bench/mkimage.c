@@ -0,0 +1,253 @@
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <openssl/sha.h>
+#include "../nyufile.h"
+
+// deterministic synthetic FAT32 image generator for the benchmarks
+//   ./mkimage -o image [-c secPerClus] [-f numFATs] [-n files] [-D subdirs]
+//             [-z maxFileSize] [-F fragmentedPercent] [-d deletedPercent] [-s seed]
+// writes image and image.manifest ("path sha1 size clusters fragmented" per deleted file)
+
+#define BYTES_PER_SECTOR 512
+#define RESERVED_SECTORS 32
+
+typedef struct GenFile {
+    unsigned int size;
+    unsigned int clusters;
+    unsigned int dir;                   // 0 is the root directory, d is subdirectory d
+    int deleted;
+    int fragmented;
+    unsigned int firstCluster;
+    unsigned int splitCluster;          // first cluster of the second fragment
+} GenFile;
+
+unsigned long long rngState;
+unsigned long long nextRandom(){
+    // xorshift64* - same stream for the same seed on every machine
+    rngState ^= rngState >> 12;
+    rngState ^= rngState << 25;
+    rngState ^= rngState >> 27;
+    return rngState*0x2545f4914f6cdd1dULL;
+}
+void printGenUsage(){
+    fprintf(stderr, "Usage: ./mkimage -o image [-c secPerClus] [-f numFATs] [-n files] [-D subdirs] [-z maxFileSize] [-F fragmentedPercent] [-d deletedPercent] [-s seed]\n");
+    exit(1);
+}
+void setFat(unsigned char* disk, unsigned int fatStart, unsigned int clus, unsigned int value){
+    FatEntry* entry = (FatEntry*) &disk[fatStart+(4*clus)];
+    entry->clusterIndex = value;
+    return;
+}
+void fillDirEntry(DirEntry* entry, const char* name, unsigned char attr, unsigned int clus, unsigned int size){
+    memset(entry, 0, sizeof(DirEntry));
+    memcpy(entry->DIR_Name, name, 11);
+    entry->DIR_Attr = attr;
+    entry->DIR_CrtDate = 0x5a21;
+    entry->DIR_WrtDate = 0x5a21;
+    entry->DIR_CrtTime = 0x6000;
+    entry->DIR_WrtTime = 0x6000;
+    entry->DIR_FstClusHI = (unsigned short) (clus >> 16);
+    entry->DIR_FstClusLO = (unsigned short) (clus & 0xffff);
+    entry->DIR_FileSize = size;
+    return;
+}
+int main(int argc, char* argv[]){
+    char* output = NULL;
+    unsigned int secPerClus = 1;
+    unsigned int numOfFats = 2;
+    unsigned int numOfFiles = 100;
+    unsigned int numOfSubdirs = 0;
+    unsigned int maxFileSize = 0;
+    unsigned int fragPercent = 0;
+    unsigned int deletedPercent = 10;
+    unsigned long long seed = 1;
+    int opt;
+    while((opt = getopt(argc, argv, "o:c:f:n:D:z:F:d:s:")) != -1){
+        switch(opt){
+            case 'o': output = optarg; break;
+            case 'c': secPerClus = atoi(optarg); break;
+            case 'f': numOfFats = atoi(optarg); break;
+            case 'n': numOfFiles = atoi(optarg); break;
+            case 'D': numOfSubdirs = atoi(optarg); break;
+            case 'z': maxFileSize = atoi(optarg); break;
+            case 'F': fragPercent = atoi(optarg); break;
+            case 'd': deletedPercent = atoi(optarg); break;
+            case 's': seed = strtoull(optarg, NULL, 10); break;
+            default: printGenUsage();
+        }
+    }
+    if(!output || secPerClus == 0 || (secPerClus & (secPerClus-1)) || secPerClus > 64 || numOfFats == 0 || numOfFiles > 9999999 || numOfSubdirs > 9999999){
+        printGenUsage();
+    }
+    rngState = seed ? seed : 1;
+    unsigned int bytesPerClus = BYTES_PER_SECTOR*secPerClus;
+    if(maxFileSize == 0){
+        maxFileSize = 4*bytesPerClus;
+    }
+    // decide every file up front
+    GenFile* files = (GenFile*) calloc(numOfFiles ? numOfFiles : 1, sizeof(GenFile));
+    unsigned int numOfDirs = numOfSubdirs+1;
+    unsigned int* dirEntries = (unsigned int*) calloc(numOfDirs, sizeof(unsigned int));
+    unsigned long long dataClusters = 0;
+    for(unsigned int i = 0; i < numOfFiles; i++){
+        files[i].size = 1+nextRandom()%maxFileSize;
+        files[i].clusters = (files[i].size+bytesPerClus-1)/bytesPerClus;
+        files[i].dir = i%numOfDirs;
+        files[i].deleted = nextRandom()%100 < deletedPercent;
+        files[i].fragmented = files[i].clusters >= 2 && nextRandom()%100 < fragPercent;
+        dirEntries[files[i].dir]++;
+        // a fragmented file leaves one free cluster of noise between its two halves
+        dataClusters += files[i].clusters+(files[i].fragmented ? 1 : 0);
+    }
+    dirEntries[0] += numOfSubdirs;
+    unsigned int* dirClusters = (unsigned int*) malloc(sizeof(unsigned int)*numOfDirs);
+    unsigned int* dirStart = (unsigned int*) malloc(sizeof(unsigned int)*numOfDirs);
+    for(unsigned int d = 0; d < numOfDirs; d++){
+        // "." and ".." in subdirectories, and room for the end marker
+        unsigned int entries = dirEntries[d]+(d ? 2 : 0)+1;
+        dirClusters[d] = (entries*sizeof(DirEntry)+bytesPerClus-1)/bytesPerClus;
+        dataClusters += dirClusters[d];
+    }
+    // a quarter of the volume stays free
+    unsigned int totalClusters = (unsigned int) (dataClusters+dataClusters/4+16);
+    unsigned int fatSectors = ((totalClusters+2)*4+BYTES_PER_SECTOR-1)/BYTES_PER_SECTOR;
+    unsigned int totalSectors = RESERVED_SECTORS+numOfFats*fatSectors+totalClusters*secPerClus;
+    unsigned long long imageSize = (unsigned long long) totalSectors*BYTES_PER_SECTOR;
+    int fd = open(output, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if(fd == -1 || ftruncate(fd, imageSize) == -1){
+        perror(output);
+        return 1;
+    }
+    unsigned char* disk = mmap(NULL, imageSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if(disk == MAP_FAILED){
+        perror(output);
+        return 1;
+    }
+    // boot sector
+    BootEntry* boot = (BootEntry*) disk;
+    memcpy(boot->BS_jmpBoot, "\xeb\x58\x90", 3);
+    memcpy(boot->BS_OEMName, "MKIMAGE ", 8);
+    boot->BPB_BytsPerSec = BYTES_PER_SECTOR;
+    boot->BPB_SecPerClus = secPerClus;
+    boot->BPB_RsvdSecCnt = RESERVED_SECTORS;
+    boot->BPB_NumFATs = numOfFats;
+    boot->BPB_Media = 0xf8;
+    boot->BPB_SecPerTrk = 32;
+    boot->BPB_NumHeads = 64;
+    boot->BPB_TotSec32 = totalSectors;
+    boot->BPB_FATSz32 = fatSectors;
+    boot->BPB_RootClus = 2;
+    boot->BPB_FSInfo = 1;
+    boot->BPB_BkBootSec = 6;
+    boot->BS_DrvNum = 0x80;
+    boot->BS_BootSig = 0x29;
+    boot->BS_VolID = (unsigned int) seed;
+    memcpy(boot->BS_VolLab, "NO NAME    ", 11);
+    memcpy(boot->BS_FilSysType, "FAT32   ", 8);
+    disk[510] = 0x55;
+    disk[511] = 0xaa;
+    unsigned int fatStart = RESERVED_SECTORS*BYTES_PER_SECTOR;
+    unsigned long long dataStart = fatStart+(unsigned long long) numOfFats*fatSectors*BYTES_PER_SECTOR;
+    setFat(disk, fatStart, 0, 0x0ffffff8);
+    setFat(disk, fatStart, 1, 0x0fffffff);
+    // directories first, each one contiguous (the root directory starts at cluster 2)
+    unsigned int nextFree = 2;
+    for(unsigned int d = 0; d < numOfDirs; d++){
+        dirStart[d] = nextFree;
+        for(unsigned int k = 0; k < dirClusters[d]; k++){
+            setFat(disk, fatStart, nextFree+k, k == dirClusters[d]-1 ? FAT_END_OF_CHAIN : nextFree+k+1);
+        }
+        nextFree += dirClusters[d];
+    }
+    unsigned int* dirFill = (unsigned int*) calloc(numOfDirs, sizeof(unsigned int));
+    for(unsigned int d = 1; d < numOfDirs; d++){
+        char name[16];
+        snprintf(name, sizeof(name), "D%07u   ", d);
+        DirEntry* rootEntries = (DirEntry*) &disk[dataStart+(unsigned long long) (dirStart[0]-2)*bytesPerClus];
+        fillDirEntry(&rootEntries[dirFill[0]++], name, ATTR_DIRECTORY, dirStart[d], 0);
+        DirEntry* subEntries = (DirEntry*) &disk[dataStart+(unsigned long long) (dirStart[d]-2)*bytesPerClus];
+        fillDirEntry(&subEntries[dirFill[d]++], ".          ", ATTR_DIRECTORY, dirStart[d], 0);
+        fillDirEntry(&subEntries[dirFill[d]++], "..         ", ATTR_DIRECTORY, 0, 0);
+    }
+    char manifestName[4096];
+    snprintf(manifestName, sizeof(manifestName), "%s.manifest", output);
+    FILE* manifest = fopen(manifestName, "w");
+    if(!manifest){
+        perror(manifestName);
+        return 1;
+    }
+    unsigned char* noise = (unsigned char*) malloc(bytesPerClus);
+    for(unsigned int i = 0; i < numOfFiles; i++){
+        GenFile* file = &files[i];
+        unsigned int firstHalf = file->fragmented ? (file->clusters+1)/2 : file->clusters;
+        file->firstCluster = nextFree;
+        file->splitCluster = nextFree+firstHalf+(file->fragmented ? 1 : 0);
+        // contents come from the same random stream, hashed as they are written
+        SHA_CTX ctx;
+        SHA1_Init(&ctx);
+        unsigned int written = 0;
+        for(unsigned int k = 0; k < file->clusters; k++){
+            unsigned int clus = k < firstHalf ? file->firstCluster+k : file->splitCluster+(k-firstHalf);
+            unsigned char* content = &disk[dataStart+(unsigned long long) (clus-2)*bytesPerClus];
+            unsigned int length = file->size-written < bytesPerClus ? file->size-written : bytesPerClus;
+            for(unsigned int b = 0; b < length; b += 8){
+                unsigned long long value = nextRandom();
+                memcpy(&content[b], &value, length-b < 8 ? length-b : 8);
+            }
+            SHA1_Update(&ctx, content, length);
+            written += length;
+            if(!file->deleted){
+                unsigned int next = k+1 == firstHalf ? file->splitCluster : clus+1;
+                setFat(disk, fatStart, clus, k == file->clusters-1 ? FAT_END_OF_CHAIN : next);
+            }
+        }
+        if(file->fragmented){
+            // the gap between the two halves is free and full of noise
+            for(unsigned int b = 0; b < bytesPerClus; b += 8){
+                unsigned long long value = nextRandom();
+                memcpy(&noise[b], &value, 8);
+            }
+            memcpy(&disk[dataStart+(unsigned long long) (file->firstCluster+firstHalf-2)*bytesPerClus], noise, bytesPerClus);
+        }
+        nextFree += file->clusters+(file->fragmented ? 1 : 0);
+        char name[16];
+        snprintf(name, sizeof(name), "F%07uDAT", i);
+        if(file->deleted){
+            name[0] = (char) DELETED_ENTRY;
+        }
+        DirEntry* entries = (DirEntry*) &disk[dataStart+(unsigned long long) (dirStart[file->dir]-2)*bytesPerClus];
+        fillDirEntry(&entries[dirFill[file->dir]++], name, 0x20, file->firstCluster, file->size);
+        if(file->deleted){
+            unsigned char digest[SHA_DIGEST_LENGTH];
+            SHA1_Final(digest, &ctx);
+            if(file->dir){
+                fprintf(manifest, "D%07u/", file->dir);
+            }
+            fprintf(manifest, "F%07u.DAT ", i);
+            for(unsigned int b = 0; b < SHA_DIGEST_LENGTH; b++){
+                fprintf(manifest, "%02x", digest[b]);
+            }
+            fprintf(manifest, " %u %u %d\n", file->size, file->clusters, file->fragmented);
+        }
+    }
+    fclose(manifest);
+    // every FAT is a copy of the first one
+    for(unsigned int j = 1; j < numOfFats; j++){
+        memcpy(&disk[fatStart+(unsigned long long) j*fatSectors*BYTES_PER_SECTOR], &disk[fatStart], (unsigned long long) fatSectors*BYTES_PER_SECTOR);
+    }
+    munmap(disk, imageSize);
+    close(fd);
+    printf("%s: %llu bytes, %u clusters of %u bytes, %u files in %u directories\n", output, imageSize, totalClusters, bytesPerClus, numOfFiles, numOfDirs);
+    free(noise);
+    free(files);
+    free(dirEntries);
+    free(dirClusters);
+    free(dirStart);
+    free(dirFill);
+    return 0;
+}
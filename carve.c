@@ -0,0 +1,256 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "carve.h"
+#include "fetch.h"
+#include "stats.h"
+
+const CarveType carveTypes[NUM_CARVE_TYPES] = {
+    {"jpg", (const unsigned char*) "\xff\xd8\xff", 3, (const unsigned char*) "\xff\xd9", 2, FALSE, 64ULL << 20},
+    {"png", (const unsigned char*) "\x89PNG\r\n\x1a\n", 8, (const unsigned char*) "IEND\xae\x42\x60\x82", 8, FALSE, 64ULL << 20},
+    {"pdf", (const unsigned char*) "%PDF-", 5, (const unsigned char*) "%%EOF", 5, FALSE, 256ULL << 20},
+    {"zip", (const unsigned char*) "PK\x03\x04", 4, (const unsigned char*) "PK\x05\x06", 4, TRUE, 256ULL << 20},
+};
+
+// trie of every footer, then failure links breadth first so matching never backtracks
+void buildFooterMatcher(FooterMatcher* matcher){
+    memset(matcher->next, -1, sizeof(matcher->next));
+    memset(matcher->out, 0, sizeof(matcher->out));
+    matcher->stateCount = 1;
+    for(unsigned int t = 0; t < NUM_CARVE_TYPES; t++){
+        int state = 0;
+        for(unsigned int k = 0; k < carveTypes[t].footerLength; k++){
+            unsigned char byte = carveTypes[t].footer[k];
+            if(matcher->next[state][byte] == -1){
+                matcher->next[state][byte] = matcher->stateCount++;
+            }
+            state = matcher->next[state][byte];
+        }
+        matcher->out[state] |= 1U << t;
+    }
+    int fail[MAX_FOOTER_STATES];
+    int queue[MAX_FOOTER_STATES];
+    unsigned int head = 0;
+    unsigned int tail = 0;
+    for(unsigned int byte = 0; byte < 256; byte++){
+        int child = matcher->next[0][byte];
+        if(child == -1){
+            matcher->next[0][byte] = 0;
+        }
+        else{
+            fail[child] = 0;
+            queue[tail++] = child;
+        }
+    }
+    while(head < tail){
+        int state = queue[head++];
+        matcher->out[state] |= matcher->out[fail[state]];
+        for(unsigned int byte = 0; byte < 256; byte++){
+            int child = matcher->next[state][byte];
+            if(child == -1){
+                matcher->next[state][byte] = matcher->next[fail[state]][byte];
+            }
+            else{
+                fail[child] = matcher->next[fail[state]][byte];
+                queue[tail++] = child;
+            }
+        }
+    }
+    return;
+}
+void addCarveHit(Carver* carver, unsigned int cluster, unsigned int type){
+    pthread_mutex_lock(&carver->lock);
+    if(carver->hitCount == carver->hitCapacity){
+        carver->hitCapacity = carver->hitCapacity ? carver->hitCapacity*2 : 64;
+        carver->hits = (CarveHit*) realloc(carver->hits, sizeof(CarveHit)*carver->hitCapacity);
+    }
+    carver->hits[carver->hitCount].cluster = cluster;
+    carver->hits[carver->hitCount].type = type;
+    carver->hits[carver->hitCount].size = 0;
+    carver->hitCount++;
+    pthread_mutex_unlock(&carver->lock);
+    return;
+}
+typedef struct CarveWorker {
+    Carver* carver;
+    unsigned int firstCluster;
+    unsigned int lastCluster;           // one past the end of this worker's range
+} CarveWorker;
+// next cluster from c on (within the worker's range) that is free and not inside a hole
+unsigned int nextHeaderCandidate(CarveWorker* worker, unsigned int c, unsigned long long* dataEnd){
+    Carver* carver = worker->carver;
+    FatTable* fat = carver->fat;
+    Storage* storage = carver->storage;
+    for(; c < worker->lastCluster; c++){
+        // skip 64 allocated clusters at a time
+        if(c%64 == 0 && fat->freeMap[c/64] == 0){
+            c += 63;
+            continue;
+        }
+        unsigned long long offset = clusterStart(carver->geometry, c);
+        if(!isFreeCluster(fat, c) || offset+carver->geometry->bytesPerClus > storage->size){
+            continue;
+        }
+        // holes of a sparse image read as zeros, nothing to find there
+        if(storage->isSparse && offset >= *dataEnd){
+            unsigned long long data = nextStorageData(storage, offset);
+            if(data >= offset+carver->geometry->bytesPerClus){
+                // resume at the cluster holding the next data
+                unsigned long long skip = (data-offset) >> carver->geometry->clusShift;
+                c = skip < worker->lastCluster-c ? c+(unsigned int) skip-1 : worker->lastCluster;
+                continue;
+            }
+            *dataEnd = nextStorageHole(storage, data);
+        }
+        return c;
+    }
+    return worker->lastCluster;
+}
+// pass 1: every free cluster of one range that starts with a known header
+// (the first bytes of FETCH_DEPTH candidates are in flight at any time)
+void* headerScanWorker(void* arg){
+    CarveWorker* worker = (CarveWorker*) arg;
+    Carver* carver = worker->carver;
+    unsigned int headerBytes = carver->geometry->bytesPerClus < MAX_HEADER_LENGTH ? carver->geometry->bytesPerClus : MAX_HEADER_LENGTH;
+    FetchQueue queue;
+    initFetchQueue(&queue, carver->storage, FETCH_DEPTH, headerBytes);
+    unsigned long long dataEnd = 0;
+    unsigned int c = nextHeaderCandidate(worker, worker->firstCluster, &dataEnd);
+    unsigned long long issued = 0;
+    unsigned long long consumed = 0;
+    while(TRUE){
+        while(issued-consumed < FETCH_DEPTH && c < worker->lastCluster){
+            submitFetch(&queue, issued%FETCH_DEPTH, clusterStart(carver->geometry, c), headerBytes, c);
+            issued++;
+            c = nextHeaderCandidate(worker, c+1, &dataEnd);
+        }
+        if(consumed == issued){
+            break;
+        }
+        unsigned int slot = consumed%FETCH_DEPTH;
+        const unsigned char* content = waitFetch(&queue, slot);
+        consumed++;
+        if(!content){
+            continue;
+        }
+        countStat(STAT_CLUSTERS_READ, 1);
+        for(unsigned int t = 0; t < NUM_CARVE_TYPES; t++){
+            if(carveTypes[t].headerLength <= headerBytes
+            && memcmp(content, carveTypes[t].header, carveTypes[t].headerLength) == 0){
+                addCarveHit(carver, (unsigned int) queue.slots[slot].tag, t);
+                break;
+            }
+        }
+    }
+    freeFetchQueue(&queue);
+    return NULL;
+}
+// follow free clusters from the header until the footer of the same type shows up
+void findFooter(Carver* carver, CarveHit* hit, unsigned char* scratch){
+    const CarveType* type = &carveTypes[hit->type];
+    FooterMatcher* matcher = &carver->matcher;
+    unsigned long long start = clusterStart(carver->geometry, hit->cluster);
+    unsigned long long limit = carver->storage->size-start;
+    if(limit > type->maxSize){
+        limit = type->maxSize;
+    }
+    const unsigned char* content = NULL;
+    int state = 0;
+    for(unsigned long long i = 0; i < limit; i++){
+        // deleted files are assumed contiguous - an allocated cluster ends the search
+        if((i & carver->geometry->clusMask) == 0){
+            if(!isFreeCluster(carver->fat, hit->cluster+(unsigned int) (i >> carver->geometry->clusShift))){
+                return;
+            }
+            // one cluster at a time (the last one may be cut short by the end of the image)
+            unsigned long long length = limit-i < carver->geometry->bytesPerClus ? limit-i : carver->geometry->bytesPerClus;
+            content = viewStorage(carver->storage, start+i, length, scratch);
+            if(!content){
+                return;
+            }
+        }
+        state = matcher->next[state][content[i & carver->geometry->clusMask]];
+        if(!(matcher->out[state] >> hit->type & 1) || i+1 < type->headerLength+type->footerLength){
+            continue;
+        }
+        unsigned long long size = i+1;
+        if(type->zipComment){
+            // end of central directory: 18 more bytes, the last two are the comment length
+            if(size+18 > limit){
+                return;
+            }
+            unsigned char commentLength[2];
+            if(!readStorage(carver->storage, start+size+16, commentLength, 2)){
+                return;
+            }
+            size += 18+(commentLength[0] | (commentLength[1] << 8));
+            if(size > limit){
+                return;
+            }
+        }
+        hit->size = size;
+        return;
+    }
+    return;
+}
+// pass 2: footer search, one header at a time to whichever worker is free
+void* footerScanWorker(void* arg){
+    Carver* carver = ((CarveWorker*) arg)->carver;
+    unsigned char* scratch = carver->storage->map ? NULL : (unsigned char*) malloc(carver->geometry->bytesPerClus);
+    while(TRUE){
+        unsigned int h = __atomic_fetch_add(&carver->nextHit, 1, __ATOMIC_RELAXED);
+        if(h >= carver->hitCount){
+            break;
+        }
+        findFooter(carver, &carver->hits[h], scratch);
+    }
+    free(scratch);
+    return NULL;
+}
+int compareCarveHits(const void* a, const void* b){
+    const CarveHit* hitA = (const CarveHit*) a;
+    const CarveHit* hitB = (const CarveHit*) b;
+    return (hitA->cluster > hitB->cluster)-(hitA->cluster < hitB->cluster);
+}
+// find every carvable file in the unallocated clusters, sorted by starting cluster
+void carveFreeClusters(Carver* carver){
+    unsigned long long started = beginPhase();
+    carver->hits = NULL;
+    carver->hitCount = 0;
+    carver->hitCapacity = 0;
+    carver->nextHit = 0;
+    buildFooterMatcher(&carver->matcher);
+    pthread_mutex_init(&carver->lock, NULL);
+    long numOfCpus = sysconf(_SC_NPROCESSORS_ONLN);
+    carver->numOfWorkers = numOfCpus > 0 ? (unsigned int) numOfCpus : 1;
+    pthread_t* threads = (pthread_t*) malloc(sizeof(pthread_t)*carver->numOfWorkers);
+    CarveWorker* workers = (CarveWorker*) malloc(sizeof(CarveWorker)*carver->numOfWorkers);
+    // split the data area into one cluster range per worker (multiples of 64 so bitmap words aren't shared)
+    unsigned int endCluster = carver->fat->totalClusters+2;
+    unsigned int perWorker = ((endCluster+carver->numOfWorkers-1)/carver->numOfWorkers+63) & ~63U;
+    for(unsigned int i = 0; i < carver->numOfWorkers; i++){
+        workers[i].carver = carver;
+        workers[i].firstCluster = i == 0 ? 2 : i*perWorker;
+        // the last worker always runs to the end of the data area
+        workers[i].lastCluster = (i+1)*perWorker < endCluster && i+1 < carver->numOfWorkers ? (i+1)*perWorker : endCluster;
+        if(workers[i].firstCluster > workers[i].lastCluster){
+            workers[i].firstCluster = workers[i].lastCluster;
+        }
+        pthread_create(&threads[i], NULL, headerScanWorker, &workers[i]);
+    }
+    for(unsigned int i = 0; i < carver->numOfWorkers; i++){
+        pthread_join(threads[i], NULL);
+    }
+    qsort(carver->hits, carver->hitCount, sizeof(CarveHit), compareCarveHits);
+    for(unsigned int i = 0; i < carver->numOfWorkers; i++){
+        pthread_create(&threads[i], NULL, footerScanWorker, &workers[i]);
+    }
+    for(unsigned int i = 0; i < carver->numOfWorkers; i++){
+        pthread_join(threads[i], NULL);
+    }
+    free(threads);
+    free(workers);
+    pthread_mutex_destroy(&carver->lock);
+    endPhase(STAT_PHASE_CARVE, started);
+    return;
+}
@@ -0,0 +1,60 @@
+#ifndef CARVE_H
+#define CARVE_H
+
+#include <pthread.h>
+#include "nyufile.h"
+#include "fat.h"
+#include "storage.h"
+#include "geometry.h"
+
+// longest footer pattern and number of file types the carver knows
+#define MAX_FOOTER_STATES 64
+#define NUM_CARVE_TYPES 4
+// longest header pattern (bytes read from each free cluster in the header scan)
+#define MAX_HEADER_LENGTH 8
+
+// a file type recognised by the signature at the start of a cluster
+typedef struct CarveType {
+    const char* ext;
+    const unsigned char* header;
+    unsigned int headerLength;
+    const unsigned char* footer;
+    unsigned int footerLength;
+    int zipComment;                     // footer is a ZIP end record followed by a comment
+    unsigned long long maxSize;         // give up if no footer within this many bytes
+} CarveType;
+
+// Aho-Corasick automaton over the footers of every type
+typedef struct FooterMatcher {
+    int next[MAX_FOOTER_STATES][256];
+    unsigned int out[MAX_FOOTER_STATES];    // bit t set when the footer of type t ends in this state
+    unsigned int stateCount;
+} FooterMatcher;
+
+// one carved (or attempted) file
+typedef struct CarveHit {
+    unsigned int cluster;
+    unsigned int type;
+    unsigned long long size;            // 0 until a footer was found
+} CarveHit;
+
+// state shared by the carving threads
+typedef struct Carver {
+    Storage* storage;
+    Geometry* geometry;
+    FatTable* fat;
+    FooterMatcher matcher;
+    unsigned int numOfWorkers;
+    CarveHit* hits;
+    unsigned int hitCount;
+    unsigned int hitCapacity;
+    unsigned int nextHit;               // next hit handed out for footer search
+    pthread_mutex_t lock;
+} Carver;
+
+extern const CarveType carveTypes[NUM_CARVE_TYPES];
+
+void buildFooterMatcher(FooterMatcher* matcher);
+void carveFreeClusters(Carver* carver);
+
+#endif
@@ -0,0 +1,335 @@
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "clusterhash.h"
+#include "fetch.h"
+#include "stats.h"
+
+#define XXH_PRIME64_1 0x9e3779b185ebca87ULL
+#define XXH_PRIME64_2 0xc2b2ae3d27d4eb4fULL
+#define XXH_PRIME64_3 0x165667b19e3779f9ULL
+#define XXH_PRIME64_4 0x85ebca77c2b2ae63ULL
+#define XXH_PRIME64_5 0x27d4eb2f165667c5ULL
+
+unsigned long long rotl64(unsigned long long value, unsigned int bits){
+    return (value << bits) | (value >> (64-bits));
+}
+unsigned long long read64(const unsigned char* bytes){
+    unsigned long long value;
+    memcpy(&value, bytes, 8);
+    return value;
+}
+unsigned long long xxh64Round(unsigned long long acc, unsigned long long input){
+    acc += input*XXH_PRIME64_2;
+    return rotl64(acc, 31)*XXH_PRIME64_1;
+}
+unsigned long long xxh64Merge(unsigned long long acc, unsigned long long value){
+    acc ^= xxh64Round(0, value);
+    return acc*XXH_PRIME64_1+XXH_PRIME64_4;
+}
+// XXH64 (little-endian hosts): four independent lanes over 32-byte stripes, then the tail
+unsigned long long xxh64(const void* data, size_t length, unsigned long long seed){
+    const unsigned char* bytes = (const unsigned char*) data;
+    const unsigned char* end = bytes+length;
+    unsigned long long hash;
+    if(length >= 32){
+        unsigned long long v1 = seed+XXH_PRIME64_1+XXH_PRIME64_2;
+        unsigned long long v2 = seed+XXH_PRIME64_2;
+        unsigned long long v3 = seed;
+        unsigned long long v4 = seed-XXH_PRIME64_1;
+        for(; bytes+32 <= end; bytes += 32){
+            v1 = xxh64Round(v1, read64(bytes));
+            v2 = xxh64Round(v2, read64(bytes+8));
+            v3 = xxh64Round(v3, read64(bytes+16));
+            v4 = xxh64Round(v4, read64(bytes+24));
+        }
+        hash = rotl64(v1, 1)+rotl64(v2, 7)+rotl64(v3, 12)+rotl64(v4, 18);
+        hash = xxh64Merge(hash, v1);
+        hash = xxh64Merge(hash, v2);
+        hash = xxh64Merge(hash, v3);
+        hash = xxh64Merge(hash, v4);
+    }
+    else{
+        hash = seed+XXH_PRIME64_5;
+    }
+    hash += (unsigned long long) length;
+    for(; bytes+8 <= end; bytes += 8){
+        hash ^= xxh64Round(0, read64(bytes));
+        hash = rotl64(hash, 27)*XXH_PRIME64_1+XXH_PRIME64_4;
+    }
+    if(bytes+4 <= end){
+        unsigned int word;
+        memcpy(&word, bytes, 4);
+        hash ^= (unsigned long long) word*XXH_PRIME64_1;
+        hash = rotl64(hash, 23)*XXH_PRIME64_2+XXH_PRIME64_3;
+        bytes += 4;
+    }
+    for(; bytes < end; bytes++){
+        hash ^= (unsigned long long) *bytes*XXH_PRIME64_5;
+        hash = rotl64(hash, 11)*XXH_PRIME64_1;
+    }
+    hash ^= hash >> 33;
+    hash *= XXH_PRIME64_2;
+    hash ^= hash >> 29;
+    hash *= XXH_PRIME64_3;
+    hash ^= hash >> 32;
+    return hash;
+}
+// the lookup side: every cluster goes into the chain of its content, lowest cluster first
+void indexClusterHashes(ClusterHashTable* table){
+    unsigned int slotCount = 16;
+    while(slotCount < 2ULL*table->totalClusters){
+        slotCount *= 2;
+    }
+    table->slotMask = slotCount-1;
+    table->slots = (unsigned int*) calloc(slotCount, sizeof(unsigned int));
+    table->next = (unsigned int*) calloc(table->totalClusters+2, sizeof(unsigned int));
+    table->distinctCount = 0;
+    // from the top down so each chain ends up in ascending order
+    for(unsigned int c = table->totalClusters+1; c >= 2; c--){
+        unsigned long long hash = table->hashes[c-2];
+        if(hash == CLUSTER_HASH_MISSING){
+            continue;
+        }
+        unsigned int slot = (unsigned int) hash & table->slotMask;
+        while(table->slots[slot] && table->hashes[table->slots[slot]-2] != hash){
+            slot = (slot+1) & table->slotMask;
+        }
+        if(!table->slots[slot]){
+            table->distinctCount++;
+        }
+        table->next[c] = table->slots[slot];
+        table->slots[slot] = c;
+    }
+    return;
+}
+// lowest cluster whose content hashes to hash (0 when there is none)
+unsigned int findClusterHash(ClusterHashTable* table, unsigned long long hash){
+    if(hash == CLUSTER_HASH_MISSING){
+        return 0;
+    }
+    for(unsigned int slot = (unsigned int) hash & table->slotMask; table->slots[slot]; slot = (slot+1) & table->slotMask){
+        if(table->hashes[table->slots[slot]-2] == hash){
+            return table->slots[slot];
+        }
+    }
+    return 0;
+}
+// next cluster after cluster with the same content (0 when there is none)
+unsigned int nextClusterWithHash(ClusterHashTable* table, unsigned int cluster){
+    return table->next[cluster];
+}
+typedef struct ClusterHashWorker {
+    Storage* storage;
+    Geometry* geometry;
+    unsigned long long* hashes;
+    unsigned int firstCluster;
+    unsigned int lastCluster;           // one past the end of this worker's range
+    unsigned int depth;                 // reads this worker keeps in flight
+} ClusterHashWorker;
+// hash one range of clusters, CLUSTER_HASH_RUN bytes per read and depth reads in flight
+void* clusterHashWorker(void* arg){
+    ClusterHashWorker* worker = (ClusterHashWorker*) arg;
+    Geometry* geometry = worker->geometry;
+    Storage* storage = worker->storage;
+    unsigned int runClusters = CLUSTER_HASH_RUN >> geometry->clusShift ? CLUSTER_HASH_RUN >> geometry->clusShift : 1;
+    FetchQueue queue;
+    initFetchQueue(&queue, storage, worker->depth, runClusters << geometry->clusShift);
+    unsigned int c = worker->firstCluster;
+    unsigned long long issued = 0;
+    unsigned long long consumed = 0;
+    while(TRUE){
+        while(issued-consumed < worker->depth && c < worker->lastCluster){
+            unsigned int count = worker->lastCluster-c < runClusters ? worker->lastCluster-c : runClusters;
+            unsigned long long start = clusterStart(geometry, c);
+            // clusters past the end of a truncated image have no content to hash
+            unsigned int present = 0;
+            if(start < storage->size){
+                unsigned long long held = (storage->size-start) >> geometry->clusShift;
+                present = held < count ? (unsigned int) held : count;
+            }
+            for(unsigned int k = present; k < count; k++){
+                worker->hashes[c-2+k] = CLUSTER_HASH_MISSING;
+            }
+            if(present){
+                submitFetch(&queue, issued%worker->depth, start, present << geometry->clusShift, c);
+                issued++;
+            }
+            c += count;
+        }
+        if(consumed == issued){
+            break;
+        }
+        unsigned int slot = consumed%worker->depth;
+        const unsigned char* content = waitFetch(&queue, slot);
+        unsigned int first = (unsigned int) queue.slots[slot].tag;
+        unsigned int present = queue.slots[slot].length >> geometry->clusShift;
+        consumed++;
+        for(unsigned int k = 0; k < present; k++){
+            worker->hashes[first-2+k] = content ? xxh64(&content[(unsigned long long) k << geometry->clusShift], geometry->bytesPerClus, 0) : CLUSTER_HASH_MISSING;
+        }
+        if(content){
+            countStat(STAT_CLUSTERS_READ, present);
+            countStat(STAT_BYTES_HASHED, (unsigned long long) present << geometry->clusShift);
+        }
+    }
+    freeFetchQueue(&queue);
+    return NULL;
+}
+// hash every data cluster, one cluster range per CPU
+void buildClusterHashTable(Storage* storage, Geometry* geometry, ClusterHashTable* table){
+    unsigned long long started = beginPhase();
+    table->totalClusters = geometry->totalClusters;
+    table->hashes = (unsigned long long*) malloc(sizeof(unsigned long long)*(table->totalClusters ? table->totalClusters : 1));
+    table->mapping = NULL;
+    table->mappingSize = 0;
+    long numOfCpus = sysconf(_SC_NPROCESSORS_ONLN);
+    unsigned int numOfWorkers = numOfCpus > 0 ? (unsigned int) numOfCpus : 1;
+    unsigned int perWorker = (table->totalClusters+numOfWorkers-1)/numOfWorkers;
+    unsigned int endCluster = table->totalClusters+2;
+    pthread_t* threads = (pthread_t*) malloc(sizeof(pthread_t)*numOfWorkers);
+    ClusterHashWorker* workers = (ClusterHashWorker*) malloc(sizeof(ClusterHashWorker)*numOfWorkers);
+    // FETCH_DEPTH reads in flight between all of them
+    unsigned int depth = FETCH_DEPTH/numOfWorkers > 4 ? FETCH_DEPTH/numOfWorkers : 4;
+    for(unsigned int i = 0; i < numOfWorkers; i++){
+        workers[i].storage = storage;
+        workers[i].geometry = geometry;
+        workers[i].hashes = table->hashes;
+        workers[i].depth = depth;
+        workers[i].firstCluster = 2+(unsigned long long) i*perWorker < endCluster ? 2+i*perWorker : endCluster;
+        workers[i].lastCluster = 2+(unsigned long long) (i+1)*perWorker < endCluster ? 2+(i+1)*perWorker : endCluster;
+        pthread_create(&threads[i], NULL, clusterHashWorker, &workers[i]);
+    }
+    for(unsigned int i = 0; i < numOfWorkers; i++){
+        pthread_join(threads[i], NULL);
+    }
+    free(threads);
+    free(workers);
+    endPhase(STAT_PHASE_HASH, started);
+    indexClusterHashes(table);
+    return;
+}
+// map image.nyuclus if it was built from this exact image (same size, mtime and cluster layout)
+int loadClusterHashTable(char* tablePath, Storage* storage, Geometry* geometry, ClusterHashTable* table){
+    struct stat imageStat;
+    struct stat tableStat;
+    // a block device's mtime doesn't follow writes
+    if(storage->isDevice || fstat(storage->fd, &imageStat) == -1){
+        return FALSE;
+    }
+    int fd = open(tablePath, O_RDONLY);
+    if(fd == -1){
+        return FALSE;
+    }
+    if(fstat(fd, &tableStat) == -1 || (unsigned long long) tableStat.st_size < sizeof(ClusterHashHeader)){
+        close(fd);
+        return FALSE;
+    }
+    size_t size = tableStat.st_size;
+    unsigned char* map = (unsigned char*) mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(map == MAP_FAILED){
+        return FALSE;
+    }
+    ClusterHashHeader* header = (ClusterHashHeader*) map;
+    int valid = memcmp(header->magic, CLUSTER_HASH_MAGIC, 8) == 0
+    && header->imageSize == storage->size
+    && header->mtimeSec == (long long) imageStat.st_mtim.tv_sec
+    && header->mtimeNsec == (long long) imageStat.st_mtim.tv_nsec
+    && header->bytesPerClus == geometry->bytesPerClus
+    && header->totalClusters == geometry->totalClusters
+    && size == sizeof(ClusterHashHeader)+sizeof(unsigned long long)*(unsigned long long) header->totalClusters;
+    if(!valid){
+        munmap(map, size);
+        return FALSE;
+    }
+    table->totalClusters = header->totalClusters;
+    table->hashes = (unsigned long long*) &map[sizeof(ClusterHashHeader)];
+    table->mapping = map;
+    table->mappingSize = size;
+    indexClusterHashes(table);
+    return TRUE;
+}
+// write the table for the image as it is now (written aside, then renamed over the old one)
+int saveClusterHashTable(char* tablePath, Storage* storage, Geometry* geometry, ClusterHashTable* table){
+    struct stat imageStat;
+    if(storage->isDevice || fstat(storage->fd, &imageStat) == -1){
+        return FALSE;
+    }
+    ClusterHashHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CLUSTER_HASH_MAGIC, 8);
+    header.imageSize = storage->size;
+    header.mtimeSec = imageStat.st_mtim.tv_sec;
+    header.mtimeNsec = imageStat.st_mtim.tv_nsec;
+    header.bytesPerClus = geometry->bytesPerClus;
+    header.totalClusters = table->totalClusters;
+    char tempPath[4096];
+    snprintf(tempPath, sizeof(tempPath), "%s.tmp", tablePath);
+    FILE* file = fopen(tempPath, "wb");
+    if(!file){
+        return FALSE;
+    }
+    int ok = fwrite(&header, sizeof(header), 1, file) == 1
+    && fwrite(table->hashes, sizeof(unsigned long long), table->totalClusters, file) == table->totalClusters;
+    ok = fclose(file) == 0 && ok;
+    if(!ok || rename(tempPath, tablePath) == -1){
+        unlink(tempPath);
+        return FALSE;
+    }
+    return TRUE;
+}
+void freeClusterHashTable(ClusterHashTable* table){
+    if(table->mapping){
+        munmap(table->mapping, table->mappingSize);
+    }
+    else{
+        free(table->hashes);
+    }
+    free(table->slots);
+    free(table->next);
+    table->hashes = NULL;
+    table->slots = NULL;
+    table->next = NULL;
+    table->mapping = NULL;
+    return;
+}
+// content identity of a file laid out in extents: its whole clusters come from the table, only the
+// partial last cluster is read (the slack after the file differs between copies); FALSE if unreadable
+int fileContentHash(ClusterHashTable* table, Storage* storage, Geometry* geometry, FatExtent* extents, unsigned int extentCount,
+unsigned long long fileSize, unsigned long long* hash){
+    unsigned long long value = fileSize;
+    unsigned long long remaining = fileSize;
+    for(unsigned int e = 0; e < extentCount && remaining > 0; e++){
+        for(unsigned int c = extents[e].start; c < extents[e].start+extents[e].length && remaining > 0; c++){
+            if(c < 2 || c >= table->totalClusters+2){
+                return FALSE;
+            }
+            if(remaining >= geometry->bytesPerClus){
+                if(table->hashes[c-2] == CLUSTER_HASH_MISSING){
+                    return FALSE;
+                }
+                value = xxh64(&table->hashes[c-2], sizeof(unsigned long long), value);
+                remaining -= geometry->bytesPerClus;
+                continue;
+            }
+            unsigned char* scratch = storage->map ? NULL : (unsigned char*) malloc(remaining);
+            const unsigned char* tail = viewStorage(storage, clusterStart(geometry, c), remaining, scratch);
+            if(tail){
+                value = xxh64(tail, remaining, value);
+            }
+            free(scratch);
+            if(!tail){
+                return FALSE;
+            }
+            remaining = 0;
+        }
+    }
+    *hash = value;
+    return remaining == 0;
+}
@@ -0,0 +1,51 @@
+#ifndef CLUSTERHASH_H
+#define CLUSTERHASH_H
+
+#include <stddef.h>
+#include "nyufile.h"
+#include "fat.h"
+#include "storage.h"
+#include "geometry.h"
+
+// bump the version whenever the hash or the layout changes
+#define CLUSTER_HASH_MAGIC "NYUCLH01"
+// bytes each hashing thread reads at a time (whole clusters; every worker keeps a few such reads in flight)
+#define CLUSTER_HASH_RUN (256U << 10)
+// hash of a cluster the image doesn't fully hold (never looked up)
+#define CLUSTER_HASH_MISSING 0
+// clusters -L lists per block (the rest are only counted)
+#define CLUSTER_HASH_MAX_LISTED 8
+
+// start of image.nyuclus, followed by one hash per data cluster
+typedef struct ClusterHashHeader {
+    char magic[8];
+    unsigned long long imageSize;
+    long long mtimeSec;
+    long long mtimeNsec;
+    unsigned int bytesPerClus;
+    unsigned int totalClusters;
+} ClusterHashHeader;
+
+// XXH64 of every data cluster, with a lookup from a hash to the clusters holding that content
+typedef struct ClusterHashTable {
+    unsigned long long* hashes;         // hashes[c-2] for cluster c
+    unsigned int totalClusters;
+    unsigned int* slots;                // open addressing on the hash: lowest cluster of each distinct content (0 = empty)
+    unsigned int slotMask;
+    unsigned int* next;                 // next[c]: next higher cluster with the same content (0 = none)
+    unsigned int distinctCount;
+    void* mapping;                      // image.nyuclus the hashes point into (NULL when built)
+    size_t mappingSize;
+} ClusterHashTable;
+
+unsigned long long xxh64(const void* data, size_t length, unsigned long long seed);
+void buildClusterHashTable(Storage* storage, Geometry* geometry, ClusterHashTable* table);
+int loadClusterHashTable(char* tablePath, Storage* storage, Geometry* geometry, ClusterHashTable* table);
+int saveClusterHashTable(char* tablePath, Storage* storage, Geometry* geometry, ClusterHashTable* table);
+void freeClusterHashTable(ClusterHashTable* table);
+unsigned int findClusterHash(ClusterHashTable* table, unsigned long long hash);
+unsigned int nextClusterWithHash(ClusterHashTable* table, unsigned int cluster);
+int fileContentHash(ClusterHashTable* table, Storage* storage, Geometry* geometry, FatExtent* extents, unsigned int extentCount,
+unsigned long long fileSize, unsigned long long* hash);
+
+#endif
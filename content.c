@@ -0,0 +1,184 @@
+#include <sys/mman.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "content.h"
+#include "fetch.h"
+#include "stats.h"
+
+void initContentReader(ContentReader* reader, Storage* storage, Geometry* geometry){
+    unsigned int bytesPerClus = geometry->bytesPerClus;
+    reader->storage = storage;
+    reader->geometry = geometry;
+    // large images are read through one small buffer so RSS stays flat
+    reader->usePread = storage->map == NULL || storage->size > MAX_MAPPED_CONTENT;
+    reader->buffer = NULL;
+    reader->bufferSize = 0;
+    if(reader->usePread){
+        reader->bufferSize = bytesPerClus > CONTENT_BUFFER_SIZE ? bytesPerClus : CONTENT_BUFFER_SIZE/bytesPerClus*bytesPerClus;
+        unsigned int align = storage->directAlign > CONTENT_BUFFER_ALIGN ? storage->directAlign : CONTENT_BUFFER_ALIGN;
+        if(posix_memalign((void**) &reader->buffer, align, reader->bufferSize+2*align) != 0){
+            reader->buffer = NULL;
+        }
+    }
+    return;
+}
+void freeContentReader(ContentReader* reader){
+    free(reader->buffer);
+    reader->buffer = NULL;
+    return;
+}
+// hash the first `bytes` bytes of clusterCount consecutive clusters
+int hashClusterRun(ContentReader* reader, SHA_CTX* ctx, unsigned int firstClus, unsigned int clusterCount, unsigned long long bytes){
+    if(firstClus < 2){
+        return FALSE;
+    }
+    unsigned long long start = clusterStart(reader->geometry, firstClus);
+    unsigned long long runBytes = (unsigned long long) clusterCount << reader->geometry->clusShift;
+    if(bytes > runBytes){
+        bytes = runBytes;
+    }
+    if(start+bytes > reader->storage->size){
+        return FALSE;
+    }
+    countStat(STAT_CLUSTERS_READ, clustersFor(reader->geometry, bytes));
+    countStat(STAT_BYTES_HASHED, bytes);
+    if(!reader->usePread){
+        // tell the kernel we read the run front to back once
+        long pageSize = sysconf(_SC_PAGESIZE);
+        unsigned long long pageStart = start & ~((unsigned long long) pageSize-1);
+        unsigned char* disk = reader->storage->map;
+        madvise(&disk[pageStart], start+bytes-pageStart, MADV_SEQUENTIAL);
+        madvise(&disk[pageStart], start+bytes-pageStart, MADV_WILLNEED);
+        for(unsigned long long done = 0; done < bytes; done += reader->geometry->bytesPerClus){
+            unsigned long long length = bytes-done < reader->geometry->bytesPerClus ? bytes-done : reader->geometry->bytesPerClus;
+            SHA1_Update(ctx, &disk[start+done], length);
+        }
+        return TRUE;
+    }
+    if(!reader->buffer){
+        return FALSE;
+    }
+    // widen every read to the O_DIRECT alignment and hash only the part we asked for
+    unsigned long long align = storageAlign(reader->storage);
+    for(unsigned long long done = 0; done < bytes;){
+        unsigned long long length = bytes-done < reader->bufferSize ? bytes-done : reader->bufferSize;
+        unsigned long long head = (start+done)%align;
+        unsigned long long span = (head+length+align-1)/align*align;
+        ssize_t got = preadStorage(reader->storage, reader->buffer, span, start+done-head);
+        if(got <= 0 || (unsigned long long) got <= head){
+            return FALSE;
+        }
+        if((unsigned long long) got-head < length){
+            length = got-head;
+        }
+        SHA1_Update(ctx, &reader->buffer[head], length);
+        done += length;
+    }
+    return TRUE;
+}
+// SHA-1 of a file stored in the given clusters; consecutive clusters are read as one run
+int hashClusterList(ContentReader* reader, unsigned int* clusters, unsigned int clusterCount, unsigned int fileSize, unsigned char* digest){
+    SHA_CTX ctx;
+    SHA1_Init(&ctx);
+    unsigned long long remaining = fileSize;
+    unsigned int k = 0;
+    while(k < clusterCount && remaining > 0){
+        unsigned int runLength = 1;
+        while(k+runLength < clusterCount && clusters[k+runLength] == clusters[k]+runLength){
+            runLength++;
+        }
+        unsigned long long runBytes = (unsigned long long) runLength << reader->geometry->clusShift;
+        if(runBytes > remaining){
+            runBytes = remaining;
+        }
+        if(!hashClusterRun(reader, &ctx, clusters[k], runLength, runBytes)){
+            return FALSE;
+        }
+        remaining -= runBytes;
+        k += runLength;
+    }
+    SHA1_Final(digest, &ctx);
+    return remaining == 0;
+}
+// SHA-1 of a deleted file assumed to sit in consecutive clusters
+int hashContiguousFile(ContentReader* reader, unsigned int firstClus, unsigned int fileSize, unsigned char* digest){
+    SHA_CTX ctx;
+    SHA1_Init(&ctx);
+    if(fileSize > 0){
+        unsigned int clusterCount = clustersFor(reader->geometry, fileSize);
+        if(!hashClusterRun(reader, &ctx, firstClus, clusterCount, fileSize)){
+            return FALSE;
+        }
+    }
+    SHA1_Final(digest, &ctx);
+    return TRUE;
+}
+// SHA-1 of many contiguous files: chunk reads stay FETCH_DEPTH deep in flight and are
+// hashed in the order they were issued, so one running SHA-1 state is enough
+void hashContiguousFiles(ContentReader* reader, HashJob* jobs, unsigned int jobCount){
+    unsigned long long started = beginPhase();
+    for(unsigned int j = 0; j < jobCount; j++){
+        HashJob* job = &jobs[j];
+        unsigned long long start = clusterStart(reader->geometry, job->firstClus);
+        job->ok = job->fileSize == 0 || (job->firstClus >= 2 && start+job->fileSize <= reader->storage->size);
+        if(job->fileSize == 0){
+            SHA1(NULL, 0, job->digest);
+        }
+        else if(job->ok){
+            countStat(STAT_CLUSTERS_READ, clustersFor(reader->geometry, job->fileSize));
+        }
+    }
+    FetchQueue queue;
+    initFetchQueue(&queue, reader->storage, FETCH_DEPTH, FETCH_CHUNK);
+    unsigned int issueJob = 0;
+    unsigned long long issueDone = 0;
+    unsigned long long issued = 0;
+    unsigned long long consumed = 0;
+    SHA_CTX ctx;
+    unsigned int hashJob = jobCount;
+    unsigned long long hashed = 0;
+    while(TRUE){
+        // keep the window full
+        while(issued-consumed < FETCH_DEPTH && issueJob < jobCount){
+            HashJob* job = &jobs[issueJob];
+            if(!job->ok || issueDone >= job->fileSize){
+                issueJob++;
+                issueDone = 0;
+                continue;
+            }
+            unsigned long long start = clusterStart(reader->geometry, job->firstClus);
+            unsigned int length = job->fileSize-issueDone < FETCH_CHUNK ? (unsigned int) (job->fileSize-issueDone) : FETCH_CHUNK;
+            submitFetch(&queue, issued%FETCH_DEPTH, start+issueDone, length, issueJob);
+            issueDone += length;
+            issued++;
+        }
+        if(consumed == issued){
+            break;
+        }
+        unsigned int slot = consumed%FETCH_DEPTH;
+        const unsigned char* data = waitFetch(&queue, slot);
+        HashJob* job = &jobs[queue.slots[slot].tag];
+        if(queue.slots[slot].tag != hashJob){
+            hashJob = queue.slots[slot].tag;
+            hashed = 0;
+            SHA1_Init(&ctx);
+        }
+        consumed++;
+        if(!job->ok){
+            continue;
+        }
+        if(!data){
+            job->ok = FALSE;
+            continue;
+        }
+        SHA1_Update(&ctx, data, queue.slots[slot].length);
+        countStat(STAT_BYTES_HASHED, queue.slots[slot].length);
+        hashed += queue.slots[slot].length;
+        if(hashed == job->fileSize){
+            SHA1_Final(job->digest, &ctx);
+        }
+    }
+    freeFetchQueue(&queue);
+    endPhase(STAT_PHASE_HASH, started);
+    return;
+}
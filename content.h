@@ -0,0 +1,41 @@
+#ifndef CONTENT_H
+#define CONTENT_H
+
+#include <openssl/sha.h>
+#include "nyufile.h"
+#include "storage.h"
+#include "geometry.h"
+
+// images larger than this are never paged in through the mapping to verify content
+#ifndef MAX_MAPPED_CONTENT
+#define MAX_MAPPED_CONTENT (1ULL << 30)
+#endif
+// size of the reusable pread buffer (and the alignment it is allocated with)
+#define CONTENT_BUFFER_SIZE (1U << 20)
+#define CONTENT_BUFFER_ALIGN 4096
+
+// streams cluster data into SHA-1 either from the mapping or through pread
+typedef struct ContentReader {
+    Storage* storage;
+    Geometry* geometry;
+    int usePread;
+    unsigned char* buffer;              // aligned buffer reused by every pread (plus room to round to the O_DIRECT alignment)
+    unsigned int bufferSize;            // whole clusters that fit in CONTENT_BUFFER_SIZE
+} ContentReader;
+
+// one file of a batch hashed through the fetch pipeline
+typedef struct HashJob {
+    unsigned int firstClus;
+    unsigned int fileSize;
+    unsigned char digest[SHA_DIGEST_LENGTH];
+    int ok;                             // FALSE if the content couldn't be read
+} HashJob;
+
+void initContentReader(ContentReader* reader, Storage* storage, Geometry* geometry);
+void freeContentReader(ContentReader* reader);
+int hashClusterRun(ContentReader* reader, SHA_CTX* ctx, unsigned int firstClus, unsigned int clusterCount, unsigned long long bytes);
+int hashClusterList(ContentReader* reader, unsigned int* clusters, unsigned int clusterCount, unsigned int fileSize, unsigned char* digest);
+int hashContiguousFile(ContentReader* reader, unsigned int firstClus, unsigned int fileSize, unsigned char* digest);
+void hashContiguousFiles(ContentReader* reader, HashJob* jobs, unsigned int jobCount);
+
+#endif
@@ -0,0 +1,502 @@
+#include <sys/mman.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include "dirindex.h"
+#include "stats.h"
+
+// convert a raw 8.3 name into "NAME.EXT" form
+void decodeDirName(unsigned char* dirName, unsigned char* name){
+    unsigned int length = 0;
+    // '/' is not a valid name character, but an image may hold one anyway
+    for(unsigned int j = 0; j < 8 && dirName[j] != ' '; j++){
+        name[length++] = dirName[j] == '/' ? '_' : dirName[j];
+    }
+    if(dirName[8] != ' '){
+        name[length++] = '.';
+        for(unsigned int j = 8; j < 11 && dirName[j] != ' '; j++){
+            name[length++] = dirName[j] == '/' ? '_' : dirName[j];
+        }
+    }
+    name[length] = '\0';
+    // deleted marker is not part of the name
+    if(name[0] == DELETED_ENTRY){
+        name[0] = '?';
+    }
+    return;
+}
+// convert a user-specified name into the (upper case) 8.3 form stored on disk
+void convertToDirName(unsigned char* fileName, unsigned char* dirName){
+    memset(dirName, ' ', 11);
+    unsigned int j = 0;
+    while(fileName[j] && fileName[j] != '.' && fileName[j] != '/' && j < 8){
+        dirName[j] = (unsigned char) toupper(fileName[j]);
+        j++;
+    }
+    // skip to the extension (if any)
+    while(fileName[j] && fileName[j] != '.' && fileName[j] != '/'){
+        j++;
+    }
+    if(fileName[j] == '.'){
+        for(unsigned int k = 0; k < 3 && fileName[j+1+k]; k++){
+            dirName[8+k] = (unsigned char) toupper(fileName[j+1+k]);
+        }
+    }
+    return;
+}
+// split "dir/sub/name.ext" into the directory part and the 8.3 form of name.ext
+void buildNameQuery(unsigned char* fileName, NameQuery* query){
+    // paths are relative to the root directory
+    while(fileName[0] == '/'){
+        fileName++;
+    }
+    unsigned char* baseName = (unsigned char*) strrchr((char*) fileName, '/');
+    if(baseName){
+        query->parent = fileName;
+        query->parentLength = baseName-fileName;
+        baseName++;
+    }
+    else{
+        query->parent = NULL;
+        query->parentLength = 0;
+        baseName = fileName;
+    }
+    query->baseName = baseName;
+    convertToDirName(baseName, query->dirName);
+    return;
+}
+// deleted entry whose name matches (excluding the lost first character)
+// a bare name matches in any directory, a path only in that directory
+// a long name matches in full, case-insensitively
+int matchesDeletedName(IndexEntry* entry, NameQuery* query){
+    if(!entry->deleted){
+        return FALSE;
+    }
+    if(!sameNameTail(entry->dirName, query->dirName)
+    && !(entry->longName && strcasecmp((char*) entry->longName, (char*) query->baseName) == 0)){
+        return FALSE;
+    }
+    if(query->parent){
+        return entry->parentLength == query->parentLength
+        && strncasecmp((char*) entry->path, (char*) query->parent, query->parentLength) == 0;
+    }
+    return TRUE;
+}
+// a deleted entry was recovered on disk - restore its first character in the index too
+// (the path is replaced rather than written over: library callers may be reading the old one)
+void markRecovered(IndexEntry* entry, unsigned char firstChar){
+    entry->dirName[0] = firstChar;
+    entry->name[0] = firstChar;
+    // a long name survived deletion whole
+    if(!entry->longName){
+        unsigned char* path = (unsigned char*) strdup((char*) entry->path);
+        path[entry->parentLength ? entry->parentLength+1 : 0] = firstChar;
+        entry->stalePath = entry->path;
+        entry->path = path;
+    }
+    entry->deleted = FALSE;
+    return;
+}
+// checksum of the 11-byte short name that every long name entry repeats
+unsigned char shortNameChecksum(unsigned char* dirName){
+    unsigned char sum = 0;
+    for(unsigned int i = 0; i < 11; i++){
+        sum = (unsigned char) (((sum & 1) << 7)+(sum >> 1)+dirName[i]);
+    }
+    return sum;
+}
+// collect one long name entry; live sequences must count down from the LFN_LAST_ENTRY entry
+void addLongNamePart(LongNameState* lfn, DirEntry* dirEntry, unsigned long long entryOffset){
+    unsigned char* raw = (unsigned char*) dirEntry;
+    unsigned char ord = raw[0];
+    unsigned char checksum = raw[13];
+    if(ord == DELETED_ENTRY){
+        // deleted entries lost their order byte - rely on disk order and a shared checksum
+        if(lfn->count == 0 || !lfn->deleted || lfn->checksum != checksum || lfn->count == MAX_LFN_ENTRIES){
+            lfn->count = 0;
+            lfn->deleted = TRUE;
+            lfn->checksum = checksum;
+        }
+    }
+    else if(ord & LFN_LAST_ENTRY){
+        lfn->count = 0;
+        lfn->deleted = FALSE;
+        lfn->checksum = checksum;
+        lfn->expectedOrd = ord & 0x1f;
+        if(lfn->expectedOrd == 0 || lfn->expectedOrd > MAX_LFN_ENTRIES){
+            return;
+        }
+    }
+    else if(lfn->count == 0 || lfn->deleted || lfn->checksum != checksum || ord != lfn->expectedOrd){
+        lfn->count = 0;
+        return;
+    }
+    // name characters sit at bytes 1-10, 14-25 and 28-31
+    static const unsigned char charOffsets[LFN_CHARS_PER_ENTRY] = {1, 3, 5, 7, 9, 14, 16, 18, 20, 22, 24, 28, 30};
+    for(unsigned int k = 0; k < LFN_CHARS_PER_ENTRY; k++){
+        lfn->chars[lfn->count][k] = (unsigned short) (raw[charOffsets[k]] | (raw[charOffsets[k]+1] << 8));
+    }
+    lfn->offsets[lfn->count] = entryOffset;
+    lfn->count++;
+    if(!lfn->deleted){
+        lfn->expectedOrd--;
+    }
+    return;
+}
+// UTF-8 long name for the short entry the collected sequence belongs to (NULL if it doesn't)
+unsigned char* decodeLongName(LongNameState* lfn, DirEntry* dirEntry, unsigned char* firstChar){
+    *firstChar = 0;
+    if(lfn->count == 0 || lfn->deleted != (dirEntry->DIR_Name[0] == DELETED_ENTRY)){
+        return NULL;
+    }
+    unsigned char* name = (unsigned char*) malloc(MAX_LFN_ENTRIES*LFN_CHARS_PER_ENTRY*3+1);
+    unsigned int length = 0;
+    // disk order is last part first
+    for(unsigned int p = lfn->count; p-- > 0;){
+        for(unsigned int k = 0; k < LFN_CHARS_PER_ENTRY && lfn->chars[p][k] != 0x0000 && lfn->chars[p][k] != 0xffff; k++){
+            unsigned short c = lfn->chars[p][k];
+            // a '/' would split the name into path components of its own
+            if(c < 0x80){
+                name[length++] = c == '/' ? '_' : (unsigned char) c;
+            }
+            else if(c < 0x800){
+                name[length++] = (unsigned char) (0xc0 | (c >> 6));
+                name[length++] = (unsigned char) (0x80 | (c & 0x3f));
+            }
+            else{
+                name[length++] = (unsigned char) (0xe0 | (c >> 12));
+                name[length++] = (unsigned char) (0x80 | ((c >> 6) & 0x3f));
+                name[length++] = (unsigned char) (0x80 | (c & 0x3f));
+            }
+        }
+    }
+    name[length] = '\0';
+    unsigned char shortName[11];
+    memcpy(shortName, dirEntry->DIR_Name, 11);
+    if(!lfn->deleted){
+        if(lfn->expectedOrd == 0 && shortNameChecksum(shortName) == lfn->checksum){
+            return name;
+        }
+    }
+    // deleted: find the lost first character the checksum was computed with (most likely the long name's own)
+    else{
+        shortName[0] = (unsigned char) toupper(name[0]);
+        if(shortNameChecksum(shortName) == lfn->checksum){
+            *firstChar = shortName[0];
+            return name;
+        }
+        for(unsigned int c = 0x21; c < 0x100; c++){
+            shortName[0] = (unsigned char) c;
+            if(c != DELETED_ENTRY && shortNameChecksum(shortName) == lfn->checksum){
+                *firstChar = shortName[0];
+                return name;
+            }
+        }
+    }
+    free(name);
+    return NULL;
+}
+IndexEntry* addIndexEntry(DirIndex* index, DirEntry* dirEntry, unsigned long long entryOffset, unsigned char* parentPath, LongNameState* lfn){
+    if(index->count == index->capacity){
+        index->capacity = index->capacity ? index->capacity*2 : 64;
+        index->entries = (IndexEntry*) realloc(index->entries, sizeof(IndexEntry)*index->capacity);
+    }
+    IndexEntry* entry = &index->entries[index->count++];
+    memcpy(entry->dirName, dirEntry->DIR_Name, 11);
+    decodeDirName(dirEntry->DIR_Name, entry->name);
+    entry->longName = decodeLongName(lfn, dirEntry, &entry->lfnFirstChar);
+    entry->lfnOffsets = NULL;
+    entry->lfnCount = 0;
+    if(entry->longName){
+        entry->lfnCount = lfn->count;
+        entry->lfnOffsets = (unsigned long long*) malloc(sizeof(unsigned long long)*lfn->count);
+        memcpy(entry->lfnOffsets, lfn->offsets, sizeof(unsigned long long)*lfn->count);
+    }
+    // full path from the root directory
+    unsigned char* name = entry->longName ? entry->longName : entry->name;
+    unsigned int parentLength = strlen((char*) parentPath);
+    unsigned int nameLength = strlen((char*) name);
+    entry->path = (unsigned char*) malloc(parentLength+nameLength+2);
+    if(parentLength){
+        memcpy(entry->path, parentPath, parentLength);
+        entry->path[parentLength] = '/';
+        memcpy(&entry->path[parentLength+1], name, nameLength+1);
+    }
+    else{
+        memcpy(entry->path, name, nameLength+1);
+    }
+    entry->parentLength = parentLength;
+    entry->stalePath = NULL;
+    entry->firstCluster = ((unsigned int) dirEntry->DIR_FstClusHI << 16) | dirEntry->DIR_FstClusLO;
+    entry->fileSize = dirEntry->DIR_FileSize;
+    entry->writeTime = dirEntry->DIR_WrtTime;
+    entry->writeDate = dirEntry->DIR_WrtDate;
+    entry->createTime = dirEntry->DIR_CrtTime;
+    entry->createDate = dirEntry->DIR_CrtDate;
+    entry->attr = dirEntry->DIR_Attr;
+    entry->deleted = dirEntry->DIR_Name[0] == DELETED_ENTRY;
+    entry->entryOffset = entryOffset;
+    entry->hashState = HASH_UNKNOWN;
+    return entry;
+}
+void pushDirTask(DirWalker* walker, unsigned int workerId, unsigned int cluster, unsigned char* path){
+    // never queue the same directory twice (a damaged image may link a directory to an ancestor);
+    // cluster 0 stands for the fixed root directory of FAT12/16
+    if(!(isValidCluster(walker->fat, cluster) || (cluster == 0 && walker->geometry->rootDirBytes))
+    || __atomic_exchange_n(&walker->visited[cluster], TRUE, __ATOMIC_RELAXED)){
+        free(path);
+        return;
+    }
+    __atomic_fetch_add(&walker->pending, 1, __ATOMIC_ACQ_REL);
+    TaskDeque* deque = &walker->deques[workerId];
+    pthread_mutex_lock(&deque->lock);
+    if(deque->bottom == deque->capacity){
+        // reclaim the slots thieves already took before growing
+        if(deque->top > 0){
+            memmove(deque->tasks, &deque->tasks[deque->top], sizeof(DirTask)*(deque->bottom-deque->top));
+            deque->bottom -= deque->top;
+            deque->top = 0;
+        }
+        if(deque->bottom == deque->capacity){
+            deque->capacity = deque->capacity ? deque->capacity*2 : 16;
+            deque->tasks = (DirTask*) realloc(deque->tasks, sizeof(DirTask)*deque->capacity);
+        }
+    }
+    deque->tasks[deque->bottom].cluster = cluster;
+    deque->tasks[deque->bottom].path = path;
+    // counted before a thief can see it, so queued never drops below the tasks really waiting
+    __atomic_fetch_add(&walker->queued, 1, __ATOMIC_ACQ_REL);
+    deque->bottom++;
+    pthread_mutex_unlock(&deque->lock);
+    // wake one idle worker to steal it
+    pthread_mutex_lock(&walker->idleLock);
+    pthread_cond_signal(&walker->workReady);
+    pthread_mutex_unlock(&walker->idleLock);
+    return;
+}
+int popDirTask(DirWalker* walker, unsigned int workerId, DirTask* task){
+    // own work first (newest directory, depth first)
+    TaskDeque* deque = &walker->deques[workerId];
+    pthread_mutex_lock(&deque->lock);
+    if(deque->bottom > deque->top){
+        *task = deque->tasks[--deque->bottom];
+        __atomic_fetch_sub(&walker->queued, 1, __ATOMIC_ACQ_REL);
+        pthread_mutex_unlock(&deque->lock);
+        return TRUE;
+    }
+    pthread_mutex_unlock(&deque->lock);
+    // then steal the oldest directory from another worker
+    for(unsigned int i = 1; i < walker->numOfWorkers; i++){
+        TaskDeque* victim = &walker->deques[(workerId+i)%walker->numOfWorkers];
+        pthread_mutex_lock(&victim->lock);
+        if(victim->bottom > victim->top){
+            *task = victim->tasks[victim->top++];
+            __atomic_fetch_sub(&walker->queued, 1, __ATOMIC_ACQ_REL);
+            pthread_mutex_unlock(&victim->lock);
+            return TRUE;
+        }
+        pthread_mutex_unlock(&victim->lock);
+    }
+    return FALSE;
+}
+void walkDirectory(DirWalker* walker, unsigned int workerId, DirTask* task){
+    DirIndex* index = &walker->results[workerId];
+    unsigned int dirClus = task->cluster;
+    // long names are decoded in the same pass, the sequence may span clusters
+    LongNameState lfn;
+    lfn.count = 0;
+    // the FAT12/16 root directory is one fixed region before the data area, with no chain to follow
+    int fixedRoot = dirClus == 0;
+    // bounded by the cluster count so a looping chain cannot hang us
+    for(unsigned int visited = 0; (dirClus || fixedRoot) && visited < walker->fat->totalClusters; visited++){
+        unsigned long long dirStartIndex = fixedRoot ? walker->geometry->rootDirStartIndex : clusterStart(walker->geometry, dirClus);
+        unsigned int dirBytes = fixedRoot ? walker->geometry->rootDirBytes : walker->geometry->bytesPerClus;
+        const unsigned char* dirCluster = viewStorage(walker->storage, dirStartIndex, dirBytes, walker->buffers[workerId]);
+        if(!dirCluster){
+            return;
+        }
+        countStat(STAT_CLUSTERS_READ, 1);
+        // classify the whole cluster first, records past the end one are never looked at
+        unsigned int recordCount = dirBytes/32;
+        unsigned char* classes = walker->classes[workerId];
+        unsigned int endIndex = classifyDirEntries(dirCluster, recordCount, classes);
+        for(unsigned int i = 0; i < endIndex; i++){
+            DirEntry* dirEntry = (DirEntry*) &dirCluster[i*32];
+            // long file name
+            if(classes[i] == DIRENT_LFN){
+                addLongNamePart(&lfn, dirEntry, dirStartIndex+(i*32));
+                continue;
+            }
+            // "." and ".."
+            if(classes[i] == DIRENT_LIVE && dirEntry->DIR_Name[0] == '.'){
+                lfn.count = 0;
+                continue;
+            }
+            IndexEntry* entry = addIndexEntry(index, dirEntry, dirStartIndex+(i*32), task->path, &lfn);
+            lfn.count = 0;
+            // the high half of the first cluster only exists on FAT32 (FAT12/16 may keep other data there)
+            if(walker->geometry->fatType != FAT_TYPE_32){
+                entry->firstCluster &= 0xffff;
+            }
+            // descend into live subdirectories
+            if(!entry->deleted && (entry->attr & ATTR_DIRECTORY)){
+                unsigned char* path = (unsigned char*) strdup((char*) entry->path);
+                pushDirTask(walker, workerId, entry->firstCluster, path);
+            }
+        }
+        // no more files in directory
+        if(endIndex < recordCount || fixedRoot){
+            return;
+        }
+        // check FAT if directory continues
+        dirClus = nextCluster(walker->fat, dirClus);
+    }
+    return;
+}
+typedef struct WalkWorker {
+    DirWalker* walker;
+    unsigned int id;
+} WalkWorker;
+void* dirWalkWorker(void* arg){
+    WalkWorker* worker = (WalkWorker*) arg;
+    DirWalker* walker = worker->walker;
+    DirTask task;
+    // run until no directory is queued or being walked anywhere
+    while(__atomic_load_n(&walker->pending, __ATOMIC_ACQUIRE) > 0){
+        if(!popDirTask(walker, worker->id, &task)){
+            // nothing to steal: sleep until a directory is queued or the last one is done
+            pthread_mutex_lock(&walker->idleLock);
+            while(__atomic_load_n(&walker->pending, __ATOMIC_ACQUIRE) > 0 && __atomic_load_n(&walker->queued, __ATOMIC_ACQUIRE) == 0){
+                pthread_cond_wait(&walker->workReady, &walker->idleLock);
+            }
+            pthread_mutex_unlock(&walker->idleLock);
+            continue;
+        }
+        walkDirectory(walker, worker->id, &task);
+        free(task.path);
+        if(__atomic_sub_fetch(&walker->pending, 1, __ATOMIC_ACQ_REL) == 0){
+            pthread_mutex_lock(&walker->idleLock);
+            pthread_cond_broadcast(&walker->workReady);
+            pthread_mutex_unlock(&walker->idleLock);
+        }
+    }
+    return NULL;
+}
+int compareIndexEntries(const void* a, const void* b){
+    const IndexEntry* entryA = (const IndexEntry*) a;
+    const IndexEntry* entryB = (const IndexEntry*) b;
+    int order = strcmp((char*) entryA->path, (char*) entryB->path);
+    if(order != 0){
+        return order;
+    }
+    // same path (e.g. several deleted "?NE.TXT") - keep disk order
+    return (entryA->entryOffset > entryB->entryOffset)-(entryA->entryOffset < entryB->entryOffset);
+}
+// walk the whole directory tree once (one task per directory on a work-stealing pool)
+// and record every live and deleted entry, sorted by path
+void buildDirIndex(Storage* storage, Geometry* geometry, FatTable* fat, DirIndex* index){
+    unsigned long long started = beginPhase();
+    DirWalker walker;
+    walker.storage = storage;
+    walker.geometry = geometry;
+    walker.fat = fat;
+    walker.pending = 0;
+    walker.queued = 0;
+    pthread_mutex_init(&walker.idleLock, NULL);
+    pthread_cond_init(&walker.workReady, NULL);
+    long numOfCpus = sysconf(_SC_NPROCESSORS_ONLN);
+    walker.numOfWorkers = numOfCpus > 0 ? (unsigned int) numOfCpus : 1;
+    walker.deques = (TaskDeque*) calloc(walker.numOfWorkers, sizeof(TaskDeque));
+    walker.results = (DirIndex*) calloc(walker.numOfWorkers, sizeof(DirIndex));
+    walker.visited = (unsigned char*) calloc(fat->totalClusters+2, sizeof(unsigned char));
+    walker.buffers = (unsigned char**) calloc(walker.numOfWorkers, sizeof(unsigned char*));
+    walker.classes = (unsigned char**) calloc(walker.numOfWorkers, sizeof(unsigned char*));
+    // room for a directory cluster or the fixed root directory, whichever is larger
+    unsigned int dirBytes = geometry->rootDirBytes > geometry->bytesPerClus ? geometry->rootDirBytes : geometry->bytesPerClus;
+    for(unsigned int i = 0; i < walker.numOfWorkers; i++){
+        pthread_mutex_init(&walker.deques[i].lock, NULL);
+        walker.classes[i] = (unsigned char*) malloc(dirBytes/32);
+        if(!storage->map){
+            walker.buffers[i] = (unsigned char*) malloc(dirBytes);
+        }
+    }
+    // the root directory seeds the first worker, the rest steal from it
+    pushDirTask(&walker, 0, geometry->rootCluster, (unsigned char*) strdup(""));
+    pthread_t* threads = (pthread_t*) malloc(sizeof(pthread_t)*walker.numOfWorkers);
+    WalkWorker* workers = (WalkWorker*) malloc(sizeof(WalkWorker)*walker.numOfWorkers);
+    for(unsigned int i = 0; i < walker.numOfWorkers; i++){
+        workers[i].walker = &walker;
+        workers[i].id = i;
+        pthread_create(&threads[i], NULL, dirWalkWorker, &workers[i]);
+    }
+    for(unsigned int i = 0; i < walker.numOfWorkers; i++){
+        pthread_join(threads[i], NULL);
+    }
+    // merge the partial indexes; sorting makes the result independent of scheduling
+    index->count = 0;
+    for(unsigned int i = 0; i < walker.numOfWorkers; i++){
+        index->count += walker.results[i].count;
+    }
+    index->capacity = index->count;
+    index->entries = (IndexEntry*) malloc(sizeof(IndexEntry)*(index->capacity ? index->capacity : 1));
+    unsigned int merged = 0;
+    for(unsigned int i = 0; i < walker.numOfWorkers; i++){
+        memcpy(&index->entries[merged], walker.results[i].entries, sizeof(IndexEntry)*walker.results[i].count);
+        merged += walker.results[i].count;
+        free(walker.results[i].entries);
+        free(walker.deques[i].tasks);
+        free(walker.buffers[i]);
+        free(walker.classes[i]);
+        pthread_mutex_destroy(&walker.deques[i].lock);
+    }
+    index->mapping = NULL;
+    index->mappingSize = 0;
+    index->hashesAdded = FALSE;
+    sortDirIndex(index);
+    free(threads);
+    free(workers);
+    free(walker.deques);
+    free(walker.results);
+    free(walker.visited);
+    free(walker.buffers);
+    free(walker.classes);
+    pthread_mutex_destroy(&walker.idleLock);
+    pthread_cond_destroy(&walker.workReady);
+    endPhase(STAT_PHASE_DIR_WALK, started);
+    return;
+}
+// back into path order (recovering a deleted entry changes its path)
+void sortDirIndex(DirIndex* index){
+    qsort(index->entries, index->count, sizeof(IndexEntry), compareIndexEntries);
+    return;
+}
+void freeDirIndex(DirIndex* index){
+    // a loaded scan index keeps every string in its mapping, but for paths replaced by markRecovered
+    if(index->mapping){
+        for(unsigned int i = 0; i < index->count; i++){
+            if(index->entries[i].stalePath){
+                free(index->entries[i].path);
+            }
+        }
+        munmap(index->mapping, index->mappingSize);
+        index->mapping = NULL;
+        free(index->entries);
+        index->entries = NULL;
+        index->count = 0;
+        index->capacity = 0;
+        return;
+    }
+    for(unsigned int i = 0; i < index->count; i++){
+        free(index->entries[i].path);
+        free(index->entries[i].stalePath);
+        free(index->entries[i].longName);
+        free(index->entries[i].lfnOffsets);
+    }
+    free(index->entries);
+    index->entries = NULL;
+    index->count = 0;
+    index->capacity = 0;
+    return;
+}
@@ -0,0 +1,116 @@
+#ifndef DIRINDEX_H
+#define DIRINDEX_H
+
+#include <pthread.h>
+#include <stddef.h>
+#include <openssl/sha.h>
+#include "nyufile.h"
+#include "fat.h"
+#include "geometry.h"
+#include "dirscan.h"
+
+// a long file name is at most 20 entries of 13 UCS-2 characters
+#define MAX_LFN_ENTRIES 20
+#define LFN_CHARS_PER_ENTRY 13
+// LDIR_Ord flag of the entry holding the end of the name
+#define LFN_LAST_ENTRY 0x40
+// what we know about the SHA-1 of a deleted entry's (contiguous) content
+#define HASH_UNKNOWN 0
+#define HASH_KNOWN 1
+#define HASH_UNREADABLE 2
+
+// one live or deleted directory entry, decoded once
+typedef struct IndexEntry {
+    unsigned char name[13];             // decoded 8.3 name (first character is '?' when deleted)
+    unsigned char dirName[DIRNAME_PADDED];  // name as stored in the directory entry (11 bytes)
+    unsigned char* longName;            // UTF-8 long file name (NULL when there is none)
+    unsigned long long* lfnOffsets;     // byte offsets of the long name entries, in disk order
+    unsigned int lfnCount;
+    unsigned char lfnFirstChar;         // first short name character implied by the LFN checksum (deleted entries)
+    unsigned char* path;                // "DIR/SUB/NAME.EXT" from the root directory (long names where present)
+    unsigned int parentLength;          // length of the "DIR/SUB" prefix of path (0 in the root)
+    unsigned char* stalePath;           // path before markRecovered replaced it, kept for readers still holding it
+    unsigned int firstCluster;
+    unsigned int fileSize;
+    unsigned short writeTime;           // DIR_WrtTime / DIR_WrtDate as stored
+    unsigned short writeDate;
+    unsigned short createTime;          // DIR_CrtTime / DIR_CrtDate as stored
+    unsigned short createDate;
+    unsigned char attr;
+    int deleted;
+    unsigned long long entryOffset;     // byte offset of the DirEntry in the image
+    unsigned char hashState;            // HASH_* - content digests are cached in the scan index
+    unsigned char digest[SHA_DIGEST_LENGTH];
+} IndexEntry;
+
+// every entry of the directory tree, sorted by path
+typedef struct DirIndex {
+    IndexEntry* entries;
+    unsigned int count;
+    unsigned int capacity;
+    void* mapping;                      // scan index the strings point into (NULL when walked)
+    size_t mappingSize;
+    int hashesAdded;                    // digests computed since the index was loaded or built
+} DirIndex;
+
+// long file name entries seen since the last short entry of a directory
+typedef struct LongNameState {
+    unsigned short chars[MAX_LFN_ENTRIES][LFN_CHARS_PER_ENTRY];
+    unsigned long long offsets[MAX_LFN_ENTRIES];
+    unsigned int count;
+    unsigned char checksum;
+    unsigned char expectedOrd;          // next LDIR_Ord of a live sequence (0 once complete)
+    int deleted;
+} LongNameState;
+
+// a user-specified name: optional directory part plus the 8.3 form of the last component
+typedef struct NameQuery {
+    unsigned char dirName[DIRNAME_PADDED];
+    unsigned char* baseName;
+    unsigned char* parent;
+    unsigned int parentLength;
+} NameQuery;
+
+// one directory waiting to be walked
+typedef struct DirTask {
+    unsigned int cluster;
+    unsigned char* path;
+} DirTask;
+
+// per-worker task deque; the owner pushes/pops the bottom, thieves take the top
+typedef struct TaskDeque {
+    DirTask* tasks;
+    unsigned int top;
+    unsigned int bottom;
+    unsigned int capacity;
+    pthread_mutex_t lock;
+} TaskDeque;
+
+// state shared by the directory walker threads
+typedef struct DirWalker {
+    Storage* storage;
+    unsigned char** buffers;            // one directory cluster per worker (pread backend only)
+    unsigned char** classes;            // DIRENT_* of each record of the cluster a worker is walking
+    Geometry* geometry;
+    FatTable* fat;
+    unsigned int numOfWorkers;
+    TaskDeque* deques;
+    DirIndex* results;                  // one partial index per worker, merged at the end
+    unsigned char* visited;             // directory clusters already queued (guards against loops)
+    unsigned int pending;               // tasks queued or running
+    unsigned int queued;                // tasks waiting in a deque
+    pthread_mutex_t idleLock;           // idle workers sleep on workReady until a task is queued or none are left
+    pthread_cond_t workReady;
+} DirWalker;
+
+void buildDirIndex(Storage* storage, Geometry* geometry, FatTable* fat, DirIndex* index);
+void freeDirIndex(DirIndex* index);
+void sortDirIndex(DirIndex* index);
+void decodeDirName(unsigned char* dirName, unsigned char* name);
+void convertToDirName(unsigned char* fileName, unsigned char* dirName);
+void buildNameQuery(unsigned char* fileName, NameQuery* query);
+int matchesDeletedName(IndexEntry* entry, NameQuery* query);
+void markRecovered(IndexEntry* entry, unsigned char firstChar);
+unsigned char shortNameChecksum(unsigned char* dirName);
+
+#endif
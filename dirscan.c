@@ -0,0 +1,115 @@
+#include <string.h>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+#include "dirscan.h"
+
+unsigned char classifyDirEntry(const unsigned char* record){
+    if(record[0] == 0){
+        return DIRENT_END;
+    }
+    if(record[11] == ATTR_LONG_NAME){
+        return DIRENT_LFN;
+    }
+    return record[0] == DELETED_ENTRY ? DIRENT_DELETED : DIRENT_LIVE;
+}
+// records first..count one at a time (the tail the vector loops leave, or every record without SSE2)
+unsigned int classifyScalar(const unsigned char* records, unsigned int first, unsigned int count, unsigned char* classes){
+    for(unsigned int i = first; i < count; i++){
+        classes[i] = classifyDirEntry(&records[i*32]);
+        if(classes[i] == DIRENT_END){
+            return i;
+        }
+    }
+    return count;
+}
+
+#if defined(__x86_64__)
+// per 32-bit lane: the first name byte is the low byte of names, the attribute the high byte of attrs
+__m128i classifyLanes(__m128i names, __m128i attrs, __m128i* end){
+    __m128i first = _mm_and_si128(names, _mm_set1_epi32(0xff));
+    __m128i attr = _mm_srli_epi32(attrs, 24);
+    __m128i lfn = _mm_cmpeq_epi32(attr, _mm_set1_epi32(ATTR_LONG_NAME));
+    __m128i deleted = _mm_cmpeq_epi32(first, _mm_set1_epi32(DELETED_ENTRY));
+    *end = _mm_cmpeq_epi32(first, _mm_setzero_si128());
+    __m128i classes = _mm_or_si128(_mm_and_si128(deleted, _mm_set1_epi32(DIRENT_DELETED)),
+    _mm_andnot_si128(deleted, _mm_set1_epi32(DIRENT_LIVE)));
+    classes = _mm_or_si128(_mm_and_si128(lfn, _mm_set1_epi32(DIRENT_LFN)), _mm_andnot_si128(lfn, classes));
+    return _mm_andnot_si128(*end, classes);
+}
+// four records per step: their first 16 bytes are transposed so byte 0 and byte 11 of each sit in one lane
+unsigned int classifySse2(const unsigned char* records, unsigned int count, unsigned char* classes){
+    unsigned int i = 0;
+    for(; i+4 <= count; i += 4){
+        __m128i r0 = _mm_loadu_si128((const __m128i*) &records[i*32]);
+        __m128i r1 = _mm_loadu_si128((const __m128i*) &records[(i+1)*32]);
+        __m128i r2 = _mm_loadu_si128((const __m128i*) &records[(i+2)*32]);
+        __m128i r3 = _mm_loadu_si128((const __m128i*) &records[(i+3)*32]);
+        __m128i names = _mm_unpacklo_epi64(_mm_unpacklo_epi32(r0, r1), _mm_unpacklo_epi32(r2, r3));
+        __m128i attrs = _mm_unpacklo_epi64(_mm_unpackhi_epi32(r0, r1), _mm_unpackhi_epi32(r2, r3));
+        __m128i end;
+        __m128i lanes = classifyLanes(names, attrs, &end);
+        lanes = _mm_packs_epi32(lanes, lanes);
+        int packed = _mm_cvtsi128_si32(_mm_packus_epi16(lanes, lanes));
+        memcpy(&classes[i], &packed, 4);
+        int endMask = _mm_movemask_ps(_mm_castsi128_ps(end));
+        if(endMask){
+            return i+__builtin_ctz(endMask);
+        }
+    }
+    return classifyScalar(records, i, count, classes);
+}
+// eight records per step, byte 0 and byte 11 of each gathered straight into lanes
+__attribute__((target("avx2")))
+unsigned int classifyAvx2(const unsigned char* records, unsigned int count, unsigned char* classes){
+    const __m256i nameOffsets = _mm256_setr_epi32(0, 8, 16, 24, 32, 40, 48, 56);
+    const __m256i attrOffsets = _mm256_add_epi32(nameOffsets, _mm256_set1_epi32(2));
+    unsigned int i = 0;
+    for(; i+8 <= count; i += 8){
+        const int* base = (const int*) &records[i*32];
+        __m256i first = _mm256_and_si256(_mm256_i32gather_epi32(base, nameOffsets, 4), _mm256_set1_epi32(0xff));
+        __m256i attr = _mm256_srli_epi32(_mm256_i32gather_epi32(base, attrOffsets, 4), 24);
+        __m256i lfn = _mm256_cmpeq_epi32(attr, _mm256_set1_epi32(ATTR_LONG_NAME));
+        __m256i deleted = _mm256_cmpeq_epi32(first, _mm256_set1_epi32(DELETED_ENTRY));
+        __m256i end = _mm256_cmpeq_epi32(first, _mm256_setzero_si256());
+        __m256i lanes = _mm256_blendv_epi8(_mm256_set1_epi32(DIRENT_LIVE), _mm256_set1_epi32(DIRENT_DELETED), deleted);
+        lanes = _mm256_blendv_epi8(lanes, _mm256_set1_epi32(DIRENT_LFN), lfn);
+        lanes = _mm256_andnot_si256(end, lanes);
+        // packing works within each 128-bit half: records 0-3 land in the low one, 4-7 in the high one
+        lanes = _mm256_packs_epi32(lanes, lanes);
+        lanes = _mm256_packus_epi16(lanes, lanes);
+        int low = _mm_cvtsi128_si32(_mm256_castsi256_si128(lanes));
+        int high = _mm_cvtsi128_si32(_mm256_extracti128_si256(lanes, 1));
+        memcpy(&classes[i], &low, 4);
+        memcpy(&classes[i+4], &high, 4);
+        int endMask = _mm256_movemask_ps(_mm256_castsi256_ps(end));
+        if(endMask){
+            return i+__builtin_ctz(endMask);
+        }
+    }
+    return classifyScalar(records, i, count, classes);
+}
+#endif
+
+// class of each of count 32-byte records; the index of the first end record (count when there is none)
+// classes past the end record are not meaningful
+unsigned int classifyDirEntries(const unsigned char* records, unsigned int count, unsigned char* classes){
+#if defined(__x86_64__)
+    if(__builtin_cpu_supports("avx2")){
+        return classifyAvx2(records, count, classes);
+    }
+    return classifySse2(records, count, classes);
+#else
+    return classifyScalar(records, 0, count, classes);
+#endif
+}
+// the 11-byte short names are equal except perhaps for the first character (lost on deletion);
+// both buffers must be DIRNAME_PADDED bytes
+int sameNameTail(const unsigned char* dirNameA, const unsigned char* dirNameB){
+#if defined(__x86_64__)
+    __m128i equal = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*) dirNameA), _mm_loadu_si128((const __m128i*) dirNameB));
+    return (_mm_movemask_epi8(equal) & 0x07fe) == 0x07fe;
+#else
+    return memcmp(&dirNameA[1], &dirNameB[1], 10) == 0;
+#endif
+}
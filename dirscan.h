@@ -0,0 +1,17 @@
+#ifndef DIRSCAN_H
+#define DIRSCAN_H
+
+#include "nyufile.h"
+
+// what a 32-byte directory record is (checked in this order)
+#define DIRENT_END 0                    // first byte 0x00 - nothing follows in this directory
+#define DIRENT_LFN 1                    // attribute 0x0f - part of a long name (live or deleted)
+#define DIRENT_DELETED 2                // first byte 0xe5
+#define DIRENT_LIVE 3
+// short names are kept in buffers this wide so they compare in one vector load
+#define DIRNAME_PADDED 16
+
+unsigned int classifyDirEntries(const unsigned char* records, unsigned int count, unsigned char* classes);
+int sameNameTail(const unsigned char* dirNameA, const unsigned char* dirNameB);
+
+#endif
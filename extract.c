@@ -0,0 +1,335 @@
+// copy_file_range
+#define _GNU_SOURCE
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "extract.h"
+#include "content.h"
+
+// copy through our own buffer (the mapping when there is one)
+int copyBuffered(Storage* storage, unsigned long long start, unsigned long long size, int outFd, unsigned char* buffer){
+    unsigned long long written = 0;
+    while(written < size){
+        unsigned long long length = size-written < CONTENT_BUFFER_SIZE ? size-written : CONTENT_BUFFER_SIZE;
+        const unsigned char* content = viewStorage(storage, start+written, length, buffer);
+        if(!content || write(outFd, content, length) != (ssize_t) length){
+            return FALSE;
+        }
+        written += length;
+    }
+    return TRUE;
+}
+// append size bytes of the image at start to outFd; the kernel copies when it can
+// (copy_file_range, else sendfile), our buffer of CONTENT_BUFFER_SIZE bytes when it can't
+int copyImageRange(Storage* storage, unsigned long long start, unsigned long long size, int outFd, unsigned char* buffer){
+    loff_t offset = (loff_t) start;
+    unsigned long long copied = 0;
+    int useCopyRange = TRUE;
+    while(copied < size){
+        size_t length = size-copied < (1ULL << 30) ? (size_t) (size-copied) : (size_t) 1 << 30;
+        ssize_t count = -1;
+        if(useCopyRange){
+            count = copy_file_range(storage->fd, &offset, outFd, NULL, length, 0);
+            // across file systems on older kernels, or from a block device
+            if(count == -1 && (errno == EXDEV || errno == EINVAL || errno == ENOSYS || errno == EOPNOTSUPP || errno == EBADF)){
+                useCopyRange = FALSE;
+            }
+        }
+        if(!useCopyRange){
+            off_t sendOffset = (off_t) offset;
+            count = sendfile(outFd, storage->fd, &sendOffset, length);
+            if(count == -1 && (errno == EINVAL || errno == ENOSYS)){
+                return copyBuffered(storage, (unsigned long long) offset, size-copied, outFd, buffer);
+            }
+            if(count > 0){
+                offset += count;
+            }
+        }
+        if(count == -1 && errno == EINTR){
+            continue;
+        }
+        // an error, or the end of the image before the end of the file
+        if(count <= 0){
+            return FALSE;
+        }
+        copied += (unsigned long long) count;
+    }
+    return TRUE;
+}
+// copy size bytes of the image starting at start into a new file
+int extractImageRange(Storage* storage, unsigned long long start, unsigned long long size, char* outputPath){
+    int outFd = open(outputPath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(outFd == -1){
+        return FALSE;
+    }
+    unsigned char* copyBuffer = (unsigned char*) malloc(CONTENT_BUFFER_SIZE);
+    int ok = copyImageRange(storage, start, size, outFd, copyBuffer);
+    free(copyBuffer);
+    return close(outFd) == 0 && ok;
+}
+// create every directory leading to path (below the output directory)
+void makeParentDirs(char* path, unsigned int fromIndex){
+    for(char* slash = strchr(&path[fromIndex], '/'); slash; slash = strchr(slash+1, '/')){
+        *slash = '\0';
+        mkdir(path, 0755);
+        *slash = '/';
+    }
+    return;
+}
+int extractFile(Extractor* extractor, ExtractJob* job, unsigned char* buffer){
+    makeParentDirs(job->path, strlen(extractor->outputDir)+1);
+    int outFd = open(job->path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(outFd == -1){
+        return FALSE;
+    }
+    int ok = TRUE;
+    unsigned long long remaining = job->fileSize;
+    for(unsigned int e = 0; ok && e < job->extentCount && remaining > 0; e++){
+        FatExtent* extent = &job->extents[e];
+        unsigned long long start = clusterStart(extractor->geometry, extent->start);
+        unsigned long long length = (unsigned long long) extent->length << extractor->geometry->clusShift;
+        length = length < remaining ? length : remaining;
+        // a contiguous file is one kernel copy; the pieces of a fragmented chain go through the buffer
+        if(job->extentCount == 1){
+            ok = copyImageRange(extractor->storage, start, length, outFd, buffer);
+        }
+        else{
+            ok = copyBuffered(extractor->storage, start, length, outFd, buffer);
+        }
+        remaining -= length;
+    }
+    ok = close(outFd) == 0 && ok && remaining == 0;
+    return ok;
+}
+void* extractWorker(void* arg){
+    Extractor* extractor = (Extractor*) arg;
+    unsigned char* buffer = (unsigned char*) malloc(CONTENT_BUFFER_SIZE);
+    pthread_mutex_lock(&extractor->lock);
+    while(TRUE){
+        while(extractor->count == 0 && !extractor->closing){
+            pthread_cond_wait(&extractor->jobReady, &extractor->lock);
+        }
+        if(extractor->count == 0){
+            break;
+        }
+        ExtractJob job = extractor->jobs[extractor->head];
+        extractor->head = (extractor->head+1)%EXTRACT_QUEUE_DEPTH;
+        extractor->count--;
+        pthread_cond_signal(&extractor->slotFree);
+        pthread_mutex_unlock(&extractor->lock);
+        int ok = extractFile(extractor, &job, buffer);
+        if(!ok){
+            fprintf(stderr, "%s: could not be written\n", job.path);
+        }
+        free(job.path);
+        free(job.extents);
+        pthread_mutex_lock(&extractor->lock);
+        if(!ok){
+            extractor->failures++;
+        }
+    }
+    pthread_mutex_unlock(&extractor->lock);
+    free(buffer);
+    return NULL;
+}
+// FALSE if the output directory can't be created
+int initExtractor(Extractor* extractor, Storage* storage, Geometry* geometry, char* outputDir){
+    if(mkdir(outputDir, 0755) == -1 && errno != EEXIST){
+        return FALSE;
+    }
+    extractor->storage = storage;
+    extractor->geometry = geometry;
+    extractor->outputDir = outputDir;
+    extractor->head = 0;
+    extractor->count = 0;
+    extractor->closing = FALSE;
+    extractor->failures = 0;
+    extractor->hashes = NULL;
+    extractor->seen = NULL;
+    extractor->seenMask = 0;
+    extractor->seenCount = 0;
+    extractor->links = NULL;
+    extractor->linkCount = 0;
+    extractor->linkCapacity = 0;
+    extractor->linked = 0;
+    pthread_mutex_init(&extractor->lock, NULL);
+    pthread_cond_init(&extractor->jobReady, NULL);
+    pthread_cond_init(&extractor->slotFree, NULL);
+    for(unsigned int i = 0; i < EXTRACT_THREADS; i++){
+        pthread_create(&extractor->threads[i], NULL, extractWorker, extractor);
+    }
+    return TRUE;
+}
+// the slot holding this content, or the empty slot where it belongs
+DedupEntry* findDedupSlot(Extractor* extractor, unsigned long long contentHash, unsigned long long fileSize){
+    unsigned int slot = (unsigned int) contentHash & extractor->seenMask;
+    while(extractor->seen[slot].path && (extractor->seen[slot].contentHash != contentHash || extractor->seen[slot].fileSize != fileSize)){
+        slot = (slot+1) & extractor->seenMask;
+    }
+    return &extractor->seen[slot];
+}
+// the first fileSize bytes along both lists of extents are the same
+int sameExtentContent(Storage* storage, Geometry* geometry, FatExtent* a, unsigned int aCount, FatExtent* b, unsigned int bCount, unsigned long long fileSize){
+    unsigned char* scratch = storage->map ? NULL : (unsigned char*) malloc(2*geometry->bytesPerClus);
+    unsigned int ea = 0;
+    unsigned int ka = 0;                // cluster within extent a[ea]
+    unsigned int eb = 0;
+    unsigned int kb = 0;
+    unsigned long long remaining = fileSize;
+    int same = TRUE;
+    while(same && remaining > 0){
+        if(ea == aCount || eb == bCount){
+            same = FALSE;
+            break;
+        }
+        unsigned int length = remaining < geometry->bytesPerClus ? (unsigned int) remaining : geometry->bytesPerClus;
+        const unsigned char* x = viewStorage(storage, clusterStart(geometry, a[ea].start+ka), length, scratch);
+        const unsigned char* y = viewStorage(storage, clusterStart(geometry, b[eb].start+kb), length, scratch ? &scratch[geometry->bytesPerClus] : NULL);
+        same = x && y && memcmp(x, y, length) == 0;
+        remaining -= length;
+        if(++ka == a[ea].length){
+            ea++;
+            ka = 0;
+        }
+        if(++kb == b[eb].length){
+            eb++;
+            kb = 0;
+        }
+    }
+    free(scratch);
+    return same;
+}
+// TRUE if identical content was already queued: path becomes a link to it and nothing is copied
+int deduplicateExtraction(Extractor* extractor, char* path, FatExtent* extents, unsigned int extentCount, unsigned long long fileSize){
+    unsigned long long contentHash;
+    if(!fileContentHash(extractor->hashes, extractor->storage, extractor->geometry, extents, extentCount, fileSize, &contentHash)){
+        return FALSE;
+    }
+    // keep the table at most half full
+    if(2*(extractor->seenCount+1) > extractor->seenMask+1){
+        DedupEntry* old = extractor->seen;
+        unsigned int oldSize = old ? extractor->seenMask+1 : 0;
+        extractor->seenMask = oldSize ? 2*oldSize-1 : 255;
+        extractor->seen = (DedupEntry*) calloc(extractor->seenMask+1, sizeof(DedupEntry));
+        for(unsigned int i = 0; i < oldSize; i++){
+            if(old[i].path){
+                *findDedupSlot(extractor, old[i].contentHash, old[i].fileSize) = old[i];
+            }
+        }
+        free(old);
+    }
+    DedupEntry* entry = findDedupSlot(extractor, contentHash, fileSize);
+    if(!entry->path){
+        entry->contentHash = contentHash;
+        entry->fileSize = fileSize;
+        entry->path = strdup(path);
+        entry->extents = (FatExtent*) malloc(sizeof(FatExtent)*(extentCount ? extentCount : 1));
+        memcpy(entry->extents, extents, sizeof(FatExtent)*extentCount);
+        entry->extentCount = extentCount;
+        extractor->seenCount++;
+        return FALSE;
+    }
+    // the hash only nominates a copy: a collision is written out on its own
+    if(!sameExtentContent(extractor->storage, extractor->geometry, entry->extents, entry->extentCount, extents, extentCount, fileSize)){
+        return FALSE;
+    }
+    if(extractor->linkCount == extractor->linkCapacity){
+        extractor->linkCapacity = extractor->linkCapacity ? extractor->linkCapacity*2 : 16;
+        extractor->links = (DedupLink*) realloc(extractor->links, sizeof(DedupLink)*extractor->linkCapacity);
+    }
+    extractor->links[extractor->linkCount].path = path;
+    extractor->links[extractor->linkCount].target = entry->path;
+    extractor->linkCount++;
+    return TRUE;
+}
+// a path read from the image, safe to put under the output directory: a hostile image can name a file
+// or directory "..", so empty, "." and ".." components get a '_' in front
+char* escapeRelativePath(unsigned char* relativePath){
+    size_t length = strlen((char*) relativePath);
+    char* escaped = (char*) malloc(length*2+2);
+    size_t used = 0;
+    char* component = (char*) relativePath;
+    while(TRUE){
+        char* slash = strchr(component, '/');
+        size_t componentLength = slash ? (size_t) (slash-component) : strlen(component);
+        if(componentLength <= 2 && strncmp(component, "..", componentLength) == 0){
+            escaped[used++] = '_';
+        }
+        memcpy(&escaped[used], component, componentLength);
+        used += componentLength;
+        if(!slash){
+            break;
+        }
+        escaped[used++] = '/';
+        component = slash+1;
+    }
+    escaped[used] = '\0';
+    return escaped;
+}
+// hand a file to the threads (blocks while the queue is full); the extents are freed once written
+void queueExtraction(Extractor* extractor, unsigned char* relativePath, FatExtent* extents, unsigned int extentCount, unsigned long long fileSize){
+    char* escaped = escapeRelativePath(relativePath);
+    unsigned int pathLength = strlen(extractor->outputDir)+strlen(escaped)+2;
+    char* path = (char*) malloc(pathLength);
+    snprintf(path, pathLength, "%s/%s", extractor->outputDir, escaped);
+    free(escaped);
+    // content written once already (per the cluster-hash table) is linked, not copied again
+    if(extractor->hashes && deduplicateExtraction(extractor, path, extents, extentCount, fileSize)){
+        free(extents);
+        return;
+    }
+    pthread_mutex_lock(&extractor->lock);
+    while(extractor->count == EXTRACT_QUEUE_DEPTH){
+        pthread_cond_wait(&extractor->slotFree, &extractor->lock);
+    }
+    ExtractJob* job = &extractor->jobs[(extractor->head+extractor->count)%EXTRACT_QUEUE_DEPTH];
+    job->path = path;
+    job->extents = extents;
+    job->extentCount = extentCount;
+    job->fileSize = fileSize;
+    extractor->count++;
+    pthread_cond_signal(&extractor->jobReady);
+    pthread_mutex_unlock(&extractor->lock);
+    return;
+}
+// wait for every queued file; the number that could not be written
+unsigned int finishExtractor(Extractor* extractor){
+    pthread_mutex_lock(&extractor->lock);
+    extractor->closing = TRUE;
+    pthread_cond_broadcast(&extractor->jobReady);
+    pthread_mutex_unlock(&extractor->lock);
+    for(unsigned int i = 0; i < EXTRACT_THREADS; i++){
+        pthread_join(extractor->threads[i], NULL);
+    }
+    // every first copy is on disk now
+    for(unsigned int l = 0; l < extractor->linkCount; l++){
+        DedupLink* dedup = &extractor->links[l];
+        makeParentDirs(dedup->path, strlen(extractor->outputDir)+1);
+        unlink(dedup->path);
+        if(link(dedup->target, dedup->path) == 0){
+            extractor->linked++;
+        }
+        else{
+            fprintf(stderr, "%s: could not be written\n", dedup->path);
+            extractor->failures++;
+        }
+        free(dedup->path);
+    }
+    for(unsigned int i = 0; extractor->seen && i <= extractor->seenMask; i++){
+        free(extractor->seen[i].path);
+        free(extractor->seen[i].extents);
+    }
+    free(extractor->seen);
+    free(extractor->links);
+    extractor->seen = NULL;
+    extractor->links = NULL;
+    pthread_mutex_destroy(&extractor->lock);
+    pthread_cond_destroy(&extractor->jobReady);
+    pthread_cond_destroy(&extractor->slotFree);
+    return extractor->failures;
+}
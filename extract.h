@@ -0,0 +1,70 @@
+#ifndef EXTRACT_H
+#define EXTRACT_H
+
+#include <pthread.h>
+#include "nyufile.h"
+#include "fat.h"
+#include "storage.h"
+#include "geometry.h"
+#include "clusterhash.h"
+
+// files waiting for a thread (bounds the memory of a run recovering thousands of files)
+#define EXTRACT_QUEUE_DEPTH 64
+// threads copying recovered files out of the image
+#define EXTRACT_THREADS 4
+
+// one recovered file to write out
+typedef struct ExtractJob {
+    char* path;                         // output file (under the output directory)
+    FatExtent* extents;                 // its clusters, in file order
+    unsigned int extentCount;
+    unsigned long long fileSize;
+} ExtractJob;
+
+// a file already queued, by content (only with a cluster-hash table)
+typedef struct DedupEntry {
+    unsigned long long contentHash;
+    unsigned long long fileSize;
+    char* path;                         // NULL for an empty slot
+    FatExtent* extents;                 // its clusters, compared byte for byte before a file is linked to it
+    unsigned int extentCount;
+} DedupEntry;
+
+// a duplicate that becomes a hard link to the first copy once every file is written
+typedef struct DedupLink {
+    char* path;
+    char* target;
+} DedupLink;
+
+// writes recovered files to a directory instead of relinking them in the image
+typedef struct Extractor {
+    Storage* storage;
+    Geometry* geometry;
+    char* outputDir;
+    ExtractJob jobs[EXTRACT_QUEUE_DEPTH];   // ring of queued files
+    unsigned int head;
+    unsigned int count;
+    int closing;
+    unsigned int failures;              // files that could not be written
+    // content deduplication (hashes is NULL without image.nyuclus)
+    ClusterHashTable* hashes;
+    DedupEntry* seen;                   // open addressing on the content hash
+    unsigned int seenMask;
+    unsigned int seenCount;
+    DedupLink* links;
+    unsigned int linkCount;
+    unsigned int linkCapacity;
+    unsigned int linked;                // duplicates written as hard links
+    pthread_t threads[EXTRACT_THREADS];
+    pthread_mutex_t lock;
+    pthread_cond_t jobReady;
+    pthread_cond_t slotFree;
+} Extractor;
+
+int initExtractor(Extractor* extractor, Storage* storage, Geometry* geometry, char* outputDir);
+void queueExtraction(Extractor* extractor, unsigned char* relativePath, FatExtent* extents, unsigned int extentCount, unsigned long long fileSize);
+unsigned int finishExtractor(Extractor* extractor);
+int copyImageRange(Storage* storage, unsigned long long start, unsigned long long size, int outFd, unsigned char* buffer);
+int extractImageRange(Storage* storage, unsigned long long start, unsigned long long size, char* outputPath);
+
+#endif
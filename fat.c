@@ -0,0 +1,215 @@
+#include <stdlib.h>
+#include <string.h>
+#include "fat.h"
+#include "dirindex.h"
+#include "stats.h"
+
+// FAT12 packs two entries into three bytes; 0xff7 and up are bad/end-of-chain markers
+void decodeFat12(const unsigned char* raw, unsigned int* entries, unsigned int count){
+    for(unsigned int c = 0; c < count; c++){
+        const unsigned char* pair = &raw[c*3/2];
+        unsigned int value = (c & 1) ? (pair[0] >> 4 | pair[1] << 4) : (pair[0] | (pair[1] & 0x0f) << 8);
+        entries[c] = value >= 0xff7 ? value | 0x0ffff000 : value;
+    }
+    return;
+}
+void decodeFat16(const unsigned char* raw, unsigned int* entries, unsigned int count){
+    for(unsigned int c = 0; c < count; c++){
+        unsigned int value = raw[2*c] | raw[2*c+1] << 8;
+        entries[c] = value >= 0xfff7 ? value | 0x0fff0000 : value;
+    }
+    return;
+}
+void decodeFat32(const unsigned char* raw, unsigned int* entries, unsigned int count){
+    (void) raw;
+    // read straight into entries; the top 4 bits are reserved
+    for(unsigned int c = 0; c < count; c++){
+        entries[c] &= FAT_ENTRY_MASK;
+    }
+    return;
+}
+// the entry shares a byte with its neighbour: mask marks our nibble, the other one is merged from
+// the image when the write is committed (so entries linked in any order can't undo each other)
+unsigned int encodeFat12(unsigned int clus, unsigned int value, unsigned char* bytes, unsigned char* mask){
+    value &= 0xfff;
+    if(clus & 1){
+        bytes[0] = (unsigned char) ((value & 0x0f) << 4);
+        bytes[1] = (unsigned char) (value >> 4);
+        mask[0] = 0xf0;
+        mask[1] = 0xff;
+    }
+    else{
+        bytes[0] = (unsigned char) value;
+        bytes[1] = (unsigned char) (value >> 8);
+        mask[0] = 0xff;
+        mask[1] = 0x0f;
+    }
+    return 2;
+}
+unsigned int encodeFat16(unsigned int clus, unsigned int value, unsigned char* bytes, unsigned char* mask){
+    (void) clus;
+    bytes[0] = (unsigned char) value;
+    bytes[1] = (unsigned char) (value >> 8);
+    memset(mask, 0xff, 2);
+    return 2;
+}
+unsigned int encodeFat32(unsigned int clus, unsigned int value, unsigned char* bytes, unsigned char* mask){
+    (void) clus;
+    memcpy(bytes, &value, 4);
+    memset(mask, 0xff, 4);
+    return 4;
+}
+// indexed by FAT_TYPE_*
+const FatOps fatOps[3] = {
+    {12, decodeFat12, encodeFat12},
+    {16, decodeFat16, encodeFat16},
+    {32, decodeFat32, encodeFat32}
+};
+
+// read one FAT copy (normally the first) once into a compact array and derive the free-cluster bitmap
+// (FALSE if the image is too short to hold it)
+int loadFatTable(Storage* storage, Geometry* geometry, unsigned int copy, FatTable* fat){
+    unsigned long long started = beginPhase();
+    unsigned int totalClusters = geometry->totalClusters;
+    fat->ops = &fatOps[geometry->fatType];
+    fat->totalClusters = totalClusters;
+    fat->entries = (unsigned int*) malloc(sizeof(unsigned int)*(totalClusters+2));
+    fat->freeMap = (unsigned long long*) calloc((totalClusters+2+63)/64, sizeof(unsigned long long));
+    fat->owner = (unsigned int*) malloc(sizeof(unsigned int)*(totalClusters+2));
+    fat->freeCount = 0;
+    // FAT32 entries are read straight into the array, narrower ones through a buffer of the raw bytes
+    // (one spare zero byte, as the last FAT12 entry is decoded from a byte pair)
+    unsigned long long rawSize = sizeof(unsigned int)*(totalClusters+2);
+    unsigned char* raw = (unsigned char*) fat->entries;
+    if(geometry->fatType != FAT_TYPE_32){
+        rawSize = ((unsigned long long) (totalClusters+2)*fat->ops->bits+7)/8;
+        raw = (unsigned char*) calloc(rawSize+1, 1);
+    }
+    int loaded = readStorage(storage, fatEntryOffset(geometry, copy, 0), raw, rawSize);
+    if(loaded){
+        fat->ops->decode(raw, fat->entries, totalClusters+2);
+    }
+    if(raw != (unsigned char*) fat->entries){
+        free(raw);
+    }
+    if(!loaded){
+        freeFatTable(fat);
+        endPhase(STAT_PHASE_FAT, started);
+        return FALSE;
+    }
+    for(unsigned int c = 0; c < totalClusters+2; c++){
+        fat->owner[c] = FAT_NO_OWNER;
+        if(c >= 2 && fat->entries[c] == 0){
+            fat->freeMap[c/64] |= 1ULL << (c%64);
+            fat->freeCount++;
+        }
+    }
+    countStat(STAT_FAT_ENTRIES, totalClusters+2);
+    endPhase(STAT_PHASE_FAT, started);
+    return TRUE;
+}
+void freeFatTable(FatTable* fat){
+    free(fat->entries);
+    free(fat->freeMap);
+    free(fat->owner);
+    fat->entries = NULL;
+    fat->freeMap = NULL;
+    fat->owner = NULL;
+    return;
+}
+int isValidCluster(FatTable* fat, unsigned int clus){
+    return clus >= 2 && clus < fat->totalClusters+2;
+}
+// next cluster of a chain, or 0 when the chain ends (or points somewhere invalid)
+unsigned int nextCluster(FatTable* fat, unsigned int clus){
+    countStat(STAT_FAT_ENTRIES, 1);
+    unsigned int next = fat->entries[clus];
+    if(next >= FAT_BAD_CLUSTER || !isValidCluster(fat, next)){
+        return 0;
+    }
+    return next;
+}
+int isFreeCluster(FatTable* fat, unsigned int clus){
+    return isValidCluster(fat, clus) && (fat->freeMap[clus/64] >> (clus%64) & 1);
+}
+int isFreeRun(FatTable* fat, unsigned int start, unsigned int length){
+    for(unsigned int c = start; c < start+length; c++){
+        if(!isFreeCluster(fat, c)){
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+// keep the decoded table in step with what recovery writes to the image
+void setFatEntry(FatTable* fat, unsigned int clus, unsigned int value){
+    countStat(STAT_FAT_ENTRIES, 1);
+    int wasFree = isFreeCluster(fat, clus);
+    fat->entries[clus] = value & FAT_ENTRY_MASK;
+    if(wasFree && value != 0){
+        fat->freeMap[clus/64] &= ~(1ULL << (clus%64));
+        fat->freeCount--;
+    }
+    else if(!wasFree && value == 0){
+        fat->freeMap[clus/64] |= 1ULL << (clus%64);
+        fat->freeCount++;
+    }
+    return;
+}
+// bytes to write at fatEntryOffset so the on-disk entry of clus becomes value (only the bits set in mask)
+unsigned int encodeFatEntry(FatTable* fat, unsigned int clus, unsigned int value, unsigned char* bytes, unsigned char* mask){
+    return fat->ops->encode(clus, value, bytes, mask);
+}
+// free clusters in disk order, at most maxCount of them
+unsigned int collectFreeClusters(FatTable* fat, unsigned int* clusters, unsigned int maxCount){
+    unsigned int count = 0;
+    unsigned int words = (fat->totalClusters+2+63)/64;
+    for(unsigned int w = 0; w < words && count < maxCount; w++){
+        unsigned long long bits = fat->freeMap[w];
+        while(bits && count < maxCount){
+            clusters[count++] = w*64+__builtin_ctzll(bits);
+            bits &= bits-1;
+        }
+    }
+    return count;
+}
+// run-length form of the chain starting at firstClus (bounded so a looping chain terminates)
+unsigned int getChainExtents(FatTable* fat, unsigned int firstClus, FatExtent** extents){
+    unsigned int count = 0;
+    unsigned int capacity = 0;
+    *extents = NULL;
+    unsigned int clus = isValidCluster(fat, firstClus) ? firstClus : 0;
+    for(unsigned int visited = 0; clus && visited < fat->totalClusters; visited++){
+        if(count > 0 && (*extents)[count-1].start+(*extents)[count-1].length == clus){
+            (*extents)[count-1].length++;
+        }
+        else{
+            if(count == capacity){
+                capacity = capacity ? capacity*2 : 4;
+                *extents = (FatExtent*) realloc(*extents, sizeof(FatExtent)*capacity);
+            }
+            (*extents)[count].start = clus;
+            (*extents)[count].length = 1;
+            count++;
+        }
+        clus = nextCluster(fat, clus);
+    }
+    return count;
+}
+// reverse map: which live entry of the index owns each allocated cluster
+void mapClusterOwners(FatTable* fat, DirIndex* index){
+    for(unsigned int i = 0; i < index->count; i++){
+        IndexEntry* entry = &index->entries[i];
+        if(entry->deleted){
+            continue;
+        }
+        FatExtent* extents;
+        unsigned int extentCount = getChainExtents(fat, entry->firstCluster, &extents);
+        for(unsigned int e = 0; e < extentCount; e++){
+            for(unsigned int c = extents[e].start; c < extents[e].start+extents[e].length; c++){
+                fat->owner[c] = i;
+            }
+        }
+        free(extents);
+    }
+    return;
+}
@@ -0,0 +1,56 @@
+#ifndef FAT_H
+#define FAT_H
+
+#include "nyufile.h"
+#include "storage.h"
+#include "geometry.h"
+
+// cluster that no live file owns
+#define FAT_NO_OWNER 0xffffffff
+
+
+// how one FAT width is read and written; picked once per volume (fatOps[geometry->fatType]) so
+// nothing past loading and write-back ever looks at the width
+typedef struct FatOps {
+    unsigned int bits;
+    // raw on-disk entries to next-cluster values, with the reserved and end-of-chain values widened
+    // to their FAT32 form (count entries; raw and entries may be the same buffer on FAT32)
+    void (*decode)(const unsigned char* raw, unsigned int* entries, unsigned int count);
+    // the bytes that store value as the entry of clus (at fatEntryOffset), returning how many; mask
+    // marks the bits that belong to the entry (a FAT12 entry shares a byte with its neighbour)
+    unsigned int (*encode)(unsigned int clus, unsigned int value, unsigned char* bytes, unsigned char* mask);
+} FatOps;
+
+extern const FatOps fatOps[3];
+
+// a run of consecutive clusters in a chain
+typedef struct FatExtent {
+    unsigned int start;
+    unsigned int length;
+} FatExtent;
+
+// the first FAT decoded once, with what we derive from it
+typedef struct FatTable {
+    const FatOps* ops;
+    unsigned int* entries;              // masked next-cluster value of every cluster, in FAT32 form
+    unsigned int totalClusters;         // data clusters (valid cluster numbers are 2..totalClusters+1)
+    unsigned long long* freeMap;        // bit c set while cluster c is unallocated
+    unsigned int freeCount;
+    unsigned int* owner;                // index entry owning each cluster (FAT_NO_OWNER when none)
+} FatTable;
+
+struct DirIndex;
+
+int loadFatTable(Storage* storage, Geometry* geometry, unsigned int copy, FatTable* fat);
+void freeFatTable(FatTable* fat);
+unsigned int nextCluster(FatTable* fat, unsigned int clus);
+int isValidCluster(FatTable* fat, unsigned int clus);
+int isFreeCluster(FatTable* fat, unsigned int clus);
+int isFreeRun(FatTable* fat, unsigned int start, unsigned int length);
+void setFatEntry(FatTable* fat, unsigned int clus, unsigned int value);
+unsigned int encodeFatEntry(FatTable* fat, unsigned int clus, unsigned int value, unsigned char* bytes, unsigned char* mask);
+unsigned int collectFreeClusters(FatTable* fat, unsigned int* clusters, unsigned int maxCount);
+unsigned int getChainExtents(FatTable* fat, unsigned int firstClus, FatExtent** extents);
+void mapClusterOwners(FatTable* fat, struct DirIndex* index);
+
+#endif
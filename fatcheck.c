@@ -0,0 +1,252 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "fatcheck.h"
+
+void initFatCheck(FatCheck* check, Storage* storage, Geometry* geometry){
+    check->storage = storage;
+    check->geometry = geometry;
+    check->numOfFats = geometry->numOfFats;
+    check->totalClusters = geometry->totalClusters;
+    check->reports = (FatCopyReport*) calloc(check->numOfFats ? check->numOfFats : 1, sizeof(FatCopyReport));
+    check->best = 0;
+    return;
+}
+void freeFatCheck(FatCheck* check){
+    for(unsigned int k = 0; k < check->numOfFats; k++){
+        free(check->reports[k].divergent);
+    }
+    free(check->reports);
+    check->reports = NULL;
+    return;
+}
+// record clusters first..last as divergent, extending the last range when they follow it
+void addFatRange(FatCopyReport* report, unsigned int first, unsigned int last){
+    if(report->divergentCount > 0 && report->divergent[report->divergentCount-1].last+1 == first){
+        report->divergent[report->divergentCount-1].last = last;
+    }
+    else{
+        if(report->divergentCount == report->divergentCapacity){
+            report->divergentCapacity = report->divergentCapacity ? report->divergentCapacity*2 : 16;
+            report->divergent = (FatRange*) realloc(report->divergent, sizeof(FatRange)*report->divergentCapacity);
+        }
+        report->divergent[report->divergentCount].first = first;
+        report->divergent[report->divergentCount].last = last;
+        report->divergentCount++;
+    }
+    report->divergentClusters += last-first+1;
+    return;
+}
+typedef struct FatCompareWorker {
+    FatCheck* check;
+    unsigned int firstCluster;
+    unsigned int lastCluster;           // one past the end
+    FatCopyReport* reports;             // this worker's ranges, one report per copy
+} FatCompareWorker;
+// compare one cluster range of every copy against the first FAT
+void* fatCompareWorker(void* arg){
+    FatCompareWorker* worker = (FatCompareWorker*) arg;
+    FatCheck* check = worker->check;
+    Storage* storage = check->storage;
+    unsigned char* scratchFirst = storage->map ? NULL : (unsigned char*) malloc(FATCHECK_CHUNK*4);
+    unsigned char* scratchCopy = storage->map ? NULL : (unsigned char*) malloc(FATCHECK_CHUNK*4);
+    for(unsigned int start = worker->firstCluster; start < worker->lastCluster; start += FATCHECK_CHUNK){
+        unsigned int count = worker->lastCluster-start < FATCHECK_CHUNK ? worker->lastCluster-start : FATCHECK_CHUNK;
+        const unsigned int* first = (const unsigned int*) viewStorage(storage, fatEntryOffset(check->geometry, 0, start), 4ULL*count, scratchFirst);
+        for(unsigned int k = 1; k < check->numOfFats; k++){
+            const unsigned int* copy = (const unsigned int*) viewStorage(storage, fatEntryOffset(check->geometry, k, start), 4ULL*count, scratchCopy);
+            // a copy cut short by the end of the image differs everywhere it is missing
+            if(!first || !copy){
+                addFatRange(&worker->reports[k], start, start+count-1);
+                continue;
+            }
+            // whole blocks go through memcmp (vectorized by libc); entries only where a block differs
+            for(unsigned int block = 0; block < count; block += FATCHECK_BLOCK){
+                unsigned int blockCount = count-block < FATCHECK_BLOCK ? count-block : FATCHECK_BLOCK;
+                if(memcmp(&first[block], &copy[block], 4*blockCount) == 0){
+                    continue;
+                }
+                for(unsigned int i = block; i < block+blockCount; i++){
+                    // the top 4 bits are reserved and may differ harmlessly
+                    if((first[i] ^ copy[i]) & FAT_ENTRY_MASK){
+                        addFatRange(&worker->reports[k], start+i, start+i);
+                    }
+                }
+            }
+        }
+    }
+    free(scratchFirst);
+    free(scratchCopy);
+    return NULL;
+}
+// FAT12/16 variant: their FATs are at most 128 KiB, so every copy is decoded whole and compared entry by entry
+int compareNarrowFatCopies(FatCheck* check){
+    FatTable first;
+    if(!loadFatTable(check->storage, check->geometry, 0, &first)){
+        first.entries = NULL;
+    }
+    int agree = TRUE;
+    for(unsigned int k = 1; k < check->numOfFats; k++){
+        FatCopyReport* report = &check->reports[k];
+        FatTable copy;
+        if(!first.entries || !loadFatTable(check->storage, check->geometry, k, &copy)){
+            addFatRange(report, 2, check->totalClusters+1);
+            agree = FALSE;
+            continue;
+        }
+        for(unsigned int c = 2; c < check->totalClusters+2; c++){
+            if(first.entries[c] != copy.entries[c]){
+                addFatRange(report, c, c);
+                agree = FALSE;
+            }
+        }
+        freeFatTable(&copy);
+    }
+    if(first.entries){
+        freeFatTable(&first);
+    }
+    return agree;
+}
+// compare every copy against the first one, cluster ranges split across threads;
+// TRUE when all copies agree
+int compareFatCopies(FatCheck* check){
+    if(check->numOfFats < 2){
+        return TRUE;
+    }
+    if(check->geometry->fatType != FAT_TYPE_32){
+        return compareNarrowFatCopies(check);
+    }
+    long numOfCpus = sysconf(_SC_NPROCESSORS_ONLN);
+    unsigned int numOfWorkers = numOfCpus > 0 ? (unsigned int) numOfCpus : 1;
+    unsigned int endCluster = check->totalClusters+2;
+    unsigned int perWorker = (check->totalClusters+numOfWorkers-1)/numOfWorkers;
+    if(perWorker == 0){
+        perWorker = 1;
+    }
+    pthread_t* threads = (pthread_t*) malloc(sizeof(pthread_t)*numOfWorkers);
+    FatCompareWorker* workers = (FatCompareWorker*) malloc(sizeof(FatCompareWorker)*numOfWorkers);
+    for(unsigned int i = 0; i < numOfWorkers; i++){
+        workers[i].check = check;
+        // entries 0 and 1 are reserved, the data clusters start at 2
+        workers[i].firstCluster = 2+i*perWorker < endCluster ? 2+i*perWorker : endCluster;
+        workers[i].lastCluster = 2+(i+1)*perWorker < endCluster ? 2+(i+1)*perWorker : endCluster;
+        workers[i].reports = (FatCopyReport*) calloc(check->numOfFats, sizeof(FatCopyReport));
+        pthread_create(&threads[i], NULL, fatCompareWorker, &workers[i]);
+    }
+    for(unsigned int i = 0; i < numOfWorkers; i++){
+        pthread_join(threads[i], NULL);
+    }
+    // stitch the per-worker ranges together in cluster order
+    int agree = TRUE;
+    for(unsigned int k = 1; k < check->numOfFats; k++){
+        FatCopyReport* report = &check->reports[k];
+        for(unsigned int i = 0; i < numOfWorkers; i++){
+            FatCopyReport* part = &workers[i].reports[k];
+            for(unsigned int r = 0; r < part->divergentCount; r++){
+                addFatRange(report, part->divergent[r].first, part->divergent[r].last);
+            }
+        }
+        if(report->divergentClusters > 0){
+            agree = FALSE;
+        }
+    }
+    for(unsigned int i = 0; i < numOfWorkers; i++){
+        for(unsigned int k = 0; k < check->numOfFats; k++){
+            free(workers[i].reports[k].divergent);
+        }
+        free(workers[i].reports);
+    }
+    free(threads);
+    free(workers);
+    return agree;
+}
+typedef struct FatScoreWorker {
+    FatCheck* check;
+    unsigned int copy;
+    unsigned char* started;             // clusters a live directory entry (or the root) starts a chain at
+} FatScoreWorker;
+// decode one copy and count what can't be right: wild pointers, cross links, orphaned chains
+void* fatScoreWorker(void* arg){
+    FatScoreWorker* worker = (FatScoreWorker*) arg;
+    FatCheck* check = worker->check;
+    FatCopyReport* report = &check->reports[worker->copy];
+    FatTable fat;
+    if(!loadFatTable(check->storage, check->geometry, worker->copy, &fat)){
+        // unreadable copy - never the best one
+        report->invalidCount = check->totalClusters;
+        return NULL;
+    }
+    unsigned char* inDegree = (unsigned char*) calloc(check->totalClusters+2, sizeof(unsigned char));
+    for(unsigned int c = 2; c < check->totalClusters+2; c++){
+        unsigned int next = fat.entries[c];
+        if(next == 0 || next >= FAT_BAD_CLUSTER){
+            continue;
+        }
+        if(!isValidCluster(&fat, next)){
+            report->invalidCount++;
+            continue;
+        }
+        if(inDegree[next] < 255){
+            inDegree[next]++;
+        }
+    }
+    for(unsigned int c = 2; c < check->totalClusters+2; c++){
+        if(inDegree[c] > 1){
+            if(report->crossLinkedCount < FATCHECK_MAX_LISTED){
+                report->crossLinked[report->crossLinkedCount] = c;
+            }
+            report->crossLinkedCount++;
+        }
+        // an allocated cluster nothing points to must be where some file starts
+        unsigned int value = fat.entries[c];
+        if(value != 0 && value != FAT_BAD_CLUSTER && inDegree[c] == 0 && !worker->started[c]){
+            if(report->orphanCount < FATCHECK_MAX_LISTED){
+                report->orphans[report->orphanCount] = c;
+            }
+            report->orphanCount++;
+        }
+    }
+    free(inDegree);
+    freeFatTable(&fat);
+    return NULL;
+}
+// score every copy (one thread each) and pick the one with the fewest inconsistencies
+void scoreFatCopies(FatCheck* check, DirIndex* index){
+    unsigned int rootCluster = check->geometry->rootCluster;
+    unsigned char* started = (unsigned char*) calloc(check->totalClusters+2, sizeof(unsigned char));
+    if(rootCluster >= 2 && rootCluster < check->totalClusters+2){
+        started[rootCluster] = TRUE;
+    }
+    for(unsigned int i = 0; index && i < index->count; i++){
+        IndexEntry* entry = &index->entries[i];
+        if(!entry->deleted && entry->firstCluster >= 2 && entry->firstCluster < check->totalClusters+2){
+            started[entry->firstCluster] = TRUE;
+        }
+    }
+    pthread_t* threads = (pthread_t*) malloc(sizeof(pthread_t)*check->numOfFats);
+    FatScoreWorker* workers = (FatScoreWorker*) malloc(sizeof(FatScoreWorker)*check->numOfFats);
+    for(unsigned int k = 0; k < check->numOfFats; k++){
+        workers[k].check = check;
+        workers[k].copy = k;
+        workers[k].started = started;
+        pthread_create(&threads[k], NULL, fatScoreWorker, &workers[k]);
+    }
+    for(unsigned int k = 0; k < check->numOfFats; k++){
+        pthread_join(threads[k], NULL);
+    }
+    // ties go to the lower copy (normally FAT 1)
+    unsigned long long bestScore = ~0ULL;
+    for(unsigned int k = 0; k < check->numOfFats; k++){
+        FatCopyReport* report = &check->reports[k];
+        unsigned long long score = (unsigned long long) report->invalidCount+report->crossLinkedCount+report->orphanCount;
+        if(score < bestScore){
+            bestScore = score;
+            check->best = k;
+        }
+    }
+    free(threads);
+    free(workers);
+    free(started);
+    return;
+}
@@ -0,0 +1,50 @@
+#ifndef FATCHECK_H
+#define FATCHECK_H
+
+#include "nyufile.h"
+#include "fat.h"
+#include "dirindex.h"
+#include "storage.h"
+#include "geometry.h"
+
+// entries compared per step (4 MiB of FAT) and per memcmp block inside a differing step
+#define FATCHECK_CHUNK (1U << 20)
+#define FATCHECK_BLOCK 1024
+// cross-linked clusters and orphaned chains listed per FAT (the rest are only counted)
+#define FATCHECK_MAX_LISTED 16
+
+// clusters first..last (inclusive)
+typedef struct FatRange {
+    unsigned int first;
+    unsigned int last;
+} FatRange;
+
+// how one FAT copy compares to the first and how plausible its chains are
+typedef struct FatCopyReport {
+    FatRange* divergent;                // ranges that differ from FAT 1 (empty for FAT 1 itself)
+    unsigned int divergentCount;
+    unsigned int divergentCapacity;
+    unsigned int divergentClusters;
+    unsigned int invalidCount;          // entries pointing outside the data area
+    unsigned int crossLinkedCount;      // clusters that more than one cluster points to
+    unsigned int orphanCount;           // chains no directory entry starts
+    unsigned int crossLinked[FATCHECK_MAX_LISTED];
+    unsigned int orphans[FATCHECK_MAX_LISTED];
+} FatCopyReport;
+
+// every FAT copy of the image, compared and scored
+typedef struct FatCheck {
+    Storage* storage;
+    Geometry* geometry;
+    unsigned int numOfFats;
+    unsigned int totalClusters;
+    FatCopyReport* reports;
+    unsigned int best;                  // copy recovery should use (0-based)
+} FatCheck;
+
+void initFatCheck(FatCheck* check, Storage* storage, Geometry* geometry);
+void freeFatCheck(FatCheck* check);
+int compareFatCopies(FatCheck* check);
+void scoreFatCopies(FatCheck* check, DirIndex* index);
+
+#endif
@@ -0,0 +1,246 @@
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "fetch.h"
+
+// no liburing - the three syscalls are all we need
+int ringSetup(unsigned int entries, struct io_uring_params* params){
+    return (int) syscall(__NR_io_uring_setup, entries, params);
+}
+int ringEnter(int ringFd, unsigned int toSubmit, unsigned int minComplete, unsigned int flags){
+    return (int) syscall(__NR_io_uring_enter, ringFd, toSubmit, minComplete, flags, NULL, 0);
+}
+// map the submission and completion rings; FALSE leaves the queue on the thread pool
+int openRing(FetchQueue* queue){
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    queue->ringFd = ringSetup(queue->depth, &params);
+    if(queue->ringFd < 0){
+        return FALSE;
+    }
+    queue->sqRingSize = params.sq_off.array+params.sq_entries*sizeof(unsigned int);
+    queue->cqRingSize = params.cq_off.cqes+params.cq_entries*sizeof(struct io_uring_cqe);
+    if(params.features & IORING_FEAT_SINGLE_MMAP){
+        if(queue->cqRingSize > queue->sqRingSize){
+            queue->sqRingSize = queue->cqRingSize;
+        }
+        queue->cqRingSize = queue->sqRingSize;
+    }
+    queue->sqRing = mmap(NULL, queue->sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, queue->ringFd, IORING_OFF_SQ_RING);
+    if(queue->sqRing == MAP_FAILED){
+        close(queue->ringFd);
+        return FALSE;
+    }
+    queue->cqRing = queue->sqRing;
+    if(!(params.features & IORING_FEAT_SINGLE_MMAP)){
+        queue->cqRing = mmap(NULL, queue->cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, queue->ringFd, IORING_OFF_CQ_RING);
+        if(queue->cqRing == MAP_FAILED){
+            munmap(queue->sqRing, queue->sqRingSize);
+            close(queue->ringFd);
+            return FALSE;
+        }
+    }
+    queue->sqesSize = params.sq_entries*sizeof(struct io_uring_sqe);
+    queue->sqes = (struct io_uring_sqe*) mmap(NULL, queue->sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, queue->ringFd, IORING_OFF_SQES);
+    if(queue->sqes == MAP_FAILED){
+        if(queue->cqRing != queue->sqRing){
+            munmap(queue->cqRing, queue->cqRingSize);
+        }
+        munmap(queue->sqRing, queue->sqRingSize);
+        close(queue->ringFd);
+        return FALSE;
+    }
+    unsigned char* sq = (unsigned char*) queue->sqRing;
+    unsigned char* cq = (unsigned char*) queue->cqRing;
+    queue->sqTail = (unsigned int*) &sq[params.sq_off.tail];
+    queue->sqMask = (unsigned int*) &sq[params.sq_off.ring_mask];
+    queue->sqArray = (unsigned int*) &sq[params.sq_off.array];
+    queue->cqHead = (unsigned int*) &cq[params.cq_off.head];
+    queue->cqTail = (unsigned int*) &cq[params.cq_off.tail];
+    queue->cqMask = (unsigned int*) &cq[params.cq_off.ring_mask];
+    queue->cqes = (struct io_uring_cqe*) &cq[params.cq_off.cqes];
+    queue->unsubmitted = 0;
+    return TRUE;
+}
+void* fetchWorker(void* arg){
+    FetchQueue* queue = (FetchQueue*) arg;
+    pthread_mutex_lock(&queue->lock);
+    while(TRUE){
+        while(queue->pendingCount == 0 && !queue->closing){
+            pthread_cond_wait(&queue->workReady, &queue->lock);
+        }
+        if(queue->pendingCount == 0){
+            break;
+        }
+        FetchSlot* slot = &queue->slots[queue->pending[queue->pendingHead]];
+        queue->pendingHead = (queue->pendingHead+1)%queue->depth;
+        queue->pendingCount--;
+        pthread_mutex_unlock(&queue->lock);
+        ssize_t count = preadStorage(queue->storage, slot->buffer, slot->span, slot->offset-slot->head);
+        pthread_mutex_lock(&queue->lock);
+        slot->result = count >= 0 ? count : -errno;
+        slot->done = TRUE;
+        pthread_cond_broadcast(&queue->workDone);
+    }
+    pthread_mutex_unlock(&queue->lock);
+    return NULL;
+}
+// depth slots of at most maxLength bytes each, served by io_uring if the kernel lets us
+void initFetchQueue(FetchQueue* queue, Storage* storage, unsigned int depth, unsigned int maxLength){
+    queue->storage = storage;
+    queue->depth = depth;
+    queue->maxLength = maxLength;
+    queue->align = storage->directAlign;
+    // room to widen any request to the alignment on both ends
+    unsigned int stride = (maxLength+2*queue->align+queue->align-1)/queue->align*queue->align;
+    queue->slots = (FetchSlot*) calloc(depth, sizeof(FetchSlot));
+    if(posix_memalign((void**) &queue->buffers, queue->align, (size_t) stride*depth) != 0){
+        queue->buffers = NULL;
+    }
+    for(unsigned int i = 0; i < depth; i++){
+        queue->slots[i].buffer = queue->buffers ? &queue->buffers[(size_t) stride*i] : NULL;
+        queue->slots[i].done = TRUE;
+    }
+    queue->threads = NULL;
+    queue->numOfThreads = 0;
+    queue->pending = NULL;
+    queue->useRing = FETCH_USE_URING && openRing(queue);
+    if(queue->useRing){
+        return;
+    }
+    queue->pending = (unsigned int*) malloc(sizeof(unsigned int)*depth);
+    queue->pendingHead = 0;
+    queue->pendingCount = 0;
+    queue->closing = FALSE;
+    pthread_mutex_init(&queue->lock, NULL);
+    pthread_cond_init(&queue->workReady, NULL);
+    pthread_cond_init(&queue->workDone, NULL);
+    queue->numOfThreads = depth < FETCH_THREADS ? depth : FETCH_THREADS;
+    queue->threads = (pthread_t*) malloc(sizeof(pthread_t)*queue->numOfThreads);
+    for(unsigned int i = 0; i < queue->numOfThreads; i++){
+        pthread_create(&queue->threads[i], NULL, fetchWorker, queue);
+    }
+    return;
+}
+void freeFetchQueue(FetchQueue* queue){
+    if(queue->useRing){
+        munmap(queue->sqes, queue->sqesSize);
+        if(queue->cqRing != queue->sqRing){
+            munmap(queue->cqRing, queue->cqRingSize);
+        }
+        munmap(queue->sqRing, queue->sqRingSize);
+        close(queue->ringFd);
+    }
+    else{
+        pthread_mutex_lock(&queue->lock);
+        queue->closing = TRUE;
+        pthread_cond_broadcast(&queue->workReady);
+        pthread_mutex_unlock(&queue->lock);
+        for(unsigned int i = 0; i < queue->numOfThreads; i++){
+            pthread_join(queue->threads[i], NULL);
+        }
+        free(queue->threads);
+        free(queue->pending);
+        pthread_mutex_destroy(&queue->lock);
+        pthread_cond_destroy(&queue->workReady);
+        pthread_cond_destroy(&queue->workDone);
+    }
+    free(queue->slots);
+    free(queue->buffers);
+    return;
+}
+// start reading length bytes at offset into slot (the slot must not be in flight)
+void submitFetch(FetchQueue* queue, unsigned int slot, unsigned long long offset, unsigned int length, unsigned long long tag){
+    FetchSlot* fetch = &queue->slots[slot];
+    unsigned int align = storageAlign(queue->storage);
+    fetch->offset = offset;
+    fetch->length = length < queue->maxLength ? length : queue->maxLength;
+    fetch->head = (unsigned int) (offset%align);
+    fetch->span = (fetch->head+fetch->length+align-1)/align*align;
+    fetch->tag = tag;
+    fetch->result = 0;
+    fetch->done = FALSE;
+    if(!fetch->buffer){
+        fetch->done = TRUE;
+        fetch->result = -ENOMEM;
+        return;
+    }
+    if(queue->useRing){
+        // aligned reads go to the O_DIRECT descriptor, like preadStorage
+        int direct = align > 1 && ((unsigned long) fetch->buffer & (align-1)) == 0;
+        unsigned int tail = *queue->sqTail;
+        unsigned int index = tail & *queue->sqMask;
+        struct io_uring_sqe* sqe = &queue->sqes[index];
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode = IORING_OP_READ;
+        sqe->fd = direct ? queue->storage->directFd : queue->storage->fd;
+        sqe->addr = (unsigned long) fetch->buffer;
+        sqe->len = fetch->span;
+        sqe->off = offset-fetch->head;
+        sqe->user_data = slot;
+        queue->sqArray[index] = index;
+        __atomic_store_n(queue->sqTail, tail+1, __ATOMIC_RELEASE);
+        queue->unsubmitted++;
+        return;
+    }
+    pthread_mutex_lock(&queue->lock);
+    queue->pending[(queue->pendingHead+queue->pendingCount)%queue->depth] = slot;
+    queue->pendingCount++;
+    pthread_cond_signal(&queue->workReady);
+    pthread_mutex_unlock(&queue->lock);
+    return;
+}
+void reapRing(FetchQueue* queue){
+    unsigned int head = *queue->cqHead;
+    unsigned int tail = __atomic_load_n(queue->cqTail, __ATOMIC_ACQUIRE);
+    for(; head != tail; head++){
+        struct io_uring_cqe* cqe = &queue->cqes[head & *queue->cqMask];
+        FetchSlot* fetch = &queue->slots[cqe->user_data];
+        fetch->result = cqe->res;
+        fetch->done = TRUE;
+    }
+    __atomic_store_n(queue->cqHead, head, __ATOMIC_RELEASE);
+    return;
+}
+// block until slot is read; the requested bytes, or NULL if they can't be read
+const unsigned char* waitFetch(FetchQueue* queue, unsigned int slot){
+    FetchSlot* fetch = &queue->slots[slot];
+    if(queue->useRing){
+        while(TRUE){
+            reapRing(queue);
+            if(fetch->done){
+                break;
+            }
+            int submitted = ringEnter(queue->ringFd, queue->unsubmitted, 1, IORING_ENTER_GETEVENTS);
+            if(submitted < 0 && errno != EINTR){
+                // the ring broke down - read this one ourselves
+                fetch->result = -errno;
+                fetch->done = TRUE;
+                break;
+            }
+            if(submitted > 0){
+                queue->unsubmitted -= (unsigned int) submitted;
+            }
+        }
+    }
+    else{
+        pthread_mutex_lock(&queue->lock);
+        while(!fetch->done){
+            pthread_cond_wait(&queue->workDone, &queue->lock);
+        }
+        pthread_mutex_unlock(&queue->lock);
+    }
+    if(!fetch->buffer){
+        return NULL;
+    }
+    // short read, rejected O_DIRECT alignment or an error - finish it synchronously
+    if(fetch->result < (long long) fetch->head+fetch->length){
+        if(!readStorage(queue->storage, fetch->offset, &fetch->buffer[fetch->head], fetch->length)){
+            return NULL;
+        }
+    }
+    return &fetch->buffer[fetch->head];
+}
@@ -0,0 +1,74 @@
+#ifndef FETCH_H
+#define FETCH_H
+
+#include <pthread.h>
+#include <linux/io_uring.h>
+#include "nyufile.h"
+#include "storage.h"
+
+// reads kept in flight by the batch hashing and scanning loops
+#define FETCH_DEPTH 32
+// largest single read of the hashing pipeline
+#define FETCH_CHUNK (256U << 10)
+// threads that stand in for io_uring when the kernel (or a sandbox) refuses it
+#define FETCH_THREADS 8
+// build with -DFETCH_USE_URING=0 to always use the thread pool
+#ifndef FETCH_USE_URING
+#define FETCH_USE_URING 1
+#endif
+
+// one read of the pipeline; the caller picks the slot and later waits on it
+typedef struct FetchSlot {
+    unsigned long long offset;          // what the caller asked for
+    unsigned int length;
+    unsigned int head;                  // bytes read before offset to satisfy the O_DIRECT alignment
+    unsigned int span;                  // bytes actually requested from the kernel
+    unsigned char* buffer;
+    long long result;                   // bytes read, or -errno
+    int done;
+    unsigned long long tag;             // free for the caller (cluster, file index...)
+} FetchSlot;
+
+// a fixed set of slots served by an io_uring instance or a small thread pool
+typedef struct FetchQueue {
+    Storage* storage;
+    unsigned int depth;
+    unsigned int maxLength;
+    unsigned int align;
+    FetchSlot* slots;
+    unsigned char* buffers;
+    int useRing;
+    // io_uring
+    int ringFd;
+    void* sqRing;
+    size_t sqRingSize;
+    void* cqRing;
+    size_t cqRingSize;
+    struct io_uring_sqe* sqes;
+    size_t sqesSize;
+    unsigned int* sqTail;
+    unsigned int* sqMask;
+    unsigned int* sqArray;
+    unsigned int* cqHead;
+    unsigned int* cqTail;
+    unsigned int* cqMask;
+    struct io_uring_cqe* cqes;
+    unsigned int unsubmitted;
+    // thread pool fallback
+    pthread_t* threads;
+    unsigned int numOfThreads;
+    unsigned int* pending;              // slots waiting for a thread (ring of depth entries)
+    unsigned int pendingHead;
+    unsigned int pendingCount;
+    int closing;
+    pthread_mutex_t lock;
+    pthread_cond_t workReady;
+    pthread_cond_t workDone;
+} FetchQueue;
+
+void initFetchQueue(FetchQueue* queue, Storage* storage, unsigned int depth, unsigned int maxLength);
+void freeFetchQueue(FetchQueue* queue);
+void submitFetch(FetchQueue* queue, unsigned int slot, unsigned long long offset, unsigned int length, unsigned long long tag);
+const unsigned char* waitFetch(FetchQueue* queue, unsigned int slot);
+
+#endif
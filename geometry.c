@@ -0,0 +1,92 @@
+#include "geometry.h"
+
+// log2 of a power of two (-1 for anything else)
+int powerOfTwoShift(unsigned int value){
+    if(value == 0 || (value & (value-1)) != 0){
+        return -1;
+    }
+    int shift = 0;
+    while((1U << shift) != value){
+        shift++;
+    }
+    return shift;
+}
+// FALSE unless the boot sector describes a FAT volume we can address
+int loadGeometry(BootEntry* bootSector, Geometry* geometry){
+    int secShift = powerOfTwoShift(bootSector->BPB_BytsPerSec);
+    int clusShift = powerOfTwoShift(bootSector->BPB_SecPerClus);
+    // 512 to 4096 bytes per sector, 1 to 128 sectors per cluster
+    if(secShift < 9 || secShift > 12 || clusShift < 0 || clusShift > 7){
+        return FALSE;
+    }
+    // FAT12/16 keep the FAT size and (on small volumes) the sector count in the 16-bit fields
+    unsigned int secPerFat = bootSector->BPB_FATSz16 ? bootSector->BPB_FATSz16 : bootSector->BPB_FATSz32;
+    unsigned int totalSectors = bootSector->BPB_TotSec16 ? bootSector->BPB_TotSec16 : bootSector->BPB_TotSec32;
+    if(bootSector->BPB_RsvdSecCnt == 0 || bootSector->BPB_NumFATs == 0 || secPerFat == 0){
+        return FALSE;
+    }
+    geometry->bytesPerSec = bootSector->BPB_BytsPerSec;
+    geometry->secPerClus = bootSector->BPB_SecPerClus;
+    geometry->clusShift = (unsigned int) (secShift+clusShift);
+    geometry->bytesPerClus = 1U << geometry->clusShift;
+    geometry->clusMask = geometry->bytesPerClus-1;
+    geometry->numOfFats = bootSector->BPB_NumFATs;
+    geometry->fatAreaStartIndex = (unsigned long long) bootSector->BPB_RsvdSecCnt << secShift;
+    geometry->bytesPerFat = (unsigned long long) secPerFat << secShift;
+    // the fixed root directory of FAT12/16 sits between the FATs and the data area, rounded up to whole sectors
+    geometry->rootDirStartIndex = geometry->fatAreaStartIndex+geometry->numOfFats*geometry->bytesPerFat;
+    geometry->rootDirBytes = bootSector->BPB_RootEntCnt*32U;
+    unsigned long long rootDirSize = ((unsigned long long) geometry->rootDirBytes+geometry->bytesPerSec-1) >> secShift << secShift;
+    geometry->dataAreaStartIndex = geometry->rootDirStartIndex+rootDirSize;
+    geometry->volumeSize = (unsigned long long) totalSectors << secShift;
+    if(geometry->volumeSize < geometry->dataAreaStartIndex+geometry->bytesPerClus){
+        return FALSE;
+    }
+    unsigned long long totalClusters = (geometry->volumeSize-geometry->dataAreaStartIndex) >> geometry->clusShift;
+    // the cluster count decides the FAT width; a FAT32 boot sector (no 16-bit FAT size, no fixed root)
+    // stays FAT32 however small the volume is, as mkfs and the kernel allow
+    unsigned int maxCluster;
+    if(bootSector->BPB_FATSz16 == 0 && geometry->rootDirBytes == 0){
+        geometry->fatType = FAT_TYPE_32;
+        geometry->fatBits = 32;
+        // FAT32 cluster numbers are 28 bits
+        maxCluster = FAT_BAD_CLUSTER;
+    }
+    else if(geometry->rootDirBytes == 0){
+        return FALSE;
+    }
+    else if(totalClusters <= FAT12_MAX_CLUSTERS){
+        geometry->fatType = FAT_TYPE_12;
+        geometry->fatBits = 12;
+        maxCluster = 0xff7;
+    }
+    else if(totalClusters <= FAT16_MAX_CLUSTERS){
+        geometry->fatType = FAT_TYPE_16;
+        geometry->fatBits = 16;
+        maxCluster = 0xfff7;
+    }
+    else{
+        return FALSE;
+    }
+    // data clusters, bounded by the number of entries one FAT can hold
+    unsigned long long fatEntries = geometry->bytesPerFat*8/geometry->fatBits;
+    if(fatEntries < 3){
+        return FALSE;
+    }
+    if(totalClusters+2 > fatEntries){
+        totalClusters = fatEntries-2;
+    }
+    if(totalClusters+2 > maxCluster){
+        totalClusters = maxCluster-2;
+    }
+    geometry->totalClusters = (unsigned int) totalClusters;
+    if(geometry->fatType != FAT_TYPE_32){
+        geometry->rootCluster = 0;
+        return TRUE;
+    }
+    geometry->rootCluster = bootSector->BPB_RootClus;
+    if(geometry->rootCluster < 2 || geometry->rootCluster >= geometry->totalClusters+2){
+        return FALSE;
+    }
+    return TRUE;
+}
@@ -0,0 +1,49 @@
+#ifndef GEOMETRY_H
+#define GEOMETRY_H
+
+#include "nyufile.h"
+
+// FAT width, decided by the number of data clusters (indexes fatOps)
+#define FAT_TYPE_12 0
+#define FAT_TYPE_16 1
+#define FAT_TYPE_32 2
+#define FAT12_MAX_CLUSTERS 4084
+#define FAT16_MAX_CLUSTERS 65524
+
+// layout of the volume, derived from the boot sector once and checked; every offset is 64-bit
+// (sector and cluster sizes are validated powers of two, so cluster arithmetic is shifts and masks)
+typedef struct Geometry {
+    unsigned int bytesPerSec;
+    unsigned int secPerClus;
+    unsigned int bytesPerClus;
+    unsigned int clusShift;             // log2(bytesPerClus)
+    unsigned int clusMask;              // bytesPerClus-1
+    unsigned int numOfFats;
+    unsigned int fatType;               // FAT_TYPE_*
+    unsigned int fatBits;               // 12, 16 or 32 bits per FAT entry
+    unsigned long long fatAreaStartIndex;   // byte offset of the first FAT (end of the reserved area)
+    unsigned long long bytesPerFat;
+    unsigned long long dataAreaStartIndex;  // byte offset of cluster 2
+    unsigned long long volumeSize;      // bytes the boot sector says the volume spans
+    unsigned long long rootDirStartIndex;   // FAT12/16 root directory region (right before the data area)
+    unsigned int rootDirBytes;          // 0 on FAT32, whose root directory is a cluster chain
+    unsigned int rootCluster;           // 0 on FAT12/16
+    unsigned int totalClusters;         // data clusters (valid cluster numbers are 2..totalClusters+1)
+} Geometry;
+
+int loadGeometry(BootEntry* bootSector, Geometry* geometry);
+
+// byte offset of a data cluster
+static inline unsigned long long clusterStart(const Geometry* geometry, unsigned int cluster){
+    return geometry->dataAreaStartIndex+((unsigned long long) (cluster-2) << geometry->clusShift);
+}
+// byte offset of a cluster's entry in one FAT copy (of the byte holding its low bits on FAT12)
+static inline unsigned long long fatEntryOffset(const Geometry* geometry, unsigned int copy, unsigned int cluster){
+    return geometry->fatAreaStartIndex+copy*geometry->bytesPerFat+(((unsigned long long) cluster*geometry->fatBits) >> 3);
+}
+// clusters needed to hold size bytes
+static inline unsigned int clustersFor(const Geometry* geometry, unsigned long long size){
+    return (unsigned int) ((size+geometry->clusMask) >> geometry->clusShift);
+}
+
+#endif
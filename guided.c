@@ -0,0 +1,301 @@
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "guided.h"
+#include "fetch.h"
+#include "stats.h"
+
+// one line of a hash list: 40 hex digits, then the end of the line or whitespace (sha1sum adds a name)
+int parseBlockHash(char* line, unsigned char* digest){
+    for(unsigned int i = 0; i < SHA_DIGEST_LENGTH; i++){
+        unsigned int byte;
+        if(!isxdigit((unsigned char) line[i*2]) || !isxdigit((unsigned char) line[i*2+1]) || sscanf(&line[i*2], "%2x", &byte) != 1){
+            return FALSE;
+        }
+        digest[i] = (unsigned char) byte;
+    }
+    return line[SHA_DIGEST_LENGTH*2] == '\0' || isspace((unsigned char) line[SHA_DIGEST_LENGTH*2]);
+}
+void appendBlockHash(BlockGuide* guide, unsigned int* capacity, unsigned char* digest){
+    if(guide->blockCount == *capacity){
+        *capacity *= 2;
+        guide->blocks = (unsigned char (*)[SHA_DIGEST_LENGTH]) realloc(guide->blocks, (size_t) SHA_DIGEST_LENGTH*(*capacity));
+    }
+    memcpy(guide->blocks[guide->blockCount++], digest, SHA_DIGEST_LENGTH);
+    return;
+}
+// either a per-block hash list (one SHA-1 per cluster-sized block, in file order, e.g. sha1sum over the
+// pieces of split -b) or the reference file itself, hashed here block by block; FALSE if it can't be
+// read or a hash list has a malformed line
+int loadBlockGuide(char* path, unsigned int bytesPerClus, BlockGuide* guide){
+    FILE* file = fopen(path, "rb");
+    if(!file){
+        return FALSE;
+    }
+    unsigned int capacity = 64;
+    guide->blocks = (unsigned char (*)[SHA_DIGEST_LENGTH]) malloc((size_t) SHA_DIGEST_LENGTH*capacity);
+    guide->blockCount = 0;
+    guide->fileSize = 0;
+    // a hash list starts with 40 hex digits
+    char first[SHA_DIGEST_LENGTH*2+2] = {0};
+    unsigned char digest[SHA_DIGEST_LENGTH];
+    size_t peeked = fread(first, 1, sizeof(first)-1, file);
+    guide->fromList = peeked >= SHA_DIGEST_LENGTH*2 && parseBlockHash(first, digest);
+    rewind(file);
+    int ok = TRUE;
+    if(guide->fromList){
+        char line[4096];
+        while(ok && fgets(line, sizeof(line), file)){
+            // blank lines are skipped
+            if(line[strspn(line, " \t\r\n")] == '\0'){
+                continue;
+            }
+            ok = parseBlockHash(line, digest);
+            if(ok){
+                appendBlockHash(guide, &capacity, digest);
+            }
+        }
+    }
+    else{
+        unsigned char* block = (unsigned char*) malloc(bytesPerClus);
+        size_t length;
+        while((length = fread(block, 1, bytesPerClus, file)) > 0){
+            SHA1(block, length, digest);
+            appendBlockHash(guide, &capacity, digest);
+            guide->fileSize += length;
+        }
+        free(block);
+    }
+    ok = !ferror(file) && ok;
+    fclose(file);
+    if(!ok){
+        freeBlockGuide(guide);
+    }
+    return ok;
+}
+void freeBlockGuide(BlockGuide* guide){
+    free(guide->blocks);
+    guide->blocks = NULL;
+    guide->blockCount = 0;
+    return;
+}
+// one pass hashing the first bytes of each listed cluster, shared by the hashing threads
+typedef struct DigestPass {
+    Storage* storage;
+    Geometry* geometry;
+    unsigned int* clusters;
+    unsigned int count;
+    unsigned int bytes;
+    unsigned char (*digests)[SHA_DIGEST_LENGTH];
+    unsigned int next;                  // first cluster of the next batch to hand out
+    unsigned int depth;                 // reads each thread keeps in flight
+} DigestPass;
+void* digestPassWorker(void* arg){
+    DigestPass* pass = (DigestPass*) arg;
+    FetchQueue queue;
+    initFetchQueue(&queue, pass->storage, pass->depth, pass->bytes);
+    while(TRUE){
+        unsigned int first = __atomic_fetch_add(&pass->next, GUIDE_BATCH, __ATOMIC_RELAXED);
+        if(first >= pass->count){
+            break;
+        }
+        unsigned int last = pass->count-first < GUIDE_BATCH ? pass->count : first+GUIDE_BATCH;
+        unsigned int issued = first;
+        unsigned int read = 0;
+        for(unsigned int i = first; i < last; i++){
+            while(issued-i < pass->depth && issued < last){
+                submitFetch(&queue, (issued-first)%pass->depth, clusterStart(pass->geometry, pass->clusters[issued]), pass->bytes, issued);
+                issued++;
+            }
+            const unsigned char* content = waitFetch(&queue, (i-first)%pass->depth);
+            // a cluster past the end of a truncated image matches nothing
+            if(!content){
+                memset(pass->digests[i], 0, SHA_DIGEST_LENGTH);
+                continue;
+            }
+            SHA1(content, pass->bytes, pass->digests[i]);
+            read++;
+        }
+        countStat(STAT_CLUSTERS_READ, read);
+        countStat(STAT_BYTES_HASHED, (unsigned long long) read*pass->bytes);
+    }
+    freeFetchQueue(&queue);
+    return NULL;
+}
+// SHA-1 of the first bytes of every listed cluster, one thread per cpu
+void runDigestPass(Storage* storage, Geometry* geometry, unsigned int* clusters, unsigned int count, unsigned int bytes,
+unsigned char (*digests)[SHA_DIGEST_LENGTH]){
+    DigestPass pass;
+    pass.storage = storage;
+    pass.geometry = geometry;
+    pass.clusters = clusters;
+    pass.count = count;
+    pass.bytes = bytes;
+    pass.digests = digests;
+    pass.next = 0;
+    // one worker per online cpu, never more workers than batches
+    long numOfCpus = sysconf(_SC_NPROCESSORS_ONLN);
+    unsigned int numOfWorkers = numOfCpus > 0 ? (unsigned int) numOfCpus : 1;
+    unsigned int batches = (count+GUIDE_BATCH-1)/GUIDE_BATCH;
+    if(numOfWorkers > batches){
+        numOfWorkers = batches > 0 ? batches : 1;
+    }
+    // FETCH_DEPTH reads in flight between all of them
+    pass.depth = FETCH_DEPTH/numOfWorkers > 4 ? FETCH_DEPTH/numOfWorkers : 4;
+    pthread_t* workers = (pthread_t*) malloc(sizeof(pthread_t)*numOfWorkers);
+    for(unsigned int i = 0; i < numOfWorkers; i++){
+        pthread_create(&workers[i], NULL, digestPassWorker, &pass);
+    }
+    for(unsigned int i = 0; i < numOfWorkers; i++){
+        pthread_join(workers[i], NULL);
+    }
+    free(workers);
+    return;
+}
+int compareClusterDigests(const void* a, const void* b){
+    const ClusterDigest* left = (const ClusterDigest*) a;
+    const ClusterDigest* right = (const ClusterDigest*) b;
+    int order = memcmp(left->digest, right->digest, SHA_DIGEST_LENGTH);
+    if(order != 0){
+        return order;
+    }
+    return left->cluster < right->cluster ? -1 : left->cluster > right->cluster;
+}
+// hash every free cluster once; each block is then a lookup instead of a search
+void initGuidedSearch(GuidedSearch* search, Storage* storage, Geometry* geometry, FatTable* fat){
+    unsigned long long started = beginPhase();
+    search->storage = storage;
+    search->geometry = geometry;
+    search->fat = fat;
+    search->freeClusters = (unsigned int*) malloc(sizeof(unsigned int)*(geometry->totalClusters ? geometry->totalClusters : 1));
+    search->count = collectFreeClusters(fat, search->freeClusters, geometry->totalClusters);
+    unsigned int slots = search->count ? search->count : 1;
+    unsigned char (*digests)[SHA_DIGEST_LENGTH] = (unsigned char (*)[SHA_DIGEST_LENGTH]) malloc((size_t) SHA_DIGEST_LENGTH*slots);
+    runDigestPass(storage, geometry, search->freeClusters, search->count, geometry->bytesPerClus, digests);
+    search->digests = (ClusterDigest*) malloc(sizeof(ClusterDigest)*slots);
+    for(unsigned int i = 0; i < search->count; i++){
+        memcpy(search->digests[i].digest, digests[i], SHA_DIGEST_LENGTH);
+        search->digests[i].cluster = search->freeClusters[i];
+    }
+    free(digests);
+    qsort(search->digests, search->count, sizeof(ClusterDigest), compareClusterDigests);
+    endPhase(STAT_PHASE_HASH, started);
+    return;
+}
+void freeGuidedSearch(GuidedSearch* search){
+    free(search->freeClusters);
+    free(search->digests);
+    search->freeClusters = NULL;
+    search->digests = NULL;
+    return;
+}
+// index of the first free cluster not below (digest, cluster) in digest order
+unsigned int lowerDigestBound(GuidedSearch* search, const unsigned char* digest, unsigned int cluster){
+    ClusterDigest key;
+    memcpy(key.digest, digest, SHA_DIGEST_LENGTH);
+    key.cluster = cluster;
+    unsigned int lo = 0;
+    unsigned int hi = search->count;
+    while(lo < hi){
+        unsigned int mid = lo+(hi-lo)/2;
+        if(compareClusterDigests(&search->digests[mid], &key) < 0){
+            lo = mid+1;
+        }
+        else{
+            hi = mid;
+        }
+    }
+    return lo;
+}
+// the free cluster holding a whole block: want (right after the previous block) when it matches, else
+// the lowest match not used yet; a pinned block must be at want
+int placeFullBlock(GuidedSearch* search, const unsigned char* digest, unsigned int want, int pinned, unsigned char* used, unsigned int* cluster){
+    unsigned int at = lowerDigestBound(search, digest, want);
+    unsigned int pick = search->count;
+    if(at < search->count && search->digests[at].cluster == want && !used[at]
+    && memcmp(search->digests[at].digest, digest, SHA_DIGEST_LENGTH) == 0){
+        pick = at;
+    }
+    else if(!pinned){
+        for(unsigned int i = lowerDigestBound(search, digest, 0); i < search->count
+        && memcmp(search->digests[i].digest, digest, SHA_DIGEST_LENGTH) == 0; i++){
+            if(!used[i]){
+                pick = i;
+                break;
+            }
+        }
+    }
+    if(pick == search->count){
+        return FALSE;
+    }
+    used[pick] = TRUE;
+    *cluster = search->digests[pick].cluster;
+    return TRUE;
+}
+int inChain(unsigned int* chain, unsigned int length, unsigned int cluster){
+    for(unsigned int k = 0; k < length; k++){
+        if(chain[k] == cluster){
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+// the free cluster starting with the partial last block (the slack after it is anything): want when it
+// matches, else found by hashing that many bytes of every free cluster; a pinned block must be at want
+int placeTailBlock(GuidedSearch* search, const unsigned char* digest, unsigned int bytes, unsigned int want, int pinned,
+unsigned int* chain, unsigned int placed, unsigned int* cluster){
+    unsigned char found[SHA_DIGEST_LENGTH];
+    if(isValidCluster(search->fat, want) && isFreeCluster(search->fat, want) && !inChain(chain, placed, want)){
+        unsigned char* scratch = search->storage->map ? NULL : (unsigned char*) malloc(bytes);
+        const unsigned char* content = viewStorage(search->storage, clusterStart(search->geometry, want), bytes, scratch);
+        if(content){
+            SHA1(content, bytes, found);
+        }
+        free(scratch);
+        if(content && memcmp(found, digest, SHA_DIGEST_LENGTH) == 0){
+            *cluster = want;
+            return TRUE;
+        }
+    }
+    if(pinned){
+        return FALSE;
+    }
+    unsigned char (*prefixes)[SHA_DIGEST_LENGTH] = (unsigned char (*)[SHA_DIGEST_LENGTH]) malloc((size_t) SHA_DIGEST_LENGTH*(search->count ? search->count : 1));
+    runDigestPass(search->storage, search->geometry, search->freeClusters, search->count, bytes, prefixes);
+    int matched = FALSE;
+    for(unsigned int i = 0; i < search->count && !matched; i++){
+        if(memcmp(prefixes[i], digest, SHA_DIGEST_LENGTH) == 0 && !inChain(chain, placed, search->freeClusters[i])){
+            *cluster = search->freeClusters[i];
+            matched = TRUE;
+        }
+    }
+    free(prefixes);
+    return matched;
+}
+// lay the guide's blocks onto free clusters, the first at firstCluster (where the directory entry says
+// the file starts); FALSE if the sizes disagree or a block is on no free cluster
+int assembleGuidedChain(GuidedSearch* search, BlockGuide* guide, unsigned int firstCluster, unsigned long long fileSize, unsigned int* chain){
+    Geometry* geometry = search->geometry;
+    if(guide->blockCount != clustersFor(geometry, fileSize) || (!guide->fromList && guide->fileSize != fileSize)){
+        return FALSE;
+    }
+    unsigned long long started = beginPhase();
+    unsigned char* used = (unsigned char*) calloc(search->count ? search->count : 1, sizeof(unsigned char));
+    unsigned int tailBytes = guide->blockCount ? (unsigned int) (fileSize-((unsigned long long) (guide->blockCount-1) << geometry->clusShift)) : 0;
+    int ok = TRUE;
+    for(unsigned int k = 0; ok && k < guide->blockCount; k++){
+        unsigned int want = k == 0 ? firstCluster : chain[k-1]+1;
+        if(k == guide->blockCount-1 && tailBytes < geometry->bytesPerClus){
+            ok = placeTailBlock(search, guide->blocks[k], tailBytes, want, k == 0, chain, k, &chain[k]);
+        }
+        else{
+            ok = placeFullBlock(search, guide->blocks[k], want, k == 0, used, &chain[k]);
+        }
+    }
+    free(used);
+    endPhase(STAT_PHASE_SEARCH, started);
+    return ok;
+}
@@ -0,0 +1,43 @@
+#ifndef GUIDED_H
+#define GUIDED_H
+
+#include <openssl/sha.h>
+#include "nyufile.h"
+#include "fat.h"
+#include "storage.h"
+#include "geometry.h"
+
+// free clusters a hashing thread takes at a time
+#define GUIDE_BATCH 256
+
+// what the file looked like: the SHA-1 of each cluster-sized block, in file order
+typedef struct BlockGuide {
+    unsigned char (*blocks)[SHA_DIGEST_LENGTH];
+    unsigned int blockCount;
+    unsigned long long fileSize;        // size of a reference file (a hash list leaves it to the directory entry)
+    int fromList;                       // TRUE when read from a per-block hash list
+} BlockGuide;
+
+// one free cluster and the SHA-1 of its content
+typedef struct ClusterDigest {
+    unsigned char digest[SHA_DIGEST_LENGTH];
+    unsigned int cluster;
+} ClusterDigest;
+
+// every free cluster hashed once, sorted by digest (then cluster) for lookup
+typedef struct GuidedSearch {
+    Storage* storage;
+    Geometry* geometry;
+    FatTable* fat;
+    unsigned int* freeClusters;         // in disk order
+    ClusterDigest* digests;
+    unsigned int count;
+} GuidedSearch;
+
+int loadBlockGuide(char* path, unsigned int bytesPerClus, BlockGuide* guide);
+void freeBlockGuide(BlockGuide* guide);
+void initGuidedSearch(GuidedSearch* search, Storage* storage, Geometry* geometry, FatTable* fat);
+void freeGuidedSearch(GuidedSearch* search);
+int assembleGuidedChain(GuidedSearch* search, BlockGuide* guide, unsigned int firstCluster, unsigned long long fileSize, unsigned int* chain);
+
+#endif
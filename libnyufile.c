@@ -0,0 +1,231 @@
+#include <stdlib.h>
+#include <string.h>
+#include "libnyufile.h"
+#include "volume.h"
+#include "content.h"
+#include "extract.h"
+#include "restore.h"
+#include "writeset.h"
+
+// writable volumes recover in place; the most plausible FAT is cached when the copies differ
+int nyuOpenVolume(const char* path, int writable, NyuVolume** volume){
+    NyuVolume* opened = (NyuVolume*) malloc(sizeof(NyuVolume));
+    int status = openVolume((char*) path, (writable ? VOLUME_WRITABLE : 0) | VOLUME_PLAUSIBLE_FAT, opened);
+    if(status != NYU_OK){
+        free(opened);
+        *volume = NULL;
+        return status;
+    }
+    *volume = opened;
+    return NYU_OK;
+}
+// no call may be running on the volume; image.nyuidx is saved when it was walked or is out of date
+// (entries recovered or content digests added)
+void nyuCloseVolume(NyuVolume* volume){
+    if(!volume){
+        return;
+    }
+    if(volume->indexReady && (!volume->indexLoaded || volume->indexChanged || volume->index.hashesAdded)){
+        saveVolumeIndex(volume);
+    }
+    closeVolume(volume);
+    free(volume);
+    return;
+}
+int nyuGetVolumeInfo(NyuVolume* volume, NyuVolumeInfo* info){
+    info->numOfFats = volume->geometry.numOfFats;
+    info->bytesPerSector = volume->geometry.bytesPerSec;
+    info->sectorsPerCluster = volume->geometry.secPerClus;
+    info->reservedSectors = volume->bootSector.BPB_RsvdSecCnt;
+    info->fatBits = volume->geometry.fatBits;
+    info->totalClusters = volume->geometry.totalClusters;
+    pthread_rwlock_rdlock(&volume->lock);
+    info->freeClusters = volume->fat.freeCount;
+    pthread_rwlock_unlock(&volume->lock);
+    return NYU_OK;
+}
+// the first call on a volume loads (or walks) its directory index
+int nyuBeginEntries(NyuVolume* volume, unsigned int flags, NyuIterator* iterator){
+    if(!(flags & (NYU_LIVE | NYU_DELETED))){
+        return NYU_ERR_ARGUMENT;
+    }
+    loadVolumeIndex(volume);
+    iterator->volume = volume;
+    iterator->next = 0;
+    iterator->flags = flags;
+    return NYU_OK;
+}
+// NYU_OK with the next entry, NYU_END after the last one
+int nyuNextEntry(NyuIterator* iterator, NyuEntry* entry){
+    NyuVolume* volume = iterator->volume;
+    int status = NYU_END;
+    pthread_rwlock_rdlock(&volume->lock);
+    while(iterator->next < volume->index.count){
+        IndexEntry* indexEntry = &volume->index.entries[iterator->next];
+        entry->id = iterator->next++;
+        if(!(iterator->flags & (indexEntry->deleted ? NYU_DELETED : NYU_LIVE))){
+            continue;
+        }
+        entry->path = (const char*) indexEntry->path;
+        entry->longName = (const char*) indexEntry->longName;
+        entry->firstCluster = indexEntry->firstCluster;
+        entry->size = indexEntry->fileSize;
+        entry->attr = indexEntry->attr;
+        entry->deleted = indexEntry->deleted;
+        entry->writeTime = indexEntry->writeTime;
+        entry->writeDate = indexEntry->writeDate;
+        entry->createTime = indexEntry->createTime;
+        entry->createDate = indexEntry->createDate;
+        status = NYU_OK;
+        break;
+    }
+    pthread_rwlock_unlock(&volume->lock);
+    return status;
+}
+// copy up to length bytes of the file from offset; a live file is read along its chain, a deleted one
+// where it was (contiguously); *bytesRead is short only at the end of the file
+int nyuReadEntry(NyuVolume* volume, const NyuEntry* entry, unsigned long long offset, void* buffer, size_t length, size_t* bytesRead){
+    *bytesRead = 0;
+    if(!__atomic_load_n(&volume->indexReady, __ATOMIC_ACQUIRE) || entry->id >= volume->index.count){
+        return NYU_ERR_ARGUMENT;
+    }
+    Geometry* geometry = &volume->geometry;
+    pthread_rwlock_rdlock(&volume->lock);
+    IndexEntry* indexEntry = &volume->index.entries[entry->id];
+    unsigned long long size = indexEntry->fileSize;
+    if(offset > size){
+        pthread_rwlock_unlock(&volume->lock);
+        return NYU_ERR_ARGUMENT;
+    }
+    length = size-offset < length ? (size_t) (size-offset) : length;
+    FatExtent* extents = NULL;
+    unsigned int extentCount = 0;
+    if(!indexEntry->deleted){
+        extentCount = getChainExtents(&volume->fat, indexEntry->firstCluster, &extents);
+    }
+    else if(size > 0 && isValidCluster(&volume->fat, indexEntry->firstCluster)){
+        extents = (FatExtent*) malloc(sizeof(FatExtent));
+        extents[0].start = indexEntry->firstCluster;
+        extents[0].length = clustersFor(geometry, size);
+        extentCount = 1;
+    }
+    pthread_rwlock_unlock(&volume->lock);
+    unsigned char* out = (unsigned char*) buffer;
+    size_t done = 0;
+    unsigned long long extentOffset = 0;
+    int status = NYU_OK;
+    for(unsigned int e = 0; e < extentCount && done < length; e++){
+        unsigned long long extentBytes = (unsigned long long) extents[e].length << geometry->clusShift;
+        unsigned long long at = offset+done;
+        if(at < extentOffset+extentBytes){
+            unsigned long long chunk = extentOffset+extentBytes-at < length-done ? extentOffset+extentBytes-at : length-done;
+            if(!readStorage(&volume->storage, clusterStart(geometry, extents[e].start)+(at-extentOffset), &out[done], chunk)){
+                status = NYU_ERR_READ;
+                break;
+            }
+            done += chunk;
+        }
+        extentOffset += extentBytes;
+    }
+    free(extents);
+    // a chain shorter than the file
+    if(status == NYU_OK && done < length){
+        status = NYU_ERR_READ;
+    }
+    *bytesRead = done;
+    return status;
+}
+// undelete entry and link its contiguous clusters as -r does (the volume's lock held for writing)
+int recoverVolumeEntry(NyuVolume* volume, IndexEntry* entry, unsigned char* fileName){
+    WriteSet writes;
+    initWriteSet(&writes);
+    unsigned char firstChar;
+    if(!claimContiguousEntry(&writes, &volume->index, &volume->fat, &volume->geometry, fileName, entry, &firstChar)){
+        freeWriteSet(&writes);
+        return NYU_ERR_IN_USE;
+    }
+    int ok = commitWriteSet(&writes, &volume->storage, volume->journalPath);
+    freeWriteSet(&writes);
+    // the image was rolled back: so goes the decoded FAT
+    if(!ok){
+        unsigned int clusterCount = clustersFor(&volume->geometry, entry->fileSize);
+        for(unsigned int k = 0; k < clusterCount; k++){
+            setFatEntry(&volume->fat, entry->firstCluster+k, 0);
+            volume->fat.owner[entry->firstCluster+k] = FAT_NO_OWNER;
+        }
+        return NYU_ERR_WRITE;
+    }
+    markRecovered(entry, firstChar);
+    volume->indexChanged = TRUE;
+    return NYU_OK;
+}
+// recover a contiguous deleted file, picked by name (and SHA-1 when several share it) as -r picks it: in
+// place, or copied to outputPath with the image left alone
+int nyuRecoverFile(NyuVolume* volume, const char* name, const char* sha1, const char* outputPath){
+    unsigned char target[SHA_DIGEST_LENGTH];
+    if(!name || !name[0] || (sha1 && !parseShaHash((unsigned char*) sha1, target))){
+        return NYU_ERR_ARGUMENT;
+    }
+    if(!outputPath && !volume->writable){
+        return NYU_ERR_READ_ONLY;
+    }
+    loadVolumeIndex(volume);
+    // a copy by name only reads the FAT and the index; a recovery in place, or a digest cached in the
+    // index, has them alone
+    if(outputPath && !sha1){
+        pthread_rwlock_rdlock(&volume->lock);
+    }
+    else{
+        pthread_rwlock_wrlock(&volume->lock);
+    }
+    NameQuery query;
+    buildNameQuery((unsigned char*) name, &query);
+    ContentReader reader;
+    initContentReader(&reader, &volume->storage, &volume->geometry);
+    IndexEntry* found;
+    int status = findDeletedEntry(&volume->index, &reader, &query, sha1 ? target : NULL, &found);
+    freeContentReader(&reader);
+    unsigned int clusterCount = found ? clustersFor(&volume->geometry, found->fileSize) : 0;
+    if(status == NYU_OK && !outputPath){
+        status = recoverVolumeEntry(volume, found, query.baseName);
+    }
+    else if(status == NYU_OK && clusterCount > 0 && !isFreeRun(&volume->fat, found->firstCluster, clusterCount)){
+        status = NYU_ERR_IN_USE;
+    }
+    else if(status == NYU_OK){
+        unsigned long long start = clusterCount ? clusterStart(&volume->geometry, found->firstCluster) : 0;
+        status = extractImageRange(&volume->storage, start, found->fileSize, (char*) outputPath) ? NYU_OK : NYU_ERR_WRITE;
+    }
+    pthread_rwlock_unlock(&volume->lock);
+    return status;
+}
+const char* nyuStatusText(int status){
+    switch(status){
+        case NYU_OK:
+            return "success";
+        case NYU_END:
+            return "no more entries";
+        case NYU_ERR_OPEN:
+            return "the image can't be opened";
+        case NYU_ERR_TRUNCATED:
+            return "the image is too short for its boot sector or its FAT";
+        case NYU_ERR_NOT_FAT:
+            return "not a FAT12/16/32 volume";
+        case NYU_ERR_NOT_FOUND:
+            return "file not found";
+        case NYU_ERR_AMBIGUOUS:
+            return "multiple candidates found";
+        case NYU_ERR_IN_USE:
+            return "clusters of the file are in use";
+        case NYU_ERR_ARGUMENT:
+            return "invalid argument";
+        case NYU_ERR_READ_ONLY:
+            return "the volume is open read-only";
+        case NYU_ERR_READ:
+            return "the image couldn't be read";
+        case NYU_ERR_WRITE:
+            return "the recovery couldn't be written";
+        default:
+            return "unknown status";
+    }
+}
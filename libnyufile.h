@@ -0,0 +1,72 @@
+#ifndef LIBNYUFILE_H
+#define LIBNYUFILE_H
+
+#include <stddef.h>
+
+// what every call returns (negative on failure, never exits)
+#define NYU_OK 0
+#define NYU_END 1                       // the iterator has no more entries
+#define NYU_ERR_OPEN -1                 // the image can't be opened
+#define NYU_ERR_TRUNCATED -2            // the image is too short for its boot sector or its FAT
+#define NYU_ERR_NOT_FAT -3              // the boot sector doesn't describe a FAT12/16/32 volume we can address
+#define NYU_ERR_NOT_FOUND -4            // no deleted file of that name (and SHA-1)
+#define NYU_ERR_AMBIGUOUS -5            // several deleted files of that name and no SHA-1 to pick one
+#define NYU_ERR_IN_USE -6               // clusters the file needs were reused
+#define NYU_ERR_ARGUMENT -7             // a malformed SHA-1, an unknown entry, ...
+#define NYU_ERR_READ_ONLY -8            // recovery in place on a volume opened read-only
+#define NYU_ERR_READ -9                 // the image couldn't be read
+#define NYU_ERR_WRITE -10               // the recovery couldn't be written (the image is left unchanged)
+
+// which entries an iterator yields
+#define NYU_LIVE 1
+#define NYU_DELETED 2
+
+// an open volume: the image (mapped when it fits), its geometry, the decoded FAT and, from the first
+// call that needs it, the directory index; any number of threads may list, read and recover through
+// one handle (recoveries in place run one at a time)
+typedef struct NyuVolume NyuVolume;
+
+// what -i prints, and how full the volume is
+typedef struct NyuVolumeInfo {
+    unsigned int numOfFats;
+    unsigned int bytesPerSector;
+    unsigned int sectorsPerCluster;
+    unsigned int reservedSectors;
+    unsigned int fatBits;               // 12, 16 or 32
+    unsigned int totalClusters;
+    unsigned int freeClusters;
+} NyuVolumeInfo;
+
+// one directory entry; the strings belong to the volume and stay valid until it is closed
+typedef struct NyuEntry {
+    const char* path;                   // "DIR/SUB/NAME.EXT" ('?' stands for the lost first character of a deleted short name);
+                                        // left as it was by a later recovery, valid until the volume is closed
+    const char* longName;               // NULL when there is none
+    unsigned int id;                    // names the entry to nyuReadEntry
+    unsigned int firstCluster;
+    unsigned int size;
+    unsigned char attr;
+    int deleted;
+    unsigned short writeTime;           // FAT time and date, as stored
+    unsigned short writeDate;
+    unsigned short createTime;
+    unsigned short createDate;
+} NyuEntry;
+
+// position in the volume's entries (in path order), set up by nyuBeginEntries
+typedef struct NyuIterator {
+    NyuVolume* volume;
+    unsigned int next;
+    unsigned int flags;                 // NYU_LIVE and/or NYU_DELETED
+} NyuIterator;
+
+int nyuOpenVolume(const char* path, int writable, NyuVolume** volume);
+void nyuCloseVolume(NyuVolume* volume);
+int nyuGetVolumeInfo(NyuVolume* volume, NyuVolumeInfo* info);
+int nyuBeginEntries(NyuVolume* volume, unsigned int flags, NyuIterator* iterator);
+int nyuNextEntry(NyuIterator* iterator, NyuEntry* entry);
+int nyuReadEntry(NyuVolume* volume, const NyuEntry* entry, unsigned long long offset, void* buffer, size_t length, size_t* bytesRead);
+int nyuRecoverFile(NyuVolume* volume, const char* name, const char* sha1, const char* outputPath);
+const char* nyuStatusText(int status);
+
+#endif
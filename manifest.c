@@ -0,0 +1,97 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "manifest.h"
+
+int parseShaHash(unsigned char* shaHash, unsigned char* digest);
+
+// the digest is already uniformly distributed, its first bytes are a good hash
+unsigned int digestSlot(Manifest* manifest, unsigned char* digest){
+    unsigned int hash;
+    memcpy(&hash, digest, sizeof(hash));
+    return hash & manifest->slotMask;
+}
+void insertManifestDigest(Manifest* manifest, unsigned int i){
+    unsigned int slot = digestSlot(manifest, manifest->entries[i].digest);
+    while(manifest->slots[slot]){
+        ManifestEntry* other = &manifest->entries[manifest->slots[slot]-1];
+        // same digest - chain the new entry in front of the existing ones
+        if(memcmp(other->digest, manifest->entries[i].digest, SHA_DIGEST_LENGTH) == 0){
+            manifest->entries[i].next = manifest->slots[slot]-1;
+            manifest->slots[slot] = i+1;
+            return;
+        }
+        slot = (slot+1) & manifest->slotMask;
+    }
+    manifest->slots[slot] = i+1;
+    return;
+}
+// read "name sha1" pairs; FALSE if the file can't be read or a digest is malformed
+int loadManifest(unsigned char* manifestFile, Manifest* manifest){
+    manifest->entries = NULL;
+    manifest->count = 0;
+    manifest->slots = NULL;
+    FILE* list = fopen((char*) manifestFile, "r");
+    if(!list){
+        return FALSE;
+    }
+    unsigned int capacity = 0;
+    char line[512];
+    while(fgets(line, sizeof(line), list)){
+        char* name = strtok(line, " \t\r\n");
+        if(!name){
+            continue;
+        }
+        char* sha = strtok(NULL, " \t\r\n");
+        if(manifest->count == capacity){
+            capacity = capacity ? capacity*2 : 256;
+            manifest->entries = (ManifestEntry*) realloc(manifest->entries, sizeof(ManifestEntry)*capacity);
+        }
+        ManifestEntry* entry = &manifest->entries[manifest->count];
+        if(!sha || !parseShaHash((unsigned char*) sha, entry->digest)){
+            fclose(list);
+            freeManifest(manifest);
+            return FALSE;
+        }
+        entry->name = (unsigned char*) strdup(name);
+        buildNameQuery(entry->name, &entry->query);
+        entry->found = FALSE;
+        entry->next = MANIFEST_NONE;
+        manifest->count++;
+    }
+    fclose(list);
+    // at most half full so probes stay short
+    unsigned int slotCount = 16;
+    while(slotCount < manifest->count*2){
+        slotCount *= 2;
+    }
+    manifest->slotMask = slotCount-1;
+    manifest->slots = (unsigned int*) calloc(slotCount, sizeof(unsigned int));
+    for(unsigned int i = 0; i < manifest->count; i++){
+        insertManifestDigest(manifest, i);
+    }
+    return TRUE;
+}
+void freeManifest(Manifest* manifest){
+    for(unsigned int i = 0; i < manifest->count; i++){
+        free(manifest->entries[i].name);
+    }
+    free(manifest->entries);
+    free(manifest->slots);
+    manifest->entries = NULL;
+    manifest->slots = NULL;
+    manifest->count = 0;
+    return;
+}
+// first entry with this digest (follow next for the others), MANIFEST_NONE if there is none
+unsigned int findManifestDigest(Manifest* manifest, unsigned char* digest){
+    unsigned int slot = digestSlot(manifest, digest);
+    while(manifest->slots[slot]){
+        unsigned int i = manifest->slots[slot]-1;
+        if(memcmp(manifest->entries[i].digest, digest, SHA_DIGEST_LENGTH) == 0){
+            return i;
+        }
+        slot = (slot+1) & manifest->slotMask;
+    }
+    return MANIFEST_NONE;
+}
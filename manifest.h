@@ -0,0 +1,32 @@
+#ifndef MANIFEST_H
+#define MANIFEST_H
+
+#include <openssl/sha.h>
+#include "nyufile.h"
+#include "dirindex.h"
+
+// end of a chain of manifest entries sharing one digest
+#define MANIFEST_NONE 0xffffffff
+
+// one "name sha1" line of a manifest
+typedef struct ManifestEntry {
+    unsigned char* name;
+    unsigned char digest[SHA_DIGEST_LENGTH];
+    NameQuery query;                    // name converted to 8.3 form once
+    int found;
+    unsigned int next;                  // next entry with the same digest
+} ManifestEntry;
+
+// every line of a manifest, with an open-addressing hash set over the binary digests
+typedef struct Manifest {
+    ManifestEntry* entries;
+    unsigned int count;
+    unsigned int* slots;                // entry index + 1, 0 for an empty slot
+    unsigned int slotMask;
+} Manifest;
+
+int loadManifest(unsigned char* manifestFile, Manifest* manifest);
+void freeManifest(Manifest* manifest);
+unsigned int findManifestDigest(Manifest* manifest, unsigned char* digest);
+
+#endif
@@ -1,6 +1,7 @@
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <errno.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <pthread.h>
@@ -8,75 +9,56 @@
 #include <stdio.h>
 #include <string.h>
 #include <openssl/sha.h>
-#include <math.h>
+#include "nyufile.h"
+#include "dirindex.h"
+#include "fat.h"
+#include "content.h"
+#include "manifest.h"
+#include "carve.h"
+#include "writeset.h"
+#include "storage.h"
+#include "geometry.h"
+#include "scanindex.h"
+#include "fatcheck.h"
+#include "rank.h"
+#include "extract.h"
+#include "report.h"
+#include "stats.h"
+#include "query.h"
+#include "clusterhash.h"
+#include "guided.h"
+#include "restore.h"
+#include "volume.h"
 
-// 
-#define TRUE 1
-#define FALSE 0
+// MILESTONE 8 - limits of the -R brute-force search
+// longest cluster chain we try to reassemble
+#define MAX_NONCONT_CLUSTERS 5
+// how many free clusters (in disk order) are eligible for the chain
+#define MAX_NONCONT_CANDIDATES 64
 
-//
-#pragma pack(push,1)
-typedef struct BootEntry {
-  unsigned char  BS_jmpBoot[3];     // Assembly instruction to jump to boot code
-  unsigned char  BS_OEMName[8];     // OEM Name in ASCII
-  unsigned short BPB_BytsPerSec;    // Bytes per sector. Allowed values include 512, 1024, 2048, and 4096
-  unsigned char  BPB_SecPerClus;    // Sectors per cluster (data unit). Allowed values are powers of 2, but the cluster size must be 32KB or smaller
-  unsigned short BPB_RsvdSecCnt;    // Size in sectors of the reserved area
-  unsigned char  BPB_NumFATs;       // Number of FATs
-  unsigned short BPB_RootEntCnt;    // Maximum number of files in the root directory for FAT12 and FAT16. This is 0 for FAT32
-  unsigned short BPB_TotSec16;      // 16-bit value of number of sectors in file system
-  unsigned char  BPB_Media;         // Media type
-  unsigned short BPB_FATSz16;       // 16-bit size in sectors of each FAT for FAT12 and FAT16. For FAT32, this field is 0
-  unsigned short BPB_SecPerTrk;     // Sectors per track of storage device
-  unsigned short BPB_NumHeads;      // Number of heads in storage device
-  unsigned int   BPB_HiddSec;       // Number of sectors before the start of partition
-  unsigned int   BPB_TotSec32;      // 32-bit value of number of sectors in file system. Either this value or the 16-bit value above must be 0
-  unsigned int   BPB_FATSz32;       // 32-bit size in sectors of one FAT
-  unsigned short BPB_ExtFlags;      // A flag for FAT
-  unsigned short BPB_FSVer;         // The major and minor version number
-  unsigned int   BPB_RootClus;      // Cluster where the root directory can be found
-  unsigned short BPB_FSInfo;        // Sector where FSINFO structure can be found
-  unsigned short BPB_BkBootSec;     // Sector where backup copy of boot sector is located
-  unsigned char  BPB_Reserved[12];  // Reserved
-  unsigned char  BS_DrvNum;         // BIOS INT13h drive number
-  unsigned char  BS_Reserved1;      // Not used
-  unsigned char  BS_BootSig;        // Extended boot signature to identify if the next three values are valid
-  unsigned int   BS_VolID;          // Volume serial number
-  unsigned char  BS_VolLab[11];     // Volume label in ASCII. User defines when creating the file system
-  unsigned char  BS_FilSysType[8];  // File system type label in ASCII
-} BootEntry;
-#pragma pack(pop)
-
-//
-#pragma pack(push,1)
-typedef struct DirEntry {
-  unsigned char  DIR_Name[11];      // File name
-  unsigned char  DIR_Attr;          // File attributes
-  unsigned char  DIR_NTRes;         // Reserved
-  unsigned char  DIR_CrtTimeTenth;  // Created time (tenths of second)
-  unsigned short DIR_CrtTime;       // Created time (hours, minutes, seconds)
-  unsigned short DIR_CrtDate;       // Created day
-  unsigned short DIR_LstAccDate;    // Accessed day
-  unsigned short DIR_FstClusHI;     // High 2 bytes of the first cluster address
-  unsigned short DIR_WrtTime;       // Written time (hours, minutes, seconds
-  unsigned short DIR_WrtDate;       // Written day
-  unsigned short DIR_FstClusLO;     // Low 2 bytes of the first cluster address
-  unsigned int   DIR_FileSize;      // File size in bytes. (0 for directories)
-} DirEntry;
-#pragma pack(pop)
-
-//
-#pragma pack(push,1)
-typedef struct FatEntry{
-    unsigned int clusterIndex;
-} FatEntry;
-#pragma pack(pop)
+// state shared by every -R search worker
+typedef struct NonContSearch {
+    Storage* storage;
+    Geometry* geometry;
+    unsigned int clusterCount;          // length of the chain we are looking for
+    unsigned int lastClusBytes;         // bytes of the file stored in the last cluster
+    unsigned char target[SHA_DIGEST_LENGTH];
+    SHA_CTX firstCtx;                   // hash state after the (known) first cluster
+    unsigned int* pool;                 // free clusters we may pick from
+    unsigned int poolSize;
+    unsigned int nextBranch;            // next pool index to hand out as the second cluster
+    int stop;                           // set once any worker finds a match
+    unsigned int chain[MAX_NONCONT_CLUSTERS];
+    pthread_mutex_t lock;
+} NonContSearch;
 
 
 // MAIN
 int main(int argc, char*argv[]){
     void validateUsage(int argc, char*argv[]);
     validateUsage(argc, argv);
+    // --stats breakdown and --trace file
+    finishStats();
     return 0;
 }
 
@@ -84,6 +66,28 @@ int main(int argc, char*argv[]){
 void validateUsage(int argc, char*argv[]){
     // declare the function to print usage information and exit prog
     void printUsageInfo();
+    // long options are taken out before getopt sees the rest
+    int statsReport = FALSE;
+    char* tracePath = NULL;
+    int kept = 1;
+    for(int i = 1; i < argc; i++){
+        if(strcmp(argv[i], "--stats") == 0){
+            statsReport = TRUE;
+        }
+        else if(strcmp(argv[i], "--trace") == 0){
+            // ERROR 22 - if --trace is not followed by a file name
+            if(i+1 == argc){
+                printUsageInfo();
+            }
+            tracePath = argv[++i];
+        }
+        else{
+            argv[kept++] = argv[i];
+        }
+    }
+    argc = kept;
+    argv[argc] = NULL;
+    initStats(statsReport, tracePath);
     // ERROR 1 - prog invoked with no arguments
     if(argc == 1){
         printUsageInfo();
@@ -94,8 +98,19 @@ void validateUsage(int argc, char*argv[]){
     char command = '\0';
     char* commandArg = NULL;
     char* sArg = NULL;
+    // ranking of colliding candidates (-k recovers the best, -K dir extracts them all)
+    char rankMode = '\0';
+    char* rankArg = NULL;
+    // recover into a directory instead of the image (-x dir)
+    char* extractArg = NULL;
+    // one JSON record per line instead of text (-j)
+    int jsonOutput = FALSE;
+    // recover everything a query matches (-q query -a)
+    int recoverAll = FALSE;
+    // blocks of a known copy of the file guide -R (-g reference)
+    char* guideArg = NULL;
     // get option
-    while ((opt = getopt(argc, argv, "r:R:s:il")) != -1){
+    while ((opt = getopt(argc, argv, "r:R:s:ilb:m:c:vx:jq:HL:")) != -1){
         switch (opt){
             // option -i
             case 'i': 
@@ -107,6 +122,75 @@ void validateUsage(int argc, char*argv[]){
                 // set command as option -l
                 command = 'l';
                 break;
+            // option -v
+            case 'v':
+                // set command as option -v
+                command = 'v';
+                break;
+            // option -H
+            case 'H':
+                // set command as option -H
+                command = 'H';
+                break;
+            // option -L
+            case 'L':
+                // set command as option -L
+                command = 'L';
+                commandArg = optarg;
+                break;
+            // option -x
+            case 'x':
+                extractArg = optarg;
+                break;
+            // option -j
+            case 'j':
+                jsonOutput = TRUE;
+                break;
+            // option -b
+            case 'b':
+                // set command as option -b
+                command = 'b';
+                commandArg = optarg;
+                break;
+            // option -m
+            case 'm':
+                // set command as option -m
+                command = 'm';
+                commandArg = optarg;
+                break;
+            // option -c
+            case 'c':
+                // set command as option -c
+                command = 'c';
+                commandArg = optarg;
+                break;
+            // option -q
+            case 'q':
+                // set command as option -q
+                command = 'q';
+                commandArg = optarg;
+                int qOpt;
+                // get opt -a (or -x / -j)
+                while ((qOpt = getopt(argc, argv, "ax:j")) != -1){
+                    switch (qOpt){
+                        // option -a
+                        case 'a':
+                            recoverAll = TRUE;
+                            break;
+                        // option -x
+                        case 'x':
+                            extractArg = optarg;
+                            break;
+                        // option -j
+                        case 'j':
+                            jsonOutput = TRUE;
+                            break;
+                        // ERROR 2 - if any other options called with -q
+                        default:
+                            printUsageInfo();
+                    }
+                }
+                break;
             // option -r
             case 'r':
                 // set command as option -r
@@ -114,14 +198,31 @@ void validateUsage(int argc, char*argv[]){
                 commandArg = optarg;                
                 // store opt -s (if it exists)
                 int sOpt;
-                // get opt -s
-                while ((sOpt = getopt(argc, argv, "s:")) != -1){
+                // get opt -s (or -k / -K)
+                while ((sOpt = getopt(argc, argv, "s:kK:x:j")) != -1){
                     switch (sOpt){
                         // option -s
                         case 's':
                             // set sArg as argument for -s option
                             sArg = optarg;
                             break;
+                        // option -k
+                        case 'k':
+                            rankMode = 'k';
+                            break;
+                        // option -K
+                        case 'K':
+                            rankMode = 'K';
+                            rankArg = optarg;
+                            break;
+                        // option -x
+                        case 'x':
+                            extractArg = optarg;
+                            break;
+                        // option -j
+                        case 'j':
+                            jsonOutput = TRUE;
+                            break;
                         // ERROR 2 - if any other options called with -r
                         default:
                             printUsageInfo();
@@ -135,14 +236,26 @@ void validateUsage(int argc, char*argv[]){
                 commandArg = optarg;
                 // store opt -s (if it exists)
                 int sOptR;
-                // get opt -s
-                while ((sOptR = getopt(argc, argv, "s:")) != -1){
+                // get opt -s (or -g / -x)
+                while ((sOptR = getopt(argc, argv, "s:g:x:j")) != -1){
                     switch (sOptR){
                         // option -s
                         case 's':
                             // set sArgR as argument for -s option
                             sArg = optarg;
                             break;
+                        // option -g
+                        case 'g':
+                            guideArg = optarg;
+                            break;
+                        // option -x
+                        case 'x':
+                            extractArg = optarg;
+                            break;
+                        // option -j
+                        case 'j':
+                            jsonOutput = TRUE;
+                            break;
                         // ERROR 2 - if any other options called with -R
                         default:
                             printUsageInfo();
@@ -154,8 +267,17 @@ void validateUsage(int argc, char*argv[]){
                 sArg = optarg;
                 // set command as option -s
                 int sOptFirst;
-                while((sOptFirst = getopt(argc, argv, "R:r:")) != -1){
+                while((sOptFirst = getopt(argc, argv, "R:r:g:x:j")) != -1){
                     switch(sOptFirst){
+                        case 'g':
+                            guideArg = optarg;
+                            break;
+                        case 'x':
+                            extractArg = optarg;
+                            break;
+                        case 'j':
+                            jsonOutput = TRUE;
+                            break;
                         case 'r':
                             command = 'r';
                             commandArg = optarg;
@@ -186,20 +308,35 @@ void validateUsage(int argc, char*argv[]){
     }
     else{
         // assign and call function of command declared in user option
-        void assignCommand(unsigned char command, unsigned char* commandArg, unsigned char* sArg, int sValid, unsigned char* diskImage);
+        void assignCommand(unsigned char command, unsigned char* commandArg, unsigned char* sArg, int sValid, 
+        unsigned char rankMode, unsigned char* rankArg, unsigned char* extractArg, int jsonOutput, int recoverAll, unsigned char* guideArg, unsigned char* diskImage);
         int sValid = FALSE;
         if(sArg){
             sValid = TRUE;
         }
-        assignCommand((unsigned char) command, (unsigned char*) commandArg, (unsigned char*) sArg, sValid, (unsigned char*) argv[optind]);
+        assignCommand((unsigned char) command, (unsigned char*) commandArg, (unsigned char*) sArg, sValid, 
+        (unsigned char) rankMode, (unsigned char*) rankArg, (unsigned char*) extractArg, jsonOutput, recoverAll, (unsigned char*) guideArg, (unsigned char*) argv[optind]);
     }
     return;
 } 
 void printUsageInfo(){
-    fprintf(stderr, "Usage: ./nyufile disk <options>\n  -i                     Print the file system information.\n  -l                     List the root directory.\n  -r filename [-s sha1]  Recover a contiguous file.\n  -R filename -s sha1    Recover a possibly non-contiguous file.\n");
+    fprintf(stderr, "Usage: ./nyufile disk <options>\n  -i                     Print the file system information.\n  -l                     List the directory tree.\n  -r filename [-s sha1]  Recover a contiguous file.\n  -r filename -k         Rank every deleted file of that name and recover the most plausible one.\n  -r filename -K outdir  Rank every deleted file of that name and write each one to outdir.\n  -R filename -s sha1    Recover a possibly non-contiguous file of up to 5 clusters (the rest of its chain is searched for\n                         among the first 64 free clusters in disk order).\n  -R filename -g ref     Recover a fragmented file of any length by locating each block of ref (a copy of the file,\n                         or one SHA-1 per cluster-sized block) among the free clusters.\n  -b listfile            Recover every file listed in listfile (one \"filename [sha1]\" per line).\n  -m manifest            Recover every deleted file whose SHA-1 is in manifest (one \"filename sha1\" per line).\n  -q query [-a]          List the deleted files matching query, -a recovers them all (terms: size, written, created,\n                         attr, name, path; e.g. \"size>1M written>=2024-01-01 attr!=h name=*.JPG\").\n  -x outdir              With -r, -R, -b, -m or -q: write the recovered files to outdir and leave the image unchanged.\n  -j                     With -l, -r, -R, -b, -m or -q: print one JSON record per line (NDJSON).\n  -c outdir              Carve JPEG, PNG, PDF and ZIP files out of unallocated clusters into outdir.\n  -v                     Compare the FAT copies and check them for cross-linked and orphaned chains.\n  -H                     Hash every data cluster into disk.nyuclus (-x then hard-links duplicate recovered files);\n                         image files only, a block device is refused.\n  -L file                Locate the clusters holding each cluster-sized block of file (a block device, having no\n                         disk.nyuclus, is hashed afresh every time).\n  --stats                Print the time of each phase and what was read to stderr.\n  --trace file           Write the phases to file as Chrome trace events.\nA block device keeps its recovery journal in $NYUFILE_STATE_DIR (default /var/lib/nyufile).\n");
     exit(1);
 }
-void assignCommand(unsigned char command, unsigned char* commandArg, unsigned char* sArg, int sValid, unsigned char* diskImage){
+void assignCommand(unsigned char command, unsigned char* commandArg, unsigned char* sArg, int sValid, 
+unsigned char rankMode, unsigned char* rankArg, unsigned char* extractArg, int jsonOutput, int recoverAll, unsigned char* guideArg, unsigned char* diskImage){
+    // ERROR 19 - if -x is given to an option that doesn't recover files
+    if(extractArg && command != 'r' && command != 'R' && command != 'b' && command != 'm' && command != 'q'){
+        printUsageInfo();
+    }
+    // ERROR 21 - if -j is given to an option that neither lists nor recovers files
+    if(jsonOutput && command != 'l' && command != 'r' && command != 'R' && command != 'b' && command != 'm' && command != 'q'){
+        printUsageInfo();
+    }
+    // ERROR 25 - if -g is given to an option other than -R
+    if(guideArg && command != 'R'){
+        printUsageInfo();
+    }
     // Print the file system information.
     if(command == 'i'){
         void option_i(char* diskImage);
@@ -208,8 +345,30 @@ void assignCommand(unsigned char command, unsigned char* commandArg, unsigned ch
     }
     // List the root directory.
     else if(command == 'l'){
-        void option_l(char* diskImage);
-        option_l((char*) diskImage);
+        void option_l(char* diskImage, int jsonOutput, QueryFilter* filter);
+        option_l((char*) diskImage, jsonOutput, NULL);
+        return;
+    }
+    // Compare and check the FAT copies.
+    else if(command == 'v'){
+        void option_v(char* diskImage);
+        option_v((char*) diskImage);
+        return;
+    }
+    // Hash every data cluster.
+    else if(command == 'H'){
+        void option_H(char* diskImage);
+        option_H((char*) diskImage);
+        return;
+    }
+    // Locate the clusters of a known file.
+    else if(command == 'L'){
+        // ERROR 24 - if option -L is called with no argument
+        if(!commandArg){
+            printUsageInfo();
+        }
+        void option_L(char* diskImage, char* referenceFile);
+        option_L((char*) diskImage, (char*) commandArg);
         return;
     }
     // Recover a contiguous file.
@@ -218,22 +377,74 @@ void assignCommand(unsigned char command, unsigned char* commandArg, unsigned ch
         if(!commandArg){
             printUsageInfo();
         }
-        void option_rR(unsigned char command, unsigned char* diskImage, unsigned char* fileName, unsigned char* shaHash, int sValid);
-        option_rR(command, diskImage, commandArg, sArg, sValid);
+        // ERROR 18 - if candidates are ranked (-k/-K) while -s already picks one
+        else if(rankMode && sValid){
+            printUsageInfo();
+        }
+        void option_rR(unsigned char command, unsigned char* diskImage, unsigned char* fileName, unsigned char* shaHash, int sValid, 
+        unsigned char rankMode, unsigned char* rankDir, unsigned char* extractDir, int jsonOutput, QueryFilter* filter, unsigned char* guideFile);
+        option_rR(command, diskImage, commandArg, sArg, sValid, rankMode, rankArg, extractArg, jsonOutput, NULL, NULL);
     }
 
 
+    // Recover a list of contiguous files.
+    else if(command == 'b'){
+        // ERROR 7 - if option -b is called with no argument
+        if(!commandArg){
+            printUsageInfo();
+        }
+        void option_rR(unsigned char command, unsigned char* diskImage, unsigned char* fileName, unsigned char* shaHash, int sValid, 
+        unsigned char rankMode, unsigned char* rankDir, unsigned char* extractDir, int jsonOutput, QueryFilter* filter, unsigned char* guideFile);
+        option_rR(command, diskImage, commandArg, NULL, FALSE, '\0', NULL, extractArg, jsonOutput, NULL, NULL);
+    }
+    // Recover every file of a manifest by content.
+    else if(command == 'm'){
+        // ERROR 12 - if option -m is called with no argument
+        if(!commandArg){
+            printUsageInfo();
+        }
+        void option_rR(unsigned char command, unsigned char* diskImage, unsigned char* fileName, unsigned char* shaHash, int sValid, 
+        unsigned char rankMode, unsigned char* rankDir, unsigned char* extractDir, int jsonOutput, QueryFilter* filter, unsigned char* guideFile);
+        option_rR(command, diskImage, commandArg, NULL, FALSE, '\0', NULL, extractArg, jsonOutput, NULL, NULL);
+    }
+    // List, recover or extract the deleted files a query matches.
+    else if(command == 'q'){
+        QueryFilter filter;
+        // ERROR 23 - if the query of option -q is missing or malformed
+        if(!commandArg || !compileQuery((char*) commandArg, &filter)){
+            printUsageInfo();
+        }
+        if(recoverAll || extractArg){
+            void option_rR(unsigned char command, unsigned char* diskImage, unsigned char* fileName, unsigned char* shaHash, int sValid, 
+            unsigned char rankMode, unsigned char* rankDir, unsigned char* extractDir, int jsonOutput, QueryFilter* filter, unsigned char* guideFile);
+            option_rR(command, diskImage, commandArg, NULL, FALSE, '\0', NULL, extractArg, jsonOutput, &filter, NULL);
+        }
+        else{
+            void option_l(char* diskImage, int jsonOutput, QueryFilter* filter);
+            option_l((char*) diskImage, jsonOutput, &filter);
+        }
+    }
+    // Carve files out of unallocated clusters.
+    else if(command == 'c'){
+        // ERROR 15 - if option -c is called with no argument
+        if(!commandArg){
+            printUsageInfo();
+        }
+        void option_c(char* diskImage, char* outputDir);
+        option_c((char*) diskImage, (char*) commandArg);
+    }
     // Recover a possibly non-contiguous file.
     else if(command == 'R'){
         // ERROR 8 - if option -R is called with no argument
         if(!commandArg){
             printUsageInfo();
         }
-        else if (!sArg){
+        else if (!sArg && !guideArg){
             printUsageInfo();
         }
-        //void option_rR(unsigned char command, unsigned char* diskImage, unsigned char* fileName, unsigned char* shaHash);
-        //option_rR(command, diskImage, commandArg, sArg);
+        void option_rR(unsigned char command, unsigned char* diskImage, unsigned char* fileName, unsigned char* shaHash, int sValid, 
+        unsigned char rankMode, unsigned char* rankDir, unsigned char* extractDir, int jsonOutput, QueryFilter* filter, unsigned char* guideFile);
+        option_rR(command, diskImage, commandArg, sArg, sValid, '\0', NULL, extractArg, jsonOutput, NULL, guideArg);
     }
     // ERROR 10 - if none of the above conditions are met
     else{
@@ -245,469 +456,1004 @@ void assignCommand(unsigned char command, unsigned char* commandArg, unsigned ch
 // MILESTONE 2 - option -i
 void option_i(char* diskImage){
     void printUsageInfo();
-    BootEntry* diskBootSector;
-    int fd;
-    fd = open(diskImage, O_RDONLY, S_IRUSR | S_IWUSR);
-    // if file aint open-able
-    if (fd == -1){
+    NyuVolume* volume;
+    // ERROR 17, 20 - if the image can't be opened, is too short or isn't a FAT12/16/32 volume we can address
+    if(nyuOpenVolume(diskImage, FALSE, &volume) != NYU_OK){
         printUsageInfo();
     }
-    // mmap the disk boot sector
-    diskBootSector = (BootEntry*) mmap(NULL, 512, PROT_READ, MAP_PRIVATE, fd, 0);
-    
-    unsigned char numOfFats = diskBootSector->BPB_NumFATs;
-    unsigned short numOfBPS = diskBootSector->BPB_BytsPerSec;
-    unsigned char numOfSPC = diskBootSector->BPB_SecPerClus;
-    unsigned short numOfRS = diskBootSector->BPB_RsvdSecCnt;
-
-    printf("Number of FATs = %i\nNumber of bytes per sector = %hu\nNumber of sectors per cluster = %i\nNumber of reserved sectors = %hu\n", numOfFats, numOfBPS, numOfSPC, numOfRS);
+    NyuVolumeInfo info;
+    nyuGetVolumeInfo(volume, &info);
+    printf("Number of FATs = %u\nNumber of bytes per sector = %u\nNumber of sectors per cluster = %u\nNumber of reserved sectors = %u\n", 
+    info.numOfFats, info.bytesPerSector, info.sectorsPerCluster, info.reservedSectors);
+    nyuCloseVolume(volume);
     return;
 }
 
 // MILESTONE 3 - option -l
-void option_l(char* diskImage){
+void option_l(char* diskImage, int jsonOutput, QueryFilter* filter){
     // declare functions
     void printUsageInfo();
-    void processRootEntry(unsigned char* disk, unsigned int rootDirStartIndex, unsigned int bytesPerClus, 
-    unsigned int fatAreaStartIndex, unsigned int fatAreaSize, unsigned int rootClusIndex, int entryCount);
     // variables
-    unsigned char* disk;
-    int fd;
-    struct stat diskStat;
-    fd = open(diskImage, O_RDONLY, S_IRUSR | S_IWUSR);
-    // if file aint open-able
-    if (fd == -1){
+    NyuVolume volume;
+    // ERROR 17, 20 - if the image can't be opened, is too short or isn't a FAT12/16/32 volume we can address
+    if(openVolume(diskImage, 0, &volume) != NYU_OK){
         printUsageInfo();
     }
-    // if sb aint fstat-able
-    if (fstat(fd, &diskStat) == -1){
-        printUsageInfo();
+    // the directory tree comes from image.nyuidx while the image is unchanged
+    loadVolumeIndex(&volume);
+    if(!volume.indexLoaded){
+        saveVolumeIndex(&volume);
     }
-    // mmap the disk boot sector
-    disk = mmap(NULL, diskStat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
-    BootEntry* diskBootSector = (BootEntry*) disk;
-    // bytes per SECTOR
-    unsigned short numOfBPS = diskBootSector->BPB_BytsPerSec;
-    // num of reserved SECTORS
-    unsigned short numOfRS = diskBootSector->BPB_RsvdSecCnt;
-    // size of each FAT in SECTORS
-    unsigned int sizeOfEachFAT = diskBootSector->BPB_FATSz32;
-    // number of FATs 
-    unsigned char numOfFATS = diskBootSector->BPB_NumFATs;
-    // sectors per CLUSTER 
-    unsigned char numOfSPC = diskBootSector->BPB_SecPerClus;
-    // bytes per CLUSTER
-    unsigned int bytesPerCluster = numOfBPS*numOfSPC;
-    // cluster start 
-    unsigned int rootClusterIndex = diskBootSector->BPB_RootClus;
-    // root area and fat area in bytes
-    unsigned int reservedArea = numOfRS*numOfBPS;
-    unsigned int fatArea = numOfFATS*sizeOfEachFAT*numOfBPS;
-    // root cluster offset
-    unsigned int rootClusterOffset = (rootClusterIndex-2) * bytesPerCluster;
-    // root directory start index
-    unsigned int rootDirStartIndex = reservedArea+fatArea+rootClusterOffset;
-    // process the rootentry
-    processRootEntry(disk, rootDirStartIndex, bytesPerCluster, reservedArea, fatArea, rootClusterIndex, 0);
-    return;
-}
-void processRootEntry(unsigned char* disk, unsigned int rootDirStartIndex, unsigned int bytesPerClus
-, unsigned int fatAreaStartIndex, unsigned int fatAreaSize, unsigned int rootClusIndex, int entryC){
-    int entryCount = entryC;
-    for (unsigned int i = 0; i < bytesPerClus/32 ; i++){
-        DirEntry* rootEntry = (DirEntry*) &disk[rootDirStartIndex+(i*32)];
-        unsigned char* dirName = rootEntry->DIR_Name;
-        // BASE CASE 1 - if no more files in directory
-        if(!dirName[0]){
-            break;
+    DirIndex* index = &volume.index;
+    // -q: only the deleted files the query matches, judged in one pass over the index
+    if(filter){
+        Report report;
+        initReport(&report, jsonOutput);
+        int matchCount = 0;
+        for(unsigned int i = 0; i < index->count; i++){
+            if(matchesQuery(filter, &index->entries[i])){
+                reportMatch(&report, &index->entries[i]);
+                matchCount++;
+            }
         }
-        // BASE CASE 2 - check if file is deleted
-        else if(dirName[0] == 0xE5){
-            continue;
+        if(!jsonOutput){
+            printf("Total number of matches = %i\n", matchCount);
+        }
+        finishReport(&report);
+    }
+    // NDJSON lists deleted entries too (flagged), streamed through one reused buffer
+    else if(jsonOutput){
+        Report report;
+        initReport(&report, TRUE);
+        for(unsigned int i = 0; i < index->count; i++){
+            reportEntry(&report, &index->entries[i]);
         }
-        // BASE CASE 3 - if long file name
-        if (rootEntry->DIR_Attr == 0x0f){
+        finishReport(&report);
+    }
+    int entryCount = 0;
+    for(unsigned int i = 0; !jsonOutput && !filter && i < index->count; i++){
+        IndexEntry* entry = &index->entries[i];
+        if(entry->deleted){
             continue;
         }
-        // ELSE - if file/dir exists
-        unsigned char* fileName = (unsigned char*) malloc (sizeof(char)*13);
-        int isDir = FALSE;
-        if (rootEntry->DIR_Attr == 0x10){
-            isDir = TRUE;
-        }
-        // process the name of file/directory
-        for (int j = 0; j < 9; j++){
-            if(dirName[j] == ' ' || j == 8){
-                if (isDir == FALSE){   
-                    if(dirName[8] != ' '){
-                        fileName[j] = '.';
-                        fileName[j+1] = dirName[8];
-                    }
-                    if(dirName[9] != ' '){
-                        fileName[j+2] = dirName[9];
-                    }
-                    if(dirName[10] != ' '){
-                        fileName[j+3] = dirName[10];
-                    }
-                }
-                else{
-                    fileName[j] = '/';
-                }
-                break;
-            }
-            else{
-                fileName[j] = dirName[j];
-            }
+        if(entry->attr & ATTR_DIRECTORY){
+            printf("%s/ (size = %u, starting cluster = %u)\n", entry->path, entry->fileSize, entry->firstCluster);
+        }
+        else{
+            printf("%s (size = %u, starting cluster = %u)\n", entry->path, entry->fileSize, entry->firstCluster);
         }
-        unsigned int fileSize = rootEntry->DIR_FileSize;
-        unsigned short highClus = rootEntry->DIR_FstClusHI;
-        unsigned short lowClus = rootEntry->DIR_FstClusLO;
-        unsigned int clus = highClus*(pow(2,16))+lowClus;
-        printf("%s (size = %u, starting cluster = %u)\n", fileName, fileSize, clus);
         entryCount++;
-        free(fileName);
-    }
-    // check FAT if root directory continues
-    unsigned int rootDirOffset = fatAreaStartIndex+(4*rootClusIndex);
-    // if new root directory location exceeds the FAT area
-    if(rootDirOffset >= fatAreaStartIndex+fatAreaSize){
-        return;
     }
-    FatEntry* fatEntryy = (FatEntry*) &disk[rootDirOffset];
-    unsigned int rootDirFatLoc = fatEntryy->clusterIndex;
-    // RECURSIVE - if not end of root directory and not a bad cluster
-    if((rootDirFatLoc < 0x0ffffff8)&&(rootDirFatLoc != 0x0ffffff7)&&(rootDirFatLoc != 0x00000000)){
-        unsigned int newOffset = (rootDirFatLoc-2) * bytesPerClus;
-        unsigned int newRootStartIndex = fatAreaStartIndex+fatAreaSize+newOffset;
-        processRootEntry(disk, newRootStartIndex, bytesPerClus, fatAreaStartIndex, fatAreaSize, rootDirFatLoc, entryCount);
-        return;
+    if(!jsonOutput && !filter){
+        printf("Total number of entries = %i\n", entryCount);
     }
-    printf("Total number of entries = %i\n", entryCount);
+    closeVolume(&volume);
     return;
 }
 
 // MILESTONE 4, 5, 6, 7 - option -r, -s
-void option_rR(unsigned char command, unsigned char* diskImage, unsigned char* fileName, unsigned char* shaHash, int sValid){
+void option_rR(unsigned char command, unsigned char* diskImage, unsigned char* fileName, unsigned char* shaHash, int sValid, 
+unsigned char rankMode, unsigned char* rankDir, unsigned char* extractDir, int jsonOutput, QueryFilter* filter, unsigned char* guideFile){
     // declare functions
     void printUsageInfo();
-    //
-    void searchDeletedFiles(unsigned char* disk, unsigned char* fileName, unsigned int rootDirStartIndex, 
-    unsigned int bytesPerClus, unsigned int fatAreaStartIndex, unsigned int fatAreaSize, unsigned int rootClusIndex
-    , unsigned int bytesPerFat, unsigned int numOfFats, unsigned int foundcount, unsigned char* shaHash,
-    DirEntry* preserve, int found, unsigned int preserveStartDataSect, int sValid);
-    //
-    //void findDeletedFiles(unsigned char* disk, unsigned char* fileName, unsigned int rootDirStartIndex, 
-    //unsigned int bytesPerClus, unsigned int fatAreaStartIndex, unsigned int fatAreaSize, unsigned int rootClusIndex
-    //, unsigned int bytesPerFat, unsigned int numOfFats, unsigned int foundcount, unsigned char* shaHash, DirEntry** entries
-    //, unsigned int preserveStartDataSect);
+    void searchDeletedFiles(WriteSet* writes, DirIndex* index, FatTable* fat, Geometry* geometry, ContentReader* reader, 
+    unsigned char* fileName, unsigned char* shaHash, int sValid, unsigned char rankMode, unsigned char* rankDir);
+    void searchNonContFiles(Storage* storage, WriteSet* writes, DirIndex* index, FatTable* fat, Geometry* geometry, 
+    ContentReader* reader, unsigned char* fileName, unsigned char* shaHash);
+    void searchGuidedFile(Storage* storage, WriteSet* writes, DirIndex* index, FatTable* fat, Geometry* geometry, 
+    ContentReader* reader, unsigned char* fileName, unsigned char* guideFile, unsigned char* shaHash, int sValid);
+    void recoverBatch(WriteSet* writes, DirIndex* index, FatTable* fat, Geometry* geometry, ContentReader* reader, unsigned char* listFile);
+    void recoverManifest(WriteSet* writes, DirIndex* index, FatTable* fat, Geometry* geometry, ContentReader* reader, unsigned char* manifestFile);
+    void recoverQuery(WriteSet* writes, DirIndex* index, FatTable* fat, Geometry* geometry, QueryFilter* filter);
 
     // variables
-    unsigned char* disk;
-    int fd;
-    struct stat diskStat;
-    // had to search online to figure out how to write with mmap
-    fd = open( (char*) diskImage, O_RDWR | O_CREAT, (mode_t)0600);
-    // if file aint open-able
-    if (fd == -1){
+    NyuVolume volume;
+    // the image is only ever read, recovery writes go out with pwrite (and with -x there are none)
+    // ERROR 17, 20 - if the image can't be opened, is too short or isn't a FAT12/16/32 volume we can address
+    if(openVolume((char*) diskImage, (extractDir ? 0 : VOLUME_WRITABLE) | VOLUME_PLAUSIBLE_FAT, &volume) != NYU_OK){
         printUsageInfo();
     }
-    // if sb aint fstat-able
-    if (fstat(fd, &diskStat) == -1){
+    if(volume.rolledBack){
+        fprintf(stderr, "%s: rolled back an interrupted recovery\n", (char*) diskImage);
+    }
+    if(volume.journalPending){
+        fprintf(stderr, "%s: an interrupted recovery was not rolled back (image opened read-only)\n", (char*) diskImage);
+    }
+    if(volume.fatCopy != 0){
+        fprintf(stderr, "%s: FAT copies differ, using FAT %u\n", (char*) diskImage, volume.fatCopy+1);
+    }
+    // ERROR 14 - if the directory for the ranked candidates can't be created
+    if(rankMode == 'K' && mkdir((char*) rankDir, 0755) == -1 && errno != EEXIST){
         printUsageInfo();
     }
-    // mmap the disk boot sector
-    disk = mmap(NULL, diskStat.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
-    BootEntry* diskBootSector = (BootEntry*) disk;
-    // bytes per SECTOR
-    unsigned short numOfBPS = diskBootSector->BPB_BytsPerSec;
-    // num of reserved SECTORS
-    unsigned short numOfRS = diskBootSector->BPB_RsvdSecCnt;
-    // size of each FAT in SECTORS
-    unsigned int sizeOfEachFAT = diskBootSector->BPB_FATSz32;
-    // number of FATs 
-    unsigned char numOfFATS = diskBootSector->BPB_NumFATs;
-    unsigned int bytesPerFAT = sizeOfEachFAT*numOfBPS;
-    // sectors per CLUSTER 
-    unsigned char numOfSPC = diskBootSector->BPB_SecPerClus;
-    // bytes per CLUSTER
-    unsigned int bytesPerCluster = numOfBPS*numOfSPC;
-    // cluster start 
-    unsigned int rootClusterIndex = diskBootSector->BPB_RootClus;
-    // root area and fat area in bytes
-    unsigned int reservedArea = numOfRS*numOfBPS;
-    unsigned int fatArea = numOfFATS*sizeOfEachFAT*numOfBPS;
-    // root cluster offset
-    unsigned int rootClusterOffset = (rootClusterIndex-2) * bytesPerCluster;
-    // root directory start index
-    unsigned int rootDirStartIndex = reservedArea+fatArea+rootClusterOffset;
-    unsigned char* filee = (unsigned char*) fileName;
+    // decode the FAT and index the whole directory tree once, every command answers from them
+    loadVolumeIndex(&volume);
+    Storage* storage = &volume.storage;
+    Geometry* geometry = &volume.geometry;
+    FatTable* fat = &volume.fat;
+    DirIndex* index = &volume.index;
+    mapClusterOwners(fat, index);
+    // file content is streamed cluster by cluster into SHA-1
+    ContentReader reader;
+    initContentReader(&reader, storage, geometry);
+    // every modification is gathered first and written once at the end
+    WriteSet writes;
+    initWriteSet(&writes);
+    Report report;
+    initReport(&report, jsonOutput);
+    writes.report = &report;
+    // with -x recovered files are copied out and the image stays untouched
+    Extractor extractor;
+    if(extractDir){
+        // ERROR 14 - if the output directory can't be created
+        if(!initExtractor(&extractor, storage, geometry, (char*) extractDir)){
+            printUsageInfo();
+        }
+        writes.extractor = &extractor;
+    }
+    // a cluster-hash table (-H) lets identical recovered files share one copy
+    ClusterHashTable clusterHashes;
+    int clusterHashesLoaded = FALSE;
+    if(extractDir){
+        char clusterHashPath[4096];
+        snprintf(clusterHashPath, sizeof(clusterHashPath), "%s.nyuclus", (char*) diskImage);
+        clusterHashesLoaded = loadClusterHashTable(clusterHashPath, storage, geometry, &clusterHashes);
+        if(clusterHashesLoaded){
+            extractor.hashes = &clusterHashes;
+        }
+    }
     
     // contiguous 
     if(command == 'r'){
         // call the actual recovery method
-        searchDeletedFiles(disk, filee, rootDirStartIndex, bytesPerCluster, reservedArea, 
-        fatArea, rootClusterIndex, bytesPerFAT, (unsigned int) numOfFATS, 0, shaHash, 
-        NULL, FALSE, rootDirStartIndex, sValid);
+        searchDeletedFiles(&writes, index, fat, geometry, &reader, fileName, shaHash, sValid, rankMode, rankDir);
+    }
+    // non-contiguous, laid out block by block from a known copy
+    else if(command == 'R' && guideFile){
+        searchGuidedFile(storage, &writes, index, fat, geometry, &reader, fileName, guideFile, shaHash, sValid);
+    }
+    // non-contiguous
+    else if(command == 'R'){
+        searchNonContFiles(storage, &writes, index, fat, geometry, &reader, fileName, shaHash);
+    }
+    // list of contiguous files
+    else if(command == 'b'){
+        recoverBatch(&writes, index, fat, geometry, &reader, fileName);
     }
+    // every file of a manifest, matched by content
+    else if(command == 'm'){
+        recoverManifest(&writes, index, fat, geometry, &reader, fileName);
+    }
+    // every deleted file a query matches
+    else if(command == 'q'){
+        recoverQuery(&writes, index, fat, geometry, filter);
+    }
+    finishReport(&report);
+    // ERROR 16 - if a recovered file could not be written out
+    unsigned long long started = beginPhase();
+    if(extractDir){
+        unsigned int failures = finishExtractor(&extractor);
+        if(extractor.linked > 0){
+            fprintf(stderr, "%s: %u duplicate files hard-linked to an identical copy\n", (char*) extractDir, extractor.linked);
+        }
+        if(clusterHashesLoaded){
+            freeClusterHashTable(&clusterHashes);
+        }
+        if(failures > 0){
+            fprintf(stderr, "%s: %u recovered files could not be written\n", (char*) extractDir, failures);
+            exit(1);
+        }
+    }
+    // ERROR 16 - if the recovery could not be written (the image is rolled back)
+    if(!commitWriteSet(&writes, storage, volume.journalPath)){
+        fprintf(stderr, "%s: could not write the recovery, image left unchanged\n", (char*) diskImage);
+        exit(1);
+    }
+    endPhase(STAT_PHASE_WRITE_BACK, started);
+    // keep the index in step with the image (recovered entries, new content digests)
+    if(!volume.indexLoaded || writes.count > 0 || index->hashesAdded){
+        saveVolumeIndex(&volume);
+    }
+    freeWriteSet(&writes);
+    freeContentReader(&reader);
+    closeVolume(&volume);
     return;
 }
-void searchDeletedFiles(unsigned char* disk, unsigned char* fileName, unsigned int rootDirStartIndex, 
-unsigned int bytesPerClus, unsigned int fatAreaStartIndex, unsigned int fatAreaSize, unsigned int rootClusIndex
-, unsigned int bytesPerFat, unsigned int numOfFats, unsigned int foundcount, unsigned char* shaHash, DirEntry* preserve
-, int found, unsigned int preserveStartDataSect, int sValid){
-    void recoverContFile(unsigned char* disk, unsigned char* fileName, DirEntry* rootEntry, 
-    unsigned int fatAreaStartIndex, unsigned int bytesPerClus, unsigned int numOfFats, unsigned int bytesPerFat);
-    unsigned char *SHA1(const unsigned char *d, size_t n, unsigned char *md); 
-    DirEntry* preservedEntry = preserve;
-    unsigned int matchCount = foundcount;
-    unsigned int startDataSect = preserveStartDataSect;
-    int shaFound = found;
-    // if user provided -s option
-    if(sValid == TRUE){
-        for (unsigned int i = 0; i < bytesPerClus/32; i++){
-            DirEntry* rootEntry = (DirEntry*) &disk[rootDirStartIndex+(i*32)];
-            unsigned char* dirName = rootEntry->DIR_Name;
-            // BASE CASE 1 - if no more files in directory
-            if(!dirName[0]){
-                break;
-            }
-            // DELETED FILES
-            else if(dirName[0] == (unsigned char) 0xe5){
-                // CHECK FOR NAME MATCH (excluding first character)
-                unsigned char compareFileName[11] = "           ";
-                compareFileName[0] = 0xe5;
-                // convert fileName to dirName format
-                for(unsigned int j = 1; j < 9; j++){
-                    if(fileName[j]){
-                        if(fileName[j] == '/'){
-                            break;
-                        }
-                        else if(fileName[j] == '.'){
-                            if(fileName[j+1]){
-                                compareFileName[8] = (unsigned char) toupper(fileName[j+1]);
-                                if(fileName[j+2]){
-                                    compareFileName[9] = (unsigned char) toupper(fileName[j+2]);
-                                    if(fileName[j+3]){
-                                        compareFileName[10] = (unsigned char) toupper(fileName[j+3]);
-                                    }
-                                }
-                            }
-                            break;
-                        }
-                        else{
-                            compareFileName[j] = (unsigned char) toupper(fileName[j]);
-                            
-                        }
-                    }
-                    else{
-                        break;
-                    }
-                }
-                // check if name of file matches user specified
-                int matches1 = TRUE;
-                for(unsigned int j = 1; j < 11; j++){
-                    if (compareFileName[j] == dirName[j]){
-                        continue;
-                    }
-                    else{
-                        matches1 = FALSE;
-                        break;
-                    }
-                } 
-                if(matches1 == FALSE){
-                    continue;
-                }
-                // NAME MATCHES USER-SPECIFIED NAME AT THIS POINT (Case insensitive)
-                
-                // CHECK FOR CONTENT MATCH
-                unsigned short highClus = rootEntry->DIR_FstClusHI;
-                unsigned short lowClus = rootEntry->DIR_FstClusLO;
-                unsigned int clus = highClus*(pow(2,16))+lowClus;
-                unsigned int sizeOfFile = rootEntry->DIR_FileSize;
-                unsigned int fileLoc = fatAreaStartIndex+fatAreaSize+((clus-2)*bytesPerClus);
-                // locate data cluster
-                unsigned char* cmpContent = (unsigned char*) &disk[fileLoc];
-                unsigned char nonConvHash[20];           
-                SHA1(cmpContent, sizeOfFile, nonConvHash);
-                // converted to compare
-                char cmpHash[40];
-                // loop through each character in returned hash (20 characters) 
-                for(unsigned int j = 0; j < 20; j++){
-                    // convert to 40 characters
-                    sprintf(&cmpHash[j*2], "%02x", nonConvHash[j]);
-                }
-                if (strcmp(cmpHash, (char*) shaHash) == 0){
-                    preservedEntry = rootEntry;
-                    shaFound = TRUE;
-                    break;
-                }
-                else{
-                    continue;
-                }
-            }
-            else{
-                continue;
-            }
+unsigned char* upperCaseName(unsigned char* fileName){
+    unsigned char* fileNameUpper = (unsigned char*) malloc(strlen( (char*) fileName)+1);
+    unsigned int k = 0;
+    while(fileName[k]){
+        fileNameUpper[k] = (unsigned char) toupper(fileName[k]);
+        k++;
+    }
+    fileNameUpper[k] = '\0';
+    return fileNameUpper;
+}
+void searchDeletedFiles(WriteSet* writes, DirIndex* index, FatTable* fat, Geometry* geometry, ContentReader* reader, 
+unsigned char* fileName, unsigned char* shaHash, int sValid, unsigned char rankMode, unsigned char* rankDir){
+    void printUsageInfo();
+    int recoverContFile(WriteSet* writes, DirIndex* index, FatTable* fat, Geometry* geometry, unsigned char* fileName, IndexEntry* entry);
+    void printClustersInUse(WriteSet* writes, DirIndex* index, FatTable* fat, Geometry* geometry, unsigned char* fileNameUpper, IndexEntry* entry);
+    void recoverRankedCandidates(WriteSet* writes, DirIndex* index, FatTable* fat, Geometry* geometry, ContentReader* reader, 
+    NameQuery* query, unsigned char* fileNameUpper, IndexEntry** candidates, unsigned int candidateCount, unsigned char rankMode, 
+    unsigned char* rankDir);
+    unsigned char target[SHA_DIGEST_LENGTH];
+    // ERROR 9 - if -s argument is not a sha1 hex digest
+    if(sValid == TRUE && parseShaHash(shaHash, target) == FALSE){
+        printUsageInfo();
+    }
+    // convert user specified name once (first character is lost on deletion)
+    NameQuery query;
+    buildNameQuery(fileName, &query);
+    // the same lookup nyuRecoverFile makes (with -s the first content match in index order wins)
+    IndexEntry* preservedEntry = NULL;
+    int status = findDeletedEntry(index, reader, &query, sValid == TRUE ? target : NULL, &preservedEntry);
+    unsigned char* fileNameUpper = upperCaseName(fileName);
+    if(status == NYU_OK){
+        if(recoverContFile(writes, index, fat, geometry, query.baseName, preservedEntry)){
+            reportRecovery(writes->report, fileNameUpper, OUTCOME_RECOVERED, preservedEntry, sValid == TRUE ? target : NULL, NULL);
+        }
+        else{
+            printClustersInUse(writes, index, fat, geometry, fileNameUpper, preservedEntry);
         }
     }
-    // if user did not specify hash command
+    // more than one file matches the given name - rank them if asked to
+    else if(status == NYU_ERR_AMBIGUOUS && rankMode){
+        IndexEntry** candidates;
+        unsigned int candidateCount = collectDeletedEntries(index, &query, &candidates);
+        recoverRankedCandidates(writes, index, fat, geometry, reader, &query, fileNameUpper, candidates, candidateCount, 
+        rankMode, rankDir);
+        free(candidates);
+    }
+    else if(status == NYU_ERR_AMBIGUOUS){
+        reportRecovery(writes->report, fileNameUpper, OUTCOME_MULTIPLE, NULL, NULL, NULL);
+    }
     else{
-        for (unsigned int i = 0; i < bytesPerClus/32 ; i++){
-            DirEntry* rootEntry = (DirEntry*) &disk[rootDirStartIndex+(i*32)];
-            unsigned char* dirName = rootEntry->DIR_Name;
-            // BASE CASE 1 - if no more files in directory
-            if(!dirName[0]){
-                break;
+        reportRecovery(writes->report, fileNameUpper, OUTCOME_NOT_FOUND, NULL, NULL, NULL);
+    }
+    free(fileNameUpper);
+    return;
+}
+// score every deleted entry matching the name, then recover the best one (-k) or extract them all (-K)
+void recoverRankedCandidates(WriteSet* writes, DirIndex* index, FatTable* fat, Geometry* geometry, ContentReader* reader, 
+NameQuery* query, unsigned char* fileNameUpper, IndexEntry** candidates, unsigned int candidateCount, unsigned char rankMode, 
+unsigned char* rankDir){
+    int recoverContFile(WriteSet* writes, DirIndex* index, FatTable* fat, Geometry* geometry, unsigned char* fileName, IndexEntry* entry);
+    void printClustersInUse(WriteSet* writes, DirIndex* index, FatTable* fat, Geometry* geometry, unsigned char* fileNameUpper, IndexEntry* entry);
+    Ranker ranker;
+    ranker.storage = reader->storage;
+    ranker.geometry = geometry;
+    ranker.fat = fat;
+    ranker.count = candidateCount;
+    ranker.candidates = (RankedCandidate*) malloc(sizeof(RankedCandidate)*candidateCount);
+    for(unsigned int k = 0; k < candidateCount; k++){
+        ranker.candidates[k].entry = candidates[k];
+    }
+    countStat(STAT_CANDIDATES, candidateCount);
+    rankCandidates(&ranker);
+    for(unsigned int k = 0; k < candidateCount; k++){
+        reportCandidate(writes->report, fileNameUpper, k+1, &ranker.candidates[k]);
+    }
+    // the best candidate goes back into the image
+    if(rankMode == 'k'){
+        IndexEntry* best = ranker.candidates[0].entry;
+        if(recoverContFile(writes, index, fat, geometry, query->baseName, best)){
+            reportRecovery(writes->report, fileNameUpper, OUTCOME_RECOVERED, best, NULL, NULL);
+        }
+        else{
+            printClustersInUse(writes, index, fat, geometry, fileNameUpper, best);
+        }
+    }
+    // every candidate goes to its own file, named after its rank; the image is left alone
+    else{
+        unsigned char* baseName = (unsigned char*) strrchr((char*) fileNameUpper, '/');
+        baseName = baseName ? baseName+1 : fileNameUpper;
+        for(unsigned int k = 0; k < candidateCount; k++){
+            IndexEntry* entry = ranker.candidates[k].entry;
+            char outputPath[4096];
+            snprintf(outputPath, sizeof(outputPath), "%s/%u-%s", (char*) rankDir, k+1, (char*) baseName);
+            unsigned long long start = clusterStart(geometry, entry->firstCluster);
+            int written = (entry->fileSize == 0 || isValidCluster(fat, entry->firstCluster))
+            && extractImageRange(reader->storage, start, entry->fileSize, outputPath);
+            reportCandidateOutput(writes->report, fileNameUpper, k+1, outputPath, written);
+        }
+    }
+    free(ranker.candidates);
+    return;
+}
+// copy a deleted file out to the extraction directory under its restored path
+void extractDeletedEntry(WriteSet* writes, unsigned char* fileName, IndexEntry* entry, FatExtent* extents, unsigned int extentCount){
+    unsigned int pathLength = strlen((char*) entry->path);
+    unsigned char* path = (unsigned char*) malloc(pathLength+1);
+    memcpy(path, entry->path, pathLength+1);
+    if(!entry->longName){
+        path[entry->parentLength ? entry->parentLength+1 : 0] = restoredFirstChar(fileName, entry);
+    }
+    queueExtraction(writes->extractor, path, extents, extentCount, entry->fileSize);
+    free(path);
+    return;
+}
+// the clusters a deleted file claims were reused - name who holds them now
+void printClustersInUse(WriteSet* writes, DirIndex* index, FatTable* fat, Geometry* geometry, unsigned char* fileNameUpper, IndexEntry* entry){
+    unsigned int clusterCount = clustersFor(geometry, entry->fileSize);
+    unsigned int owner = FAT_NO_OWNER;
+    for(unsigned int c = entry->firstCluster; c < entry->firstCluster+clusterCount && owner == FAT_NO_OWNER; c++){
+        if(isValidCluster(fat, c) && !isFreeCluster(fat, c)){
+            owner = fat->owner[c];
+        }
+    }
+    reportRecovery(writes->report, fileNameUpper, OUTCOME_IN_USE, entry, NULL, owner != FAT_NO_OWNER ? index->entries[owner].path : NULL);
+    return;
+}
+int recoverContFile(WriteSet* writes, DirIndex* index, FatTable* fat, Geometry* geometry, unsigned char* fileName, IndexEntry* entry){
+    // copied out instead: the image, the FAT and the index stay as they are
+    if(writes->extractor){
+        void extractDeletedEntry(WriteSet* writes, unsigned char* fileName, IndexEntry* entry, FatExtent* extents, unsigned int extentCount);
+        unsigned int clusterCount = clustersFor(geometry, entry->fileSize);
+        // every cluster we are about to copy must still be unallocated
+        if(clusterCount > 0 && !isFreeRun(fat, entry->firstCluster, clusterCount)){
+            return FALSE;
+        }
+        FatExtent* extents = (FatExtent*) malloc(sizeof(FatExtent));
+        extents[0].start = entry->firstCluster;
+        extents[0].length = clusterCount;
+        extractDeletedEntry(writes, fileName, entry, extents, clusterCount ? 1 : 0);
+        return TRUE;
+    }
+    // the same relink nyuRecoverFile commits
+    unsigned char firstChar;
+    if(!claimContiguousEntry(writes, index, fat, geometry, fileName, entry, &firstChar)){
+        return FALSE;
+    }
+    // keep the index in step with the disk (later lookups in a batch must not match it again)
+    markRecovered(entry, firstChar);
+    return TRUE;
+}
+void recoverBatch(WriteSet* writes, DirIndex* index, FatTable* fat, Geometry* geometry, ContentReader* reader, unsigned char* listFile){
+    void printUsageInfo();
+    FILE* list = fopen((char*) listFile, "r");
+    // ERROR 11 - if the list of names can't be read
+    if(!list){
+        printUsageInfo();
+    }
+    // one "filename [sha1]" per line, all answered from the same index
+    char line[512];
+    while(fgets(line, sizeof(line), list)){
+        char* name = strtok(line, " \t\r\n");
+        if(!name){
+            continue;
+        }
+        char* sha = strtok(NULL, " \t\r\n");
+        searchDeletedFiles(writes, index, fat, geometry, reader, (unsigned char*) name, (unsigned char*) sha, sha ? TRUE : FALSE, 
+        '\0', NULL);
+    }
+    fclose(list);
+    return;
+}
+
+void recoverManifest(WriteSet* writes, DirIndex* index, FatTable* fat, Geometry* geometry, ContentReader* reader, unsigned char* manifestFile){
+    void printUsageInfo();
+    int recoverContFile(WriteSet* writes, DirIndex* index, FatTable* fat, Geometry* geometry, unsigned char* fileName, IndexEntry* entry);
+    Manifest manifest;
+    // ERROR 13 - if the manifest can't be read or holds a malformed sha1
+    if(!loadManifest(manifestFile, &manifest)){
+        printUsageInfo();
+    }
+    // every deleted entry is hashed exactly once, all of them in one pipelined batch
+    IndexEntry** candidates = (IndexEntry**) malloc(sizeof(IndexEntry*)*(index->count ? index->count : 1));
+    unsigned int candidateCount = 0;
+    for(unsigned int i = 0; i < index->count; i++){
+        IndexEntry* entry = &index->entries[i];
+        if(!entry->deleted || (entry->attr & ATTR_DIRECTORY)){
+            continue;
+        }
+        // content already reused by another file can't be recovered
+        if(entry->fileSize > 0 && !isFreeRun(fat, entry->firstCluster, clustersFor(geometry, entry->fileSize))){
+            continue;
+        }
+        candidates[candidateCount++] = entry;
+    }
+    hashDeletedEntries(index, reader, candidates, candidateCount);
+    for(unsigned int k = 0; k < candidateCount; k++){
+        IndexEntry* entry = candidates[k];
+        if(entry->hashState != HASH_KNOWN){
+            continue;
+        }
+        // an earlier recovery in this run may have claimed the clusters
+        if(entry->fileSize > 0 && !isFreeRun(fat, entry->firstCluster, clustersFor(geometry, entry->fileSize))){
+            continue;
+        }
+        unsigned char* digest = entry->digest;
+        for(unsigned int m = findManifestDigest(&manifest, digest); m != MANIFEST_NONE; m = manifest.entries[m].next){
+            ManifestEntry* wanted = &manifest.entries[m];
+            if(wanted->found || !matchesDeletedName(entry, &wanted->query)){
+                continue;
             }
-            // if file is a deleted file
-            else if(dirName[0] == 0xe5){
-                unsigned char compareFileName[11] = "           ";
-                compareFileName[0] = 0xe5;
-                // convert fileName to dirName format
-                for(unsigned int j = 1; j < 9; j++){
-                    if(fileName[j]){
-                        if(fileName[j] == '/'){
-                            break;
-                        }
-                        else if(fileName[j] == '.'){
-                            if(fileName[j+1]){
-                                compareFileName[8] = (unsigned char) toupper(fileName[j+1]);
-                                if(fileName[j+2]){
-                                    compareFileName[9] = (unsigned char) toupper(fileName[j+2]);
-                                    if(fileName[j+3]){
-                                        compareFileName[10] = (unsigned char) toupper(fileName[j+3]);
-                                    }
-                                }
-                            }
-                            break;
-                        }
-                        else{
-                            compareFileName[j] = fileName[j];
-                        }
-                    }
-                    else{
-                        break;
-                    }
-                }
-                int matches = TRUE;
-                for(unsigned int k = 1; k < 11; k++){
-                    if (compareFileName[k] == dirName[k]){
-                        continue;
-                    }
-                    else{
-                        matches = FALSE;
-                        break;
-                    }
-                } 
-                if(matches == FALSE){
-                    continue;
+            if(recoverContFile(writes, index, fat, geometry, wanted->query.baseName, entry)){
+                unsigned char* fileNameUpper = upperCaseName(wanted->name);
+                reportRecovery(writes->report, fileNameUpper, OUTCOME_RECOVERED, entry, digest, NULL);
+                free(fileNameUpper);
+                wanted->found = TRUE;
+            }
+            break;
+        }
+    }
+    free(candidates);
+    for(unsigned int m = 0; m < manifest.count; m++){
+        if(!manifest.entries[m].found){
+            unsigned char* fileNameUpper = upperCaseName(manifest.entries[m].name);
+            reportRecovery(writes->report, fileNameUpper, OUTCOME_NOT_FOUND, NULL, NULL, NULL);
+            free(fileNameUpper);
+        }
+    }
+    freeManifest(&manifest);
+    return;
+}
+// recover (or with -x extract) every deleted file the query matches, in path order
+void recoverQuery(WriteSet* writes, DirIndex* index, FatTable* fat, Geometry* geometry, QueryFilter* filter){
+    int recoverContFile(WriteSet* writes, DirIndex* index, FatTable* fat, Geometry* geometry, unsigned char* fileName, IndexEntry* entry);
+    void printClustersInUse(WriteSet* writes, DirIndex* index, FatTable* fat, Geometry* geometry, unsigned char* fileNameUpper, IndexEntry* entry);
+    // stands in for the user's file name when the lost first character is restored
+    unsigned char firstChar[2] = {queryFirstChar(filter), '\0'};
+    IndexEntry* previous = NULL;
+    unsigned int twins = 0;
+    for(unsigned int i = 0; i < index->count; i++){
+        IndexEntry* entry = &index->entries[i];
+        if(!matchesQuery(filter, entry)){
+            continue;
+        }
+        // deleted short names differing only in the lost character sort next to each other;
+        // each gets its own first character so they don't come back under one name
+        if(previous && !entry->longName && !previous->longName && previous->parentLength == entry->parentLength
+        && strncmp((char*) previous->path, (char*) entry->path, entry->parentLength) == 0
+        && sameNameTail(previous->dirName, entry->dirName)){
+            firstChar[0] = (unsigned char) ('0'+twins%10);
+            twins++;
+        }
+        else{
+            firstChar[0] = queryFirstChar(filter);
+            twins = 0;
+        }
+        previous = entry;
+        if(recoverContFile(writes, index, fat, geometry, firstChar, entry)){
+            reportRecovery(writes->report, entry->path, OUTCOME_RECOVERED, entry, NULL, NULL);
+        }
+        else{
+            printClustersInUse(writes, index, fat, geometry, entry->path, entry);
+        }
+    }
+    return;
+}
+
+// MILESTONE 8 - option -R
+void nonContDepth(NonContSearch* search, SHA_CTX* prefixCtx, unsigned int* chain, unsigned char* used, unsigned char* scratch, unsigned int depth){
+    for(unsigned int p = 0; p < search->poolSize; p++){
+        // another worker already found the chain
+        if(__atomic_load_n(&search->stop, __ATOMIC_RELAXED)){
+            return;
+        }
+        if(used[p]){
+            continue;
+        }
+        unsigned int clus = search->pool[p];
+        // one scratch cluster per depth (only used without a mapping)
+        const unsigned char* content = viewStorage(search->storage, clusterStart(search->geometry, clus),
+        search->geometry->bytesPerClus, scratch ? &scratch[depth*search->geometry->bytesPerClus] : NULL);
+        if(!content){
+            continue;
+        }
+        countStat(STAT_CLUSTERS_READ, 1);
+        // extend the shared prefix by one cluster instead of re-hashing the whole candidate
+        SHA_CTX ctx = *prefixCtx;
+        chain[depth] = clus;
+        // last cluster - only part of it belongs to the file
+        if(depth == search->clusterCount-1){
+            unsigned char digest[SHA_DIGEST_LENGTH];
+            SHA1_Update(&ctx, content, search->lastClusBytes);
+            SHA1_Final(digest, &ctx);
+            countStat(STAT_BYTES_HASHED, search->lastClusBytes);
+            countStat(STAT_CANDIDATES, 1);
+            if(memcmp(digest, search->target, SHA_DIGEST_LENGTH) == 0){
+                pthread_mutex_lock(&search->lock);
+                if(!search->stop){
+                    memcpy(search->chain, chain, sizeof(unsigned int)*search->clusterCount);
+                    __atomic_store_n(&search->stop, TRUE, __ATOMIC_RELAXED);
                 }
-                else{
-                    preservedEntry = rootEntry;
-                    matchCount+=1;
+                pthread_mutex_unlock(&search->lock);
+                return;
+            }
+        }
+        // middle cluster - whole cluster belongs to the file
+        else{
+            SHA1_Update(&ctx, content, search->geometry->bytesPerClus);
+            countStat(STAT_BYTES_HASHED, search->geometry->bytesPerClus);
+            used[p] = TRUE;
+            nonContDepth(search, &ctx, chain, used, scratch, depth+1);
+            used[p] = FALSE;
+        }
+    }
+    return;
+}
+void* nonContWorker(void* arg){
+    NonContSearch* search = (NonContSearch*) arg;
+    unsigned int chain[MAX_NONCONT_CLUSTERS];
+    unsigned char* used = (unsigned char*) calloc(search->poolSize, sizeof(unsigned char));
+    unsigned char* scratch = search->storage->map ? NULL : (unsigned char*) malloc((unsigned long long) MAX_NONCONT_CLUSTERS*search->geometry->bytesPerClus);
+    chain[0] = search->chain[0];
+    // each branch is one choice of second cluster, handed out to whichever worker is free
+    while(!__atomic_load_n(&search->stop, __ATOMIC_RELAXED)){
+        unsigned int branch = __atomic_fetch_add(&search->nextBranch, 1, __ATOMIC_RELAXED);
+        if(branch >= search->poolSize){
+            break;
+        }
+        unsigned int clus = search->pool[branch];
+        const unsigned char* content = viewStorage(search->storage, clusterStart(search->geometry, clus),
+        search->geometry->bytesPerClus, scratch ? &scratch[search->geometry->bytesPerClus] : NULL);
+        if(!content){
+            continue;
+        }
+        countStat(STAT_CLUSTERS_READ, 1);
+        SHA_CTX ctx = search->firstCtx;
+        chain[1] = clus;
+        if(search->clusterCount == 2){
+            unsigned char digest[SHA_DIGEST_LENGTH];
+            SHA1_Update(&ctx, content, search->lastClusBytes);
+            SHA1_Final(digest, &ctx);
+            countStat(STAT_BYTES_HASHED, search->lastClusBytes);
+            countStat(STAT_CANDIDATES, 1);
+            if(memcmp(digest, search->target, SHA_DIGEST_LENGTH) == 0){
+                pthread_mutex_lock(&search->lock);
+                if(!search->stop){
+                    memcpy(search->chain, chain, sizeof(unsigned int)*2);
+                    __atomic_store_n(&search->stop, TRUE, __ATOMIC_RELAXED);
                 }
+                pthread_mutex_unlock(&search->lock);
             }
-            // BASE CASE 2 - if valid file
-            else{
+            continue;
+        }
+        SHA1_Update(&ctx, content, search->geometry->bytesPerClus);
+        countStat(STAT_BYTES_HASHED, search->geometry->bytesPerClus);
+        used[branch] = TRUE;
+        nonContDepth(search, &ctx, chain, used, scratch, 2);
+        used[branch] = FALSE;
+    }
+    free(used);
+    free(scratch);
+    return NULL;
+}
+int findNonContChain(Storage* storage, FatTable* fat, Geometry* geometry, ContentReader* reader, IndexEntry* entry,
+unsigned int* freeClusters, unsigned int freeCount, unsigned char* target, unsigned int* chain, unsigned int* chainLength){
+    unsigned int clus = entry->firstCluster;
+    unsigned int sizeOfFile = entry->fileSize;
+    unsigned char digest[SHA_DIGEST_LENGTH];
+    // empty file - no clusters to search
+    if(sizeOfFile == 0){
+        *chainLength = 0;
+        SHA1(NULL, 0, digest);
+        return memcmp(digest, target, SHA_DIGEST_LENGTH) == 0;
+    }
+    unsigned int clusterCount = clustersFor(geometry, sizeOfFile);
+    if(clusterCount > MAX_NONCONT_CLUSTERS){
+        return FALSE;
+    }
+    // the first cluster is known from the directory entry and must still be unallocated
+    if(!isFreeCluster(fat, clus)){
+        return FALSE;
+    }
+    *chainLength = clusterCount;
+    chain[0] = clus;
+    // single cluster file - nothing to permute
+    if(clusterCount == 1){
+        countStat(STAT_CANDIDATES, 1);
+        return hashClusterList(reader, chain, 1, sizeOfFile, digest) && memcmp(digest, target, SHA_DIGEST_LENGTH) == 0;
+    }
+    NonContSearch search;
+    search.storage = storage;
+    search.geometry = geometry;
+    search.clusterCount = clusterCount;
+    search.lastClusBytes = sizeOfFile-((clusterCount-1) << geometry->clusShift);
+    memcpy(search.target, target, SHA_DIGEST_LENGTH);
+    SHA1_Init(&search.firstCtx);
+    if(!hashClusterRun(reader, &search.firstCtx, clus, 1, geometry->bytesPerClus)){
+        return FALSE;
+    }
+    // every free cluster except the first one is a candidate for the rest of the chain
+    search.pool = (unsigned int*) malloc(sizeof(unsigned int)*freeCount);
+    search.poolSize = 0;
+    for(unsigned int i = 0; i < freeCount; i++){
+        if(freeClusters[i] != clus){
+            search.pool[search.poolSize++] = freeClusters[i];
+        }
+    }
+    search.nextBranch = 0;
+    search.stop = FALSE;
+    search.chain[0] = clus;
+    pthread_mutex_init(&search.lock, NULL);
+    // one worker per online cpu, never more workers than branches
+    long numOfCpus = sysconf(_SC_NPROCESSORS_ONLN);
+    unsigned int numOfWorkers = numOfCpus > 0 ? (unsigned int) numOfCpus : 1;
+    if(numOfWorkers > search.poolSize){
+        numOfWorkers = search.poolSize > 0 ? search.poolSize : 1;
+    }
+    pthread_t* workers = (pthread_t*) malloc(sizeof(pthread_t)*numOfWorkers);
+    for(unsigned int i = 0; i < numOfWorkers; i++){
+        pthread_create(&workers[i], NULL, nonContWorker, &search);
+    }
+    for(unsigned int i = 0; i < numOfWorkers; i++){
+        pthread_join(workers[i], NULL);
+    }
+    free(workers);
+    free(search.pool);
+    pthread_mutex_destroy(&search.lock);
+    if(search.stop){
+        memcpy(chain, search.chain, sizeof(unsigned int)*clusterCount);
+        return TRUE;
+    }
+    return FALSE;
+}
+void searchNonContFiles(Storage* storage, WriteSet* writes, DirIndex* index, FatTable* fat, Geometry* geometry, 
+ContentReader* reader, unsigned char* fileName, unsigned char* shaHash){
+    void printUsageInfo();
+    unsigned char* upperCaseName(unsigned char* fileName);
+    void recoverNonContFile(WriteSet* writes, DirIndex* index, FatTable* fat, Geometry* geometry, unsigned char* fileName, 
+    IndexEntry* entry, unsigned int* chain, unsigned int chainLength);
+    unsigned char target[SHA_DIGEST_LENGTH];
+    // ERROR 9 - if -s argument is not a sha1 hex digest
+    if(parseShaHash(shaHash, target) == FALSE){
+        printUsageInfo();
+    }
+    // convert user specified name once (first character is lost on deletion)
+    NameQuery query;
+    buildNameQuery(fileName, &query);
+    // collect the unallocated clusters (FAT entry 0) the chain may be built from
+    unsigned int* freeClusters = (unsigned int*) malloc(sizeof(unsigned int)*MAX_NONCONT_CANDIDATES);
+    unsigned int freeCount = collectFreeClusters(fat, freeClusters, MAX_NONCONT_CANDIDATES);
+    unsigned int chain[MAX_NONCONT_CLUSTERS];
+    unsigned int chainLength = 0;
+    IndexEntry* foundEntry = NULL;
+    // only deleted files whose name matches (excluding first character)
+    for(unsigned int i = 0; i < index->count; i++){
+        IndexEntry* entry = &index->entries[i];
+        if(!matchesDeletedName(entry, &query)){
+            continue;
+        }
+        unsigned long long started = beginPhase();
+        int found = findNonContChain(storage, fat, geometry, reader, entry, freeClusters, freeCount, target, chain, &chainLength);
+        endPhase(STAT_PHASE_SEARCH, started);
+        if(found){
+            foundEntry = entry;
+            break;
+        }
+    }
+    free(freeClusters);
+    unsigned char* fileNameUpper = upperCaseName(fileName);
+    if(foundEntry){
+        recoverNonContFile(writes, index, fat, geometry, query.baseName, foundEntry, chain, chainLength);
+        reportRecovery(writes->report, fileNameUpper, OUTCOME_RECOVERED, foundEntry, target, NULL);
+    }
+    else{
+        reportRecovery(writes->report, fileNameUpper, OUTCOME_NOT_FOUND, NULL, NULL, NULL);
+    }
+    free(fileNameUpper);
+    return;
+}
+// -g: every free cluster is hashed once and each block of the known copy is looked up, so the chain
+// may be any length
+void searchGuidedFile(Storage* storage, WriteSet* writes, DirIndex* index, FatTable* fat, Geometry* geometry, 
+ContentReader* reader, unsigned char* fileName, unsigned char* guideFile, unsigned char* shaHash, int sValid){
+    void printUsageInfo();
+    unsigned char* upperCaseName(unsigned char* fileName);
+    void recoverNonContFile(WriteSet* writes, DirIndex* index, FatTable* fat, Geometry* geometry, unsigned char* fileName, 
+    IndexEntry* entry, unsigned int* chain, unsigned int chainLength);
+    unsigned char target[SHA_DIGEST_LENGTH];
+    // ERROR 9 - if -s argument is not a sha1 hex digest
+    if(sValid && parseShaHash(shaHash, target) == FALSE){
+        printUsageInfo();
+    }
+    BlockGuide guide;
+    // ERROR 26 - if the reference file or hash list of -g can't be read
+    if(!loadBlockGuide((char*) guideFile, geometry->bytesPerClus, &guide)){
+        printUsageInfo();
+    }
+    // convert user specified name once (first character is lost on deletion)
+    NameQuery query;
+    buildNameQuery(fileName, &query);
+    unsigned int* chain = (unsigned int*) malloc(sizeof(unsigned int)*(guide.blockCount ? guide.blockCount : 1));
+    GuidedSearch search;
+    int hashed = FALSE;
+    IndexEntry* foundEntry = NULL;
+    // only deleted files whose name matches (excluding first character) and whose size fits the blocks
+    for(unsigned int i = 0; i < index->count && !foundEntry; i++){
+        IndexEntry* entry = &index->entries[i];
+        if(!matchesDeletedName(entry, &query) || clustersFor(geometry, entry->fileSize) != guide.blockCount){
+            continue;
+        }
+        // the free clusters are hashed for the first entry that could be the file
+        if(!hashed){
+            initGuidedSearch(&search, storage, geometry, fat);
+            hashed = TRUE;
+        }
+        if(!assembleGuidedChain(&search, &guide, entry->firstCluster, entry->fileSize, chain)){
+            continue;
+        }
+        // with -s the chain must also hash to the whole file's digest
+        unsigned char digest[SHA_DIGEST_LENGTH];
+        if(sValid && !(hashClusterList(reader, chain, guide.blockCount, entry->fileSize, digest) && memcmp(digest, target, SHA_DIGEST_LENGTH) == 0)){
+            continue;
+        }
+        foundEntry = entry;
+    }
+    unsigned char* fileNameUpper = upperCaseName(fileName);
+    if(foundEntry){
+        recoverNonContFile(writes, index, fat, geometry, query.baseName, foundEntry, chain, guide.blockCount);
+        reportRecovery(writes->report, fileNameUpper, OUTCOME_RECOVERED, foundEntry, sValid ? target : NULL, NULL);
+    }
+    else{
+        reportRecovery(writes->report, fileNameUpper, OUTCOME_NOT_FOUND, NULL, NULL, NULL);
+    }
+    if(hashed){
+        freeGuidedSearch(&search);
+    }
+    free(fileNameUpper);
+    free(chain);
+    freeBlockGuide(&guide);
+    return;
+}
+void recoverNonContFile(WriteSet* writes, DirIndex* index, FatTable* fat, Geometry* geometry, unsigned char* fileName, 
+IndexEntry* entry, unsigned int* chain, unsigned int chainLength){
+    // copied out instead, consecutive clusters of the chain merged into extents
+    if(writes->extractor){
+        void extractDeletedEntry(WriteSet* writes, unsigned char* fileName, IndexEntry* entry, FatExtent* extents, unsigned int extentCount);
+        FatExtent* extents = (FatExtent*) malloc(sizeof(FatExtent)*(chainLength ? chainLength : 1));
+        unsigned int extentCount = 0;
+        for(unsigned int k = 0; k < chainLength; k++){
+            if(extentCount > 0 && extents[extentCount-1].start+extents[extentCount-1].length == chain[k]){
+                extents[extentCount-1].length++;
                 continue;
             }
+            extents[extentCount].start = chain[k];
+            extents[extentCount].length = 1;
+            extentCount++;
         }
-    }
-    
-    // check FAT if root directory continues
-    unsigned int rootDirOffset = fatAreaStartIndex+(4*rootClusIndex);
-    // if new root directory location exceeds the FAT area
-    if(rootDirOffset >= fatAreaStartIndex+fatAreaSize){
-        printf("here\n");
+        extractDeletedEntry(writes, fileName, entry, extents, extentCount);
         return;
     }
-    FatEntry* fatEntryy = (FatEntry*) &disk[rootDirOffset];
-    unsigned int rootDirFatLoc = fatEntryy->clusterIndex;
-    // RECURSIVE - if not end of root directory and not a bad cluster
-    if(rootDirFatLoc < 0x0ffffff8){
-        unsigned int newOffset = (rootDirFatLoc-2) * bytesPerClus;
-        unsigned int newRootStartIndex = fatAreaStartIndex+fatAreaSize+newOffset;
-        searchDeletedFiles(disk, fileName, newRootStartIndex, bytesPerClus, fatAreaStartIndex, 
-        fatAreaSize, rootDirFatLoc, bytesPerFat, numOfFats, matchCount, shaHash, preservedEntry, 
-        shaFound, startDataSect, sValid);
-        return;
+    // recover first character in filename (and the long name, if any)
+    markRecovered(entry, restoreDeletedEntry(writes, fileName, entry));
+    // link each cluster to the next one found by the search, in every FAT
+    linkClusterChain(writes, fat, geometry, chain, chainLength, entry-index->entries);
+    return;
+}
+
+// MILESTONE 9 - option -c
+void option_c(char* diskImage, char* outputDir){
+    // declare functions
+    void printUsageInfo();
+    // variables
+    NyuVolume volume;
+    // ERROR 17, 20 - if the image can't be opened, is too short or isn't a FAT12/16/32 volume we can address
+    if(openVolume(diskImage, 0, &volume) != NYU_OK){
+        printUsageInfo();
     }
-    // DONE SEARCHING ROOT DIR AT THIS POINT
-    unsigned char* fileNameUpper = (unsigned char*) malloc(strlen( (char*) fileName)+1);
-    unsigned int k = 0;
-    while(fileName[k]){
-        fileNameUpper[k] = (unsigned char) toupper(fileName[k]);
-        k++;
+    // ERROR 14 - if the output directory can't be created
+    if(mkdir(outputDir, 0755) == -1 && errno != EEXIST){
+        printUsageInfo();
     }
-    // print options if user specified a sha option
-    if (sValid == TRUE){
-        if(preservedEntry){
-            recoverContFile(disk, fileName, preservedEntry, fatAreaStartIndex, bytesPerClus, numOfFats, bytesPerFat);
-            printf("%s: successfully recovered with SHA-1\n", fileNameUpper);
+    Storage* storage = &volume.storage;
+    Geometry* geometry = &volume.geometry;
+    // only unallocated clusters (of the first FAT) are carved
+    Carver carver;
+    carver.storage = storage;
+    carver.geometry = geometry;
+    carver.fat = &volume.fat;
+    carveFreeClusters(&carver);
+    int carvedCount = 0;
+    unsigned long long carvedEnd = 0;
+    for(unsigned int i = 0; i < carver.hitCount; i++){
+        CarveHit* hit = &carver.hits[i];
+        unsigned long long start = clusterStart(geometry, hit->cluster);
+        // no footer, or a header inside a file we already carved (e.g. a JPEG stored in a ZIP)
+        if(hit->size == 0 || start < carvedEnd){
+            continue;
         }
-        else{
-            printf("%s: file not found\n", fileNameUpper);
+        char outputName[32];
+        char outputPath[4096];
+        snprintf(outputName, sizeof(outputName), "f%08u.%s", hit->cluster, carveTypes[hit->type].ext);
+        snprintf(outputPath, sizeof(outputPath), "%s/%s", outputDir, outputName);
+        if(!extractImageRange(storage, start, hit->size, outputPath)){
+            printf("%s: could not be written\n", outputName);
+            continue;
         }
-        free(fileNameUpper);
-        return;
+        printf("%s (size = %llu, starting cluster = %u)\n", outputName, hit->size, hit->cluster);
+        carvedEnd = start+hit->size;
+        carvedCount++;
     }
-    // if user never specified a sha option
-    else{
-        // exactly one file matches the given name
-        if(matchCount == 1){
-            recoverContFile(disk, fileName, preservedEntry, fatAreaStartIndex, bytesPerClus, numOfFats, bytesPerFat);
-            printf("%s: successfully recovered\n", fileNameUpper);
+    printf("Total number of carved files = %i\n", carvedCount);
+    free(carver.hits);
+    closeVolume(&volume);
+    return;
+}
+
+// MILESTONE 10 - option -v
+void option_v(char* diskImage){
+    // declare functions
+    void printUsageInfo();
+    // variables
+    NyuVolume volume;
+    // ERROR 17, 20 - if the image can't be opened, is too short or isn't a FAT12/16/32 volume we can address
+    if(openVolume(diskImage, 0, &volume) != NYU_OK){
+        printUsageInfo();
+    }
+    unsigned int numOfFATS = volume.geometry.numOfFats;
+    // the directory tree (read with the first FAT) says where live chains start
+    loadVolumeIndex(&volume);
+    FatCheck check;
+    initFatCheck(&check, &volume.storage, &volume.geometry);
+    if(compareFatCopies(&check)){
+        printf("All %u FATs agree\n", numOfFATS);
+    }
+    for(unsigned int k = 1; k < numOfFATS; k++){
+        FatCopyReport* report = &check.reports[k];
+        for(unsigned int r = 0; r < report->divergentCount; r++){
+            FatRange* range = &report->divergent[r];
+            if(range->first == range->last){
+                printf("FAT %u differs from FAT 1 at cluster %u\n", k+1, range->first);
+            }
+            else{
+                printf("FAT %u differs from FAT 1 in clusters %u-%u\n", k+1, range->first, range->last);
+            }
+        }
+        if(report->divergentClusters > 0){
+            printf("FAT %u differs from FAT 1 in %u clusters\n", k+1, report->divergentClusters);
+        }
+    }
+    scoreFatCopies(&check, &volume.index);
+    for(unsigned int k = 0; k < numOfFATS; k++){
+        FatCopyReport* report = &check.reports[k];
+        printf("FAT %u: %u invalid entries, %u cross-linked clusters, %u orphaned chains\n", k+1,
+        report->invalidCount, report->crossLinkedCount, report->orphanCount);
+        for(unsigned int i = 0; i < report->crossLinkedCount && i < FATCHECK_MAX_LISTED; i++){
+            printf("FAT %u: cluster %u is cross-linked\n", k+1, report->crossLinked[i]);
         }
-        // more than one file matches the given name
-        else if (matchCount > 1){
-            printf("%s: multiple candidates found\n", fileNameUpper);
+        for(unsigned int i = 0; i < report->orphanCount && i < FATCHECK_MAX_LISTED; i++){
+            printf("FAT %u: orphaned chain at cluster %u\n", k+1, report->orphans[i]);
+        }
+    }
+    printf("Most plausible FAT = %u\n", check.best+1);
+    freeFatCheck(&check);
+    closeVolume(&volume);
+    return;
+}
+
+// MILESTONE 11 - option -H, -L
+void option_H(char* diskImage){
+    void printUsageInfo();
+    NyuVolume volume;
+    // ERROR 17, 20 - if the image can't be opened, is too short or isn't a FAT12/16/32 volume we can address
+    if(openVolume(diskImage, 0, &volume) != NYU_OK){
+        printUsageInfo();
+    }
+    Storage* storage = &volume.storage;
+    Geometry* geometry = &volume.geometry;
+    // ERROR 27 - if -H is given a block device (its content can change without the saved table noticing)
+    if(storage->isDevice){
+        fprintf(stderr, "%s: -H only saves a table for an image file, not a block device\n", diskImage);
+        exit(1);
+    }
+    ClusterHashTable table;
+    buildClusterHashTable(storage, geometry, &table);
+    unsigned int hashed = 0;
+    for(unsigned int c = 0; c < table.totalClusters; c++){
+        hashed += table.hashes[c] != CLUSTER_HASH_MISSING;
+    }
+    printf("Number of clusters hashed = %u\nNumber of distinct clusters = %u\nNumber of duplicate clusters = %u\n",
+    hashed, table.distinctCount, hashed-table.distinctCount);
+    char tablePath[4096];
+    snprintf(tablePath, sizeof(tablePath), "%s.nyuclus", diskImage);
+    if(!saveClusterHashTable(tablePath, storage, geometry, &table)){
+        fprintf(stderr, "%s: could not be written\n", tablePath);
+    }
+    freeClusterHashTable(&table);
+    closeVolume(&volume);
+    return;
+}
+// the cluster starts with the length bytes of block
+int clusterHolds(Storage* storage, Geometry* geometry, unsigned int cluster, unsigned char* block, size_t length, unsigned char* scratch){
+    const unsigned char* content = viewStorage(storage, clusterStart(geometry, cluster), length, scratch);
+    return content && memcmp(content, block, length) == 0;
+}
+// list the clusters holding block: first and the clusters that share its hash, each one compared (an
+// equal hash only nominates a cluster); the first that holds it, or 0
+unsigned int printBlockClusters(Storage* storage, Geometry* geometry, ClusterHashTable* table, unsigned int blockNumber, 
+unsigned char* block, size_t length, unsigned int first, unsigned char* scratch){
+    int clusterHolds(Storage* storage, Geometry* geometry, unsigned int cluster, unsigned char* block, size_t length, unsigned char* scratch);
+    unsigned int found = 0;
+    unsigned int listed = 0;
+    unsigned int more = 0;
+    for(unsigned int c = first; c; c = nextClusterWithHash(table, c)){
+        if(!clusterHolds(storage, geometry, c, block, length, scratch)){
+            continue;
+        }
+        if(!found){
+            printf("block %u: cluster %u", blockNumber, c);
+            found = c;
+            listed = 1;
+        }
+        else if(listed < CLUSTER_HASH_MAX_LISTED){
+            printf(", %u", c);
+            listed++;
         }
         else{
-            printf("%s: file not found\n", fileNameUpper);
+            more++;
         }
-        free(fileNameUpper);
-        return;
-    }   
+    }
+    if(!found){
+        printf("block %u: not found\n", blockNumber);
+        return 0;
+    }
+    if(more > 0){
+        printf(" and %u more", more);
+    }
+    printf("\n");
+    return found;
 }
-void recoverContFile(unsigned char* disk, unsigned char* fileName, DirEntry* rootEntry, unsigned int fatAreaStartIndex
-, unsigned int bytesPerClus, unsigned int numOfFats, unsigned int bytesPerFat){
-    // recover first character in filename 
-    rootEntry->DIR_Name[0] = (unsigned char) toupper(fileName[0]);
-    // find the cluster index of file
-    unsigned short highClus = rootEntry->DIR_FstClusHI;
-    unsigned short lowClus = rootEntry->DIR_FstClusLO;
-    unsigned int clus = highClus*(pow(2,16))+lowClus;
-    // get file cluster offset
-    unsigned int fileClusOffset = fatAreaStartIndex+(4*clus);
-    // check if file is larger than one cluster
-    unsigned int fileSize = rootEntry->DIR_FileSize;
-    if(fileSize>bytesPerClus){
-        unsigned int clusterCount = fileSize/bytesPerClus;
-        if (fileSize%bytesPerClus!=0){
-            clusterCount+=1;
-        }
-        // for each FAT
-        for(unsigned int j = 0; j < numOfFats; j++){
-            // for each cluster 
-            for(unsigned int k = 0; k < clusterCount; k++){
-                FatEntry* file = (FatEntry*) &disk[fileClusOffset+(4*k)+(bytesPerFat*j)];
-                // last cluster of file data
-                if(k == clusterCount-1){
-                    file->clusterIndex = (unsigned int) 0x0ffffff8;
-                }
-                else{
-                    file->clusterIndex = (unsigned int) clus+k+1;
-                }  
-            }  
+void option_L(char* diskImage, char* referenceFile){
+    void printUsageInfo();
+    unsigned int printBlockClusters(Storage* storage, Geometry* geometry, ClusterHashTable* table, unsigned int blockNumber, 
+    unsigned char* block, size_t length, unsigned int first, unsigned char* scratch);
+    NyuVolume volume;
+    // ERROR 17, 20 - if the image can't be opened, is too short or isn't a FAT12/16/32 volume we can address
+    if(openVolume(diskImage, 0, &volume) != NYU_OK){
+        printUsageInfo();
+    }
+    Storage* storage = &volume.storage;
+    Geometry* geometry = &volume.geometry;
+    FILE* reference = fopen(referenceFile, "rb");
+    // ERROR 24 - or if its file can't be read
+    if(!reference){
+        printUsageInfo();
+    }
+    // the saved table when it still describes the image, else hash the image now and save it (a block
+    // device has no saved table and is hashed every time)
+    ClusterHashTable table;
+    char tablePath[4096];
+    snprintf(tablePath, sizeof(tablePath), "%s.nyuclus", diskImage);
+    if(storage->isDevice){
+        buildClusterHashTable(storage, geometry, &table);
+    }
+    else if(!loadClusterHashTable(tablePath, storage, geometry, &table)){
+        buildClusterHashTable(storage, geometry, &table);
+        saveClusterHashTable(tablePath, storage, geometry, &table);
+    }
+    unsigned char* block = (unsigned char*) malloc(geometry->bytesPerClus);
+    unsigned char* scratch = storage->map ? NULL : (unsigned char*) malloc(geometry->bytesPerClus);
+    unsigned int blockCount = 0;
+    unsigned int located = 0;
+    unsigned int previous = 0;
+    size_t length;
+    while((length = fread(block, 1, geometry->bytesPerClus, reference)) > 0){
+        unsigned int first;
+        if(length == geometry->bytesPerClus){
+            first = findClusterHash(&table, xxh64(block, length, 0));
+        }
+        // the last block doesn't fill a cluster (the slack differs): compare it where the file would continue
+        else{
+            first = previous && previous+1 < table.totalClusters+2 ? previous+1 : 0;
         }
+        previous = printBlockClusters(storage, geometry, &table, blockCount, block, length, first, scratch);
+        located += previous != 0;
+        blockCount++;
     }
-    // short file recovery
-    else{
-        for(unsigned int j = 0; j < numOfFats; j++){
-            FatEntry* file = (FatEntry*) &disk[fileClusOffset+(bytesPerFat*j)];
-            // change first FAT entry of file back to starting cluster
-            file->clusterIndex = (unsigned int) 0x0ffffff8;
-        }   
+    int readError = ferror(reference);
+    fclose(reference);
+    // ERROR 24 - or if its file can't be read
+    if(readError){
+        printUsageInfo();
     }
+    printf("%u of %u blocks located\n", located, blockCount);
+    free(block);
+    free(scratch);
+    freeClusterHashTable(&table);
+    closeVolume(&volume);
     return;
 }
@@ -0,0 +1,80 @@
+#ifndef NYUFILE_H
+#define NYUFILE_H
+
+// 
+#define TRUE 1
+#define FALSE 0
+
+//
+#pragma pack(push,1)
+typedef struct BootEntry {
+  unsigned char  BS_jmpBoot[3];     // Assembly instruction to jump to boot code
+  unsigned char  BS_OEMName[8];     // OEM Name in ASCII
+  unsigned short BPB_BytsPerSec;    // Bytes per sector. Allowed values include 512, 1024, 2048, and 4096
+  unsigned char  BPB_SecPerClus;    // Sectors per cluster (data unit). Allowed values are powers of 2, but the cluster size must be 32KB or smaller
+  unsigned short BPB_RsvdSecCnt;    // Size in sectors of the reserved area
+  unsigned char  BPB_NumFATs;       // Number of FATs
+  unsigned short BPB_RootEntCnt;    // Maximum number of files in the root directory for FAT12 and FAT16. This is 0 for FAT32
+  unsigned short BPB_TotSec16;      // 16-bit value of number of sectors in file system
+  unsigned char  BPB_Media;         // Media type
+  unsigned short BPB_FATSz16;       // 16-bit size in sectors of each FAT for FAT12 and FAT16. For FAT32, this field is 0
+  unsigned short BPB_SecPerTrk;     // Sectors per track of storage device
+  unsigned short BPB_NumHeads;      // Number of heads in storage device
+  unsigned int   BPB_HiddSec;       // Number of sectors before the start of partition
+  unsigned int   BPB_TotSec32;      // 32-bit value of number of sectors in file system. Either this value or the 16-bit value above must be 0
+  unsigned int   BPB_FATSz32;       // 32-bit size in sectors of one FAT
+  unsigned short BPB_ExtFlags;      // A flag for FAT
+  unsigned short BPB_FSVer;         // The major and minor version number
+  unsigned int   BPB_RootClus;      // Cluster where the root directory can be found
+  unsigned short BPB_FSInfo;        // Sector where FSINFO structure can be found
+  unsigned short BPB_BkBootSec;     // Sector where backup copy of boot sector is located
+  unsigned char  BPB_Reserved[12];  // Reserved
+  unsigned char  BS_DrvNum;         // BIOS INT13h drive number
+  unsigned char  BS_Reserved1;      // Not used
+  unsigned char  BS_BootSig;        // Extended boot signature to identify if the next three values are valid
+  unsigned int   BS_VolID;          // Volume serial number
+  unsigned char  BS_VolLab[11];     // Volume label in ASCII. User defines when creating the file system
+  unsigned char  BS_FilSysType[8];  // File system type label in ASCII
+} BootEntry;
+#pragma pack(pop)
+
+//
+#pragma pack(push,1)
+typedef struct DirEntry {
+  unsigned char  DIR_Name[11];      // File name
+  unsigned char  DIR_Attr;          // File attributes
+  unsigned char  DIR_NTRes;         // Reserved
+  unsigned char  DIR_CrtTimeTenth;  // Created time (tenths of second)
+  unsigned short DIR_CrtTime;       // Created time (hours, minutes, seconds)
+  unsigned short DIR_CrtDate;       // Created day
+  unsigned short DIR_LstAccDate;    // Accessed day
+  unsigned short DIR_FstClusHI;     // High 2 bytes of the first cluster address
+  unsigned short DIR_WrtTime;       // Written time (hours, minutes, seconds
+  unsigned short DIR_WrtDate;       // Written day
+  unsigned short DIR_FstClusLO;     // Low 2 bytes of the first cluster address
+  unsigned int   DIR_FileSize;      // File size in bytes. (0 for directories)
+} DirEntry;
+#pragma pack(pop)
+
+//
+#pragma pack(push,1)
+typedef struct FatEntry{
+    unsigned int clusterIndex;
+} FatEntry;
+#pragma pack(pop)
+
+// FAT32 entries only use the low 28 bits
+#define FAT_ENTRY_MASK 0x0fffffff
+// first value that marks the end of a cluster chain
+#define FAT_END_OF_CHAIN 0x0ffffff8
+// cluster marked as bad
+#define FAT_BAD_CLUSTER 0x0ffffff7
+
+// first byte of the name of a deleted directory entry
+#define DELETED_ENTRY 0xe5
+// attribute of a long file name entry
+#define ATTR_LONG_NAME 0x0f
+// attribute of a subdirectory
+#define ATTR_DIRECTORY 0x10
+
+#endif
@@ -0,0 +1,236 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "query.h"
+
+// comparison of one query term
+#define QUERY_LESS 0
+#define QUERY_LESS_EQUAL 1
+#define QUERY_GREATER 2
+#define QUERY_GREATER_EQUAL 3
+#define QUERY_EQUAL 4
+#define QUERY_NOT_EQUAL 5
+
+// "<=" before "<" so the longer operator wins
+int parseQueryOp(char** cursor){
+    static const char* ops[] = {"<=", ">=", "!=", "<", ">", "="};
+    static const int codes[] = {QUERY_LESS_EQUAL, QUERY_GREATER_EQUAL, QUERY_NOT_EQUAL, QUERY_LESS, QUERY_GREATER, QUERY_EQUAL};
+    for(unsigned int i = 0; i < sizeof(codes)/sizeof(codes[0]); i++){
+        unsigned int length = strlen(ops[i]);
+        if(strncmp(*cursor, ops[i], length) == 0){
+            *cursor += length;
+            return codes[i];
+        }
+    }
+    return -1;
+}
+// narrow [min, max] by "value op" where the value covers lo..hi (a whole day for a date without a time)
+int applyQueryBound(long long* min, long long* max, int op, long long lo, long long hi){
+    long long newMin = 0;
+    long long newMax = 0x7fffffffffffffffLL;
+    if(op == QUERY_LESS){
+        newMax = lo-1;
+    }
+    else if(op == QUERY_LESS_EQUAL){
+        newMax = hi;
+    }
+    else if(op == QUERY_GREATER){
+        newMin = hi+1;
+    }
+    else if(op == QUERY_GREATER_EQUAL){
+        newMin = lo;
+    }
+    else if(op == QUERY_EQUAL){
+        newMin = lo;
+        newMax = hi;
+    }
+    else{
+        return FALSE;
+    }
+    *min = newMin > *min ? newMin : *min;
+    *max = newMax < *max ? newMax : *max;
+    return TRUE;
+}
+// bytes, optionally with a K, M or G (binary) suffix
+int parseQuerySize(char* value, long long* size){
+    char* end;
+    unsigned long long number = strtoull(value, &end, 10);
+    if(end == value){
+        return FALSE;
+    }
+    unsigned int shift = 0;
+    if(*end){
+        const char* suffix = strchr("KMG", toupper((unsigned char) *end));
+        if(!suffix || end[1]){
+            return FALSE;
+        }
+        shift = 10*(unsigned int) (suffix-"KMG"+1);
+    }
+    if(number >> (62-shift)){
+        return FALSE;
+    }
+    *size = (long long) (number << shift);
+    return TRUE;
+}
+// YYYY-MM-DD[THH:MM[:SS]] as the range of (FAT date << 16) | FAT time values it covers
+int parseQueryDate(char* value, long long* lo, long long* hi){
+    unsigned int year, month, day, hour = 0, minute = 0, second = 0;
+    int consumed = 0;
+    if(sscanf(value, "%4u-%2u-%2u%n", &year, &month, &day, &consumed) != 3){
+        return FALSE;
+    }
+    int timeGiven = value[consumed] != '\0';
+    if(timeGiven){
+        int timeConsumed = 0;
+        char* time = &value[consumed];
+        if(sscanf(time, "T%2u:%2u%n", &hour, &minute, &timeConsumed) != 2){
+            return FALSE;
+        }
+        if(time[timeConsumed] == ':'){
+            int secondConsumed = 0;
+            if(sscanf(&time[timeConsumed], ":%2u%n", &second, &secondConsumed) != 1){
+                return FALSE;
+            }
+            timeConsumed += secondConsumed;
+        }
+        if(time[timeConsumed] != '\0'){
+            return FALSE;
+        }
+    }
+    if(year < 1980 || year > 2107 || month < 1 || month > 12 || day < 1 || day > 31 || hour > 23 || minute > 59 || second > 59){
+        return FALSE;
+    }
+    long long date = (long long) ((year-1980) << 9 | month << 5 | day) << 16;
+    *lo = timeGiven ? date | (hour << 11 | minute << 5 | second/2) : date;
+    *hi = timeGiven ? *lo : date | 0xffff;
+    return TRUE;
+}
+// r, h, s, v, d and a, as in the DIR_Attr bits they stand for
+int parseQueryAttrs(char* value, unsigned char* attrs){
+    static const char letters[] = "rhsvda";
+    if(*value == '\0'){
+        return FALSE;
+    }
+    for(char* c = value; *c; c++){
+        const char* letter = strchr(letters, tolower((unsigned char) *c));
+        if(!letter){
+            return FALSE;
+        }
+        *attrs |= (unsigned char) (1 << (letter-letters));
+    }
+    return TRUE;
+}
+int parseQueryGlob(char* value, unsigned char* glob){
+    unsigned int length = strlen(value);
+    if(length == 0 || length >= QUERY_GLOB_SIZE){
+        return FALSE;
+    }
+    for(unsigned int i = 0; i <= length; i++){
+        glob[i] = (unsigned char) toupper((unsigned char) value[i]);
+    }
+    return TRUE;
+}
+int compileQueryTerm(char* term, QueryFilter* filter){
+    char* cursor = term;
+    while(isalpha((unsigned char) *cursor)){
+        cursor++;
+    }
+    unsigned int keyLength = (unsigned int) (cursor-term);
+    int op = parseQueryOp(&cursor);
+    if(op == -1){
+        return FALSE;
+    }
+    long long lo;
+    long long hi;
+    if(keyLength == 4 && strncmp(term, "size", 4) == 0){
+        return parseQuerySize(cursor, &lo) && applyQueryBound(&filter->minSize, &filter->maxSize, op, lo, lo);
+    }
+    if(keyLength == 7 && strncmp(term, "written", 7) == 0){
+        return parseQueryDate(cursor, &lo, &hi) && applyQueryBound(&filter->minWritten, &filter->maxWritten, op, lo, hi);
+    }
+    if(keyLength == 7 && strncmp(term, "created", 7) == 0){
+        return parseQueryDate(cursor, &lo, &hi) && applyQueryBound(&filter->minCreated, &filter->maxCreated, op, lo, hi);
+    }
+    if(keyLength == 4 && strncmp(term, "attr", 4) == 0){
+        if(op == QUERY_EQUAL){
+            return parseQueryAttrs(cursor, &filter->attrSet);
+        }
+        return op == QUERY_NOT_EQUAL && parseQueryAttrs(cursor, &filter->attrClear);
+    }
+    if(keyLength == 4 && strncmp(term, "name", 4) == 0){
+        return op == QUERY_EQUAL && parseQueryGlob(cursor, filter->nameGlob);
+    }
+    if(keyLength == 4 && strncmp(term, "path", 4) == 0){
+        return op == QUERY_EQUAL && parseQueryGlob(cursor, filter->pathGlob);
+    }
+    return FALSE;
+}
+// terms separated by spaces or commas, all of which must hold, e.g.
+// "size>1M written>=2024-01-01 written<2024-02-01T12:00 attr!=h name=*.JPG"; FALSE if any term is malformed
+int compileQuery(char* text, QueryFilter* filter){
+    memset(filter, 0, sizeof(QueryFilter));
+    filter->maxSize = 0x7fffffffffffffffLL;
+    filter->maxWritten = 0x7fffffffffffffffLL;
+    filter->maxCreated = 0x7fffffffffffffffLL;
+    char* copy = strdup(text);
+    int ok = TRUE;
+    for(char* term = strtok(copy, " ,\t"); term && ok; term = strtok(NULL, " ,\t")){
+        ok = compileQueryTerm(term, filter);
+    }
+    free(copy);
+    return ok;
+}
+// case-insensitive glob ('*' any run, '?' one character); a '?' in text is a character lost on deletion
+// and matches anything
+int matchesGlob(const unsigned char* pattern, const unsigned char* text){
+    const unsigned char* star = NULL;
+    const unsigned char* resume = NULL;
+    while(*text){
+        if(*pattern == '*'){
+            star = pattern++;
+            resume = text;
+            continue;
+        }
+        if(*pattern && (*pattern == '?' || *text == '?' || *pattern == toupper(*text))){
+            pattern++;
+            text++;
+            continue;
+        }
+        // let the last star swallow one more character
+        if(star){
+            pattern = star+1;
+            text = ++resume;
+            continue;
+        }
+        return FALSE;
+    }
+    while(*pattern == '*'){
+        pattern++;
+    }
+    return *pattern == '\0';
+}
+// deleted files only; the name glob may match the short or the long name
+int matchesQuery(QueryFilter* filter, IndexEntry* entry){
+    if(!entry->deleted || (entry->attr & ATTR_DIRECTORY)){
+        return FALSE;
+    }
+    long long written = (long long) entry->writeDate << 16 | entry->writeTime;
+    long long created = (long long) entry->createDate << 16 | entry->createTime;
+    if(entry->fileSize < filter->minSize || entry->fileSize > filter->maxSize
+    || written < filter->minWritten || written > filter->maxWritten
+    || created < filter->minCreated || created > filter->maxCreated
+    || (entry->attr & filter->attrSet) != filter->attrSet || (entry->attr & filter->attrClear)){
+        return FALSE;
+    }
+    if(filter->nameGlob[0] && !matchesGlob(filter->nameGlob, entry->name)
+    && !(entry->longName && matchesGlob(filter->nameGlob, entry->longName))){
+        return FALSE;
+    }
+    return !filter->pathGlob[0] || matchesGlob(filter->pathGlob, entry->path);
+}
+// a name glob starting with a plain character names the lost first character of every match
+unsigned char queryFirstChar(QueryFilter* filter){
+    unsigned char first = filter->nameGlob[0];
+    return first && first != '*' && first != '?' ? first : QUERY_UNKNOWN_CHAR;
+}
@@ -0,0 +1,32 @@
+#ifndef QUERY_H
+#define QUERY_H
+
+#include "nyufile.h"
+#include "dirindex.h"
+
+// longest name or path glob of a query
+#define QUERY_GLOB_SIZE 256
+// first character given to recovered short names the query can't pin down
+#define QUERY_UNKNOWN_CHAR '_'
+
+// the terms of a -q query compiled once; every bound is always checked (unset ones span everything),
+// so judging an entry is a handful of integer compares plus the globs that were given
+typedef struct QueryFilter {
+    long long minSize;
+    long long maxSize;
+    long long minWritten;               // (DIR_WrtDate << 16) | DIR_WrtTime
+    long long maxWritten;
+    long long minCreated;               // (DIR_CrtDate << 16) | DIR_CrtTime
+    long long maxCreated;
+    unsigned char attrSet;              // attributes that must all be set
+    unsigned char attrClear;            // attributes that must all be clear
+    unsigned char nameGlob[QUERY_GLOB_SIZE];    // upper case, empty when not given
+    unsigned char pathGlob[QUERY_GLOB_SIZE];
+} QueryFilter;
+
+int compileQuery(char* text, QueryFilter* filter);
+int matchesQuery(QueryFilter* filter, IndexEntry* entry);
+int matchesGlob(const unsigned char* pattern, const unsigned char* text);
+unsigned char queryFirstChar(QueryFilter* filter);
+
+#endif
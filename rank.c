@@ -0,0 +1,174 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <math.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "rank.h"
+#include "carve.h"
+
+// DIR_WrtDate: day in bits 0-4, month in bits 5-8, years since 1980 above
+int isValidFatDate(unsigned short date){
+    unsigned int day = date & 0x1f;
+    unsigned int month = (date >> 5) & 0x0f;
+    return day >= 1 && month >= 1 && month <= 12;
+}
+void formatFatTime(unsigned short date, unsigned short time, char* out, unsigned int outSize){
+    if(!isValidFatDate(date)){
+        snprintf(out, outSize, "unknown");
+        return;
+    }
+    snprintf(out, outSize, "%04u-%02u-%02u %02u:%02u:%02u", 1980+(date >> 9), (date >> 5) & 0x0f, date & 0x1f,
+    time >> 11, (time >> 5) & 0x3f, (time & 0x1f)*2);
+    return;
+}
+// carve type the 8.3 extension promises (-1 when we don't know the extension)
+int expectedCarveType(unsigned char* dirName){
+    for(int t = 0; t < NUM_CARVE_TYPES; t++){
+        const char* ext = carveTypes[t].ext;
+        if(toupper((unsigned char) ext[0]) == dirName[8] && toupper((unsigned char) ext[1]) == dirName[9]
+        && toupper((unsigned char) ext[2]) == dirName[10]){
+            return t;
+        }
+    }
+    return -1;
+}
+// carve type whose signature the content starts with (-1 for none)
+int contentCarveType(const unsigned char* content, unsigned int length){
+    for(int t = 0; t < NUM_CARVE_TYPES; t++){
+        if(carveTypes[t].headerLength <= length && memcmp(content, carveTypes[t].header, carveTypes[t].headerLength) == 0){
+            return t;
+        }
+    }
+    return -1;
+}
+// Shannon entropy in bits per byte
+double byteEntropy(const unsigned char* content, unsigned int length){
+    unsigned int counts[256];
+    memset(counts, 0, sizeof(counts));
+    for(unsigned int i = 0; i < length; i++){
+        counts[content[i]]++;
+    }
+    double entropy = 0;
+    for(unsigned int b = 0; b < 256; b++){
+        if(counts[b]){
+            double p = (double) counts[b]/length;
+            entropy -= p*log2(p);
+        }
+    }
+    return entropy;
+}
+void scoreCandidate(Ranker* ranker, RankedCandidate* candidate, unsigned char* scratch){
+    IndexEntry* entry = candidate->entry;
+    candidate->score = 0;
+    candidate->clusterCount = clustersFor(ranker->geometry, entry->fileSize);
+    candidate->freeClusters = 0;
+    candidate->signature = RANK_SIGNATURE_UNKNOWN;
+    candidate->entropy = 0;
+    if(!isValidFatDate(entry->writeDate)){
+        candidate->score -= RANK_BAD_DATE_PENALTY;
+    }
+    // an empty file has no content to judge
+    if(candidate->clusterCount == 0){
+        return;
+    }
+    // clusters someone else allocated since the deletion hold someone else's data
+    for(unsigned int c = entry->firstCluster; c < entry->firstCluster+candidate->clusterCount; c++){
+        if(isValidCluster(ranker->fat, c) && isFreeCluster(ranker->fat, c)){
+            candidate->freeClusters++;
+        }
+    }
+    candidate->score += RANK_FREE_POINTS*(int) candidate->freeClusters/(int) candidate->clusterCount;
+    if(candidate->freeClusters < candidate->clusterCount){
+        candidate->score -= RANK_IN_USE_PENALTY;
+    }
+    if(!isValidCluster(ranker->fat, entry->firstCluster)){
+        return;
+    }
+    unsigned int length = entry->fileSize < ranker->geometry->bytesPerClus ? entry->fileSize : ranker->geometry->bytesPerClus;
+    const unsigned char* content = viewStorage(ranker->storage, clusterStart(ranker->geometry, entry->firstCluster), length, scratch);
+    if(!content){
+        return;
+    }
+    int expected = expectedCarveType(entry->dirName);
+    int found = contentCarveType(content, length);
+    candidate->entropy = byteEntropy(content, length);
+    if(expected >= 0){
+        candidate->signature = found == expected ? RANK_SIGNATURE_MATCH : RANK_SIGNATURE_MISMATCH;
+        candidate->score += found == expected ? RANK_SIGNATURE_POINTS : -RANK_SIGNATURE_POINTS;
+        // these formats are compressed, so their data looks random
+        if(candidate->entropy >= 7.0){
+            candidate->score += RANK_ENTROPY_POINTS;
+        }
+    }
+    else if(found >= 0){
+        candidate->signature = RANK_SIGNATURE_FOREIGN;
+        candidate->score -= RANK_FOREIGN_PENALTY;
+    }
+    // one repeated byte (usually zeroes) is wiped space, not a file
+    if(candidate->entropy == 0 && length >= 16){
+        candidate->score -= RANK_BLANK_PENALTY;
+    }
+    return;
+}
+void* rankWorker(void* arg){
+    Ranker* ranker = (Ranker*) arg;
+    unsigned char* scratch = (unsigned char*) malloc(ranker->geometry->bytesPerClus);
+    while(TRUE){
+        unsigned int k = __atomic_fetch_add(&ranker->next, 1, __ATOMIC_RELAXED);
+        if(k >= ranker->count){
+            break;
+        }
+        scoreCandidate(ranker, &ranker->candidates[k], scratch);
+    }
+    free(scratch);
+    return NULL;
+}
+unsigned int writeStamp(IndexEntry* entry){
+    return isValidFatDate(entry->writeDate) ? ((unsigned int) entry->writeDate << 16) | entry->writeTime : 0;
+}
+// best first; equal scores go to the newer write, then to directory order
+int compareCandidates(const void* a, const void* b){
+    const RankedCandidate* first = (const RankedCandidate*) a;
+    const RankedCandidate* second = (const RankedCandidate*) b;
+    if(first->score != second->score){
+        return first->score > second->score ? -1 : 1;
+    }
+    unsigned int firstStamp = writeStamp(first->entry);
+    unsigned int secondStamp = writeStamp(second->entry);
+    if(firstStamp != secondStamp){
+        return firstStamp > secondStamp ? -1 : 1;
+    }
+    return first->entry < second->entry ? -1 : (first->entry > second->entry ? 1 : 0);
+}
+// score every candidate (spread over the cores) and sort them best first
+void rankCandidates(Ranker* ranker){
+    long numOfCpus = sysconf(_SC_NPROCESSORS_ONLN);
+    unsigned int numOfWorkers = numOfCpus > 0 ? (unsigned int) numOfCpus : 1;
+    if(numOfWorkers > ranker->count){
+        numOfWorkers = ranker->count ? ranker->count : 1;
+    }
+    ranker->next = 0;
+    pthread_t* threads = (pthread_t*) malloc(sizeof(pthread_t)*numOfWorkers);
+    for(unsigned int i = 0; i < numOfWorkers; i++){
+        pthread_create(&threads[i], NULL, rankWorker, ranker);
+    }
+    for(unsigned int i = 0; i < numOfWorkers; i++){
+        pthread_join(threads[i], NULL);
+    }
+    free(threads);
+    // the last file written under a name is the one usually asked for
+    unsigned int newest = 0;
+    for(unsigned int k = 0; k < ranker->count; k++){
+        unsigned int stamp = writeStamp(ranker->candidates[k].entry);
+        newest = stamp > newest ? stamp : newest;
+    }
+    for(unsigned int k = 0; newest && ranker->count > 1 && k < ranker->count; k++){
+        if(writeStamp(ranker->candidates[k].entry) == newest){
+            ranker->candidates[k].score += RANK_NEWEST_POINTS;
+        }
+    }
+    qsort(ranker->candidates, ranker->count, sizeof(RankedCandidate), compareCandidates);
+    return;
+}
@@ -0,0 +1,49 @@
+#ifndef RANK_H
+#define RANK_H
+
+#include "nyufile.h"
+#include "dirindex.h"
+#include "fat.h"
+#include "storage.h"
+#include "geometry.h"
+
+// what the first cluster says about the type the name promises
+#define RANK_SIGNATURE_UNKNOWN 0        // neither the extension nor the content is a type we know
+#define RANK_SIGNATURE_MATCH 1          // content starts with the signature of its extension
+#define RANK_SIGNATURE_MISMATCH 2       // content starts with something else
+#define RANK_SIGNATURE_FOREIGN 3        // unknown extension, but the content is a known type
+// points of each signal (the score is their sum, higher is more plausible)
+#define RANK_FREE_POINTS 40
+#define RANK_IN_USE_PENALTY 20
+#define RANK_SIGNATURE_POINTS 30
+#define RANK_FOREIGN_PENALTY 10
+#define RANK_ENTROPY_POINTS 10
+#define RANK_BLANK_PENALTY 20
+#define RANK_BAD_DATE_PENALTY 10
+#define RANK_NEWEST_POINTS 5
+
+// one deleted entry competing for a name, with the evidence behind its score
+typedef struct RankedCandidate {
+    IndexEntry* entry;
+    int score;
+    unsigned int clusterCount;
+    unsigned int freeClusters;          // clusters of its contiguous run still unallocated
+    int signature;                      // RANK_SIGNATURE_*
+    double entropy;                     // bits per byte of the first cluster
+} RankedCandidate;
+
+// state shared by the scoring threads
+typedef struct Ranker {
+    Storage* storage;
+    Geometry* geometry;
+    FatTable* fat;
+    RankedCandidate* candidates;
+    unsigned int count;
+    unsigned int next;                  // next candidate handed to a thread
+} Ranker;
+
+void rankCandidates(Ranker* ranker);
+int isValidFatDate(unsigned short date);
+void formatFatTime(unsigned short date, unsigned short time, char* out, unsigned int outSize);
+
+#endif
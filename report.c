@@ -0,0 +1,218 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <unistd.h>
+#include "report.h"
+
+void initReport(Report* report, int json){
+    report->json = json;
+    report->buffer = json ? (char*) malloc(REPORT_BUFFER_SIZE) : NULL;
+    report->length = 0;
+    return;
+}
+void flushReport(Report* report){
+    unsigned int written = 0;
+    while(written < report->length){
+        ssize_t count = write(STDOUT_FILENO, &report->buffer[written], report->length-written);
+        if(count == -1 && errno == EINTR){
+            continue;
+        }
+        // nobody is reading any more
+        if(count <= 0){
+            break;
+        }
+        written += (unsigned int) count;
+    }
+    report->length = 0;
+    return;
+}
+// write out whatever is buffered and release the buffer
+void finishReport(Report* report){
+    if(report->json){
+        flushReport(report);
+        free(report->buffer);
+        report->buffer = NULL;
+    }
+    else{
+        fflush(stdout);
+    }
+    return;
+}
+// make sure length more bytes fit
+void reserveReport(Report* report, unsigned int length){
+    if(report->length+length > REPORT_BUFFER_SIZE){
+        flushReport(report);
+    }
+    return;
+}
+void appendRaw(Report* report, const char* data, unsigned int length){
+    reserveReport(report, length);
+    memcpy(&report->buffer[report->length], data, length);
+    report->length += length;
+    return;
+}
+// printf-style numeric fields (at most REPORT_FIELD_ROOM bytes)
+void appendFormat(Report* report, const char* format, ...){
+    reserveReport(report, REPORT_FIELD_ROOM);
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(&report->buffer[report->length], REPORT_FIELD_ROOM, format, args);
+    va_end(args);
+    if(length > 0){
+        report->length += (unsigned int) length < REPORT_FIELD_ROOM ? (unsigned int) length : REPORT_FIELD_ROOM-1;
+    }
+    return;
+}
+// a quoted JSON string of any length (UTF-8 passes through, quotes and control characters are escaped)
+void appendString(Report* report, const char* key, const unsigned char* text){
+    static const char hexDigits[] = "0123456789abcdef";
+    appendFormat(report, ",\"%s\":\"", key);
+    for(const unsigned char* c = text; *c; c++){
+        reserveReport(report, 6);
+        char* out = &report->buffer[report->length];
+        if(*c == '"' || *c == '\\'){
+            out[0] = '\\';
+            out[1] = (char) *c;
+            report->length += 2;
+        }
+        else if(*c < 0x20){
+            memcpy(out, "\\u00", 4);
+            out[4] = hexDigits[*c >> 4];
+            out[5] = hexDigits[*c & 0x0f];
+            report->length += 6;
+        }
+        else{
+            out[0] = (char) *c;
+            report->length += 1;
+        }
+    }
+    appendRaw(report, "\"", 1);
+    return;
+}
+void appendDigest(Report* report, const unsigned char* digest){
+    static const char hexDigits[] = "0123456789abcdef";
+    char hex[SHA_DIGEST_LENGTH*2];
+    for(unsigned int i = 0; i < SHA_DIGEST_LENGTH; i++){
+        hex[i*2] = hexDigits[digest[i] >> 4];
+        hex[i*2+1] = hexDigits[digest[i] & 0x0f];
+    }
+    appendRaw(report, ",\"sha1\":\"", 9);
+    appendRaw(report, hex, sizeof(hex));
+    appendRaw(report, "\"", 1);
+    return;
+}
+// one directory entry, live or deleted (only JSON; the text listing is printed by -l itself)
+void reportEntry(Report* report, IndexEntry* entry){
+    appendRaw(report, "{\"type\":\"entry\"", 15);
+    appendString(report, "path", entry->path);
+    appendFormat(report, ",\"size\":%u,\"first_cluster\":%u,\"attributes\":%u,\"directory\":%s,\"deleted\":%s",
+    entry->fileSize, entry->firstCluster, entry->attr, entry->attr & ATTR_DIRECTORY ? "true" : "false",
+    entry->deleted ? "true" : "false");
+    // the digest of a deleted entry's content, when the scan index has it
+    if(entry->hashState == HASH_KNOWN){
+        appendDigest(report, entry->digest);
+    }
+    appendRaw(report, "}\n", 2);
+    return;
+}
+// one deleted file a -q query matched, with its timestamps
+void reportMatch(Report* report, IndexEntry* entry){
+    char written[32];
+    char created[32];
+    formatFatTime(entry->writeDate, entry->writeTime, written, sizeof(written));
+    formatFatTime(entry->createDate, entry->createTime, created, sizeof(created));
+    if(!report->json){
+        printf("%s (size = %u, starting cluster = %u, written %s, created %s)\n", entry->path, entry->fileSize,
+        entry->firstCluster, written, created);
+        return;
+    }
+    appendRaw(report, "{\"type\":\"match\"", 15);
+    appendString(report, "path", entry->path);
+    appendFormat(report, ",\"size\":%u,\"first_cluster\":%u,\"attributes\":%u", entry->fileSize, entry->firstCluster,
+    entry->attr);
+    appendString(report, "written", (unsigned char*) written);
+    appendString(report, "created", (unsigned char*) created);
+    if(entry->hashState == HASH_KNOWN){
+        appendDigest(report, entry->digest);
+    }
+    appendRaw(report, "}\n", 2);
+    return;
+}
+// the outcome of recovering name; digest is the SHA-1 it was matched with (NULL when matched by name only),
+// holder the path of the file now owning its clusters (NULL when unknown)
+void reportRecovery(Report* report, unsigned char* name, int outcome, IndexEntry* entry, const unsigned char* digest,
+unsigned char* holder){
+    if(!report->json){
+        if(outcome == OUTCOME_RECOVERED){
+            printf(digest ? "%s: successfully recovered with SHA-1\n" : "%s: successfully recovered\n", name);
+        }
+        else if(outcome == OUTCOME_MULTIPLE){
+            printf("%s: multiple candidates found\n", name);
+        }
+        else if(outcome == OUTCOME_IN_USE && holder){
+            printf("%s: clusters in use by %s\n", name, holder);
+        }
+        else if(outcome == OUTCOME_IN_USE){
+            printf("%s: clusters in use\n", name);
+        }
+        else{
+            printf("%s: file not found\n", name);
+        }
+        return;
+    }
+    static const char* statuses[] = {"recovered", "not_found", "multiple_candidates", "clusters_in_use"};
+    appendRaw(report, "{\"type\":\"recovery\"", 18);
+    appendString(report, "name", name);
+    appendFormat(report, ",\"status\":\"%s\"", statuses[outcome]);
+    if(entry){
+        appendString(report, "path", entry->path);
+        appendFormat(report, ",\"size\":%u,\"first_cluster\":%u", entry->fileSize, entry->firstCluster);
+    }
+    if(digest){
+        appendDigest(report, digest);
+    }
+    if(holder){
+        appendString(report, "in_use_by", holder);
+    }
+    appendRaw(report, "}\n", 2);
+    return;
+}
+// one ranked candidate of -k / -K with the evidence behind its score
+void reportCandidate(Report* report, unsigned char* name, unsigned int rank, RankedCandidate* candidate){
+    char written[32];
+    formatFatTime(candidate->entry->writeDate, candidate->entry->writeTime, written, sizeof(written));
+    if(!report->json){
+        printf("%s: candidate %u (score = %d, size = %u, starting cluster = %u, %u/%u clusters free, written %s)\n", name,
+        rank, candidate->score, candidate->entry->fileSize, candidate->entry->firstCluster, candidate->freeClusters,
+        candidate->clusterCount, written);
+        return;
+    }
+    appendRaw(report, "{\"type\":\"candidate\"", 19);
+    appendString(report, "name", name);
+    appendFormat(report, ",\"rank\":%u,\"score\":%d,\"size\":%u,\"first_cluster\":%u,\"clusters\":%u,\"free_clusters\":%u",
+    rank, candidate->score, candidate->entry->fileSize, candidate->entry->firstCluster, candidate->clusterCount,
+    candidate->freeClusters);
+    appendString(report, "written", (unsigned char*) written);
+    appendRaw(report, "}\n", 2);
+    return;
+}
+// where -K wrote a ranked candidate (written is FALSE if it couldn't be)
+void reportCandidateOutput(Report* report, unsigned char* name, unsigned int rank, char* outputPath, int written){
+    if(!report->json){
+        if(written){
+            printf("%s: candidate %u written to %s\n", name, rank, outputPath);
+        }
+        else{
+            printf("%s: candidate %u could not be written\n", name, rank);
+        }
+        return;
+    }
+    appendRaw(report, "{\"type\":\"recovery\"", 18);
+    appendString(report, "name", name);
+    appendFormat(report, ",\"status\":\"%s\",\"rank\":%u", written ? "written" : "write_failed", rank);
+    appendString(report, "output", (unsigned char*) outputPath);
+    appendRaw(report, "}\n", 2);
+    return;
+}
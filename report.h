@@ -0,0 +1,34 @@
+#ifndef REPORT_H
+#define REPORT_H
+
+#include "nyufile.h"
+#include "dirindex.h"
+#include "rank.h"
+
+// NDJSON records are gathered here and written to stdout in one write per fill
+#define REPORT_BUFFER_SIZE (1U << 20)
+// room for the numeric fields of one record (strings are copied in as they fit)
+#define REPORT_FIELD_ROOM 256
+// what happened to a file we were asked to recover
+#define OUTCOME_RECOVERED 0
+#define OUTCOME_NOT_FOUND 1
+#define OUTCOME_MULTIPLE 2
+#define OUTCOME_IN_USE 3
+
+// where listings and recovery outcomes go: the usual text, or one JSON record per line (-j)
+typedef struct Report {
+    int json;
+    char* buffer;                       // REPORT_BUFFER_SIZE bytes, reused for every record (NULL for text)
+    unsigned int length;
+} Report;
+
+void initReport(Report* report, int json);
+void finishReport(Report* report);
+void reportEntry(Report* report, IndexEntry* entry);
+void reportMatch(Report* report, IndexEntry* entry);
+void reportRecovery(Report* report, unsigned char* name, int outcome, IndexEntry* entry, const unsigned char* digest,
+unsigned char* holder);
+void reportCandidate(Report* report, unsigned char* name, unsigned int rank, RankedCandidate* candidate);
+void reportCandidateOutput(Report* report, unsigned char* name, unsigned int rank, char* outputPath, int written);
+
+#endif
@@ -0,0 +1,147 @@
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "restore.h"
+#include "stats.h"
+#include "libnyufile.h"
+
+// a -s argument: exactly 40 hex characters
+int parseShaHash(unsigned char* shaHash, unsigned char* digest){
+    if(strlen((char*) shaHash) != SHA_DIGEST_LENGTH*2){
+        return FALSE;
+    }
+    for(unsigned int i = 0; i < SHA_DIGEST_LENGTH; i++){
+        unsigned int byte;
+        if(!isxdigit(shaHash[i*2]) || !isxdigit(shaHash[i*2+1]) || sscanf((char*) &shaHash[i*2], "%2x", &byte) != 1){
+            return FALSE;
+        }
+        digest[i] = (unsigned char) byte;
+    }
+    return TRUE;
+}
+// the long name checksum pins down the lost first character, otherwise take the user's
+unsigned char restoredFirstChar(unsigned char* fileName, IndexEntry* entry){
+    return entry->lfnFirstChar ? entry->lfnFirstChar : (unsigned char) toupper(fileName[0]);
+}
+// undo the deletion marks of a directory entry
+unsigned char restoreDeletedEntry(WriteSet* writes, unsigned char* fileName, IndexEntry* entry){
+    unsigned char firstChar = restoredFirstChar(fileName, entry);
+    addWrite(writes, entry->entryOffset, &firstChar, 1);
+    // long name entries get their order bytes back (disk order is last part first)
+    for(unsigned int p = 0; p < entry->lfnCount; p++){
+        unsigned char ord = (unsigned char) (entry->lfnCount-p);
+        if(p == 0){
+            ord |= LFN_LAST_ENTRY;
+        }
+        addWrite(writes, entry->lfnOffsets[p], &ord, 1);
+    }
+    return firstChar;
+}
+// point clus at value in every FAT, and in the decoded table
+void linkCluster(WriteSet* writes, FatTable* fat, Geometry* geometry, unsigned int clus, unsigned int value, unsigned int owner){
+    unsigned char bytes[4];
+    unsigned char mask[4];
+    unsigned int length = encodeFatEntry(fat, clus, value, bytes, mask);
+    for(unsigned int j = 0; j < geometry->numOfFats; j++){
+        addMaskedWrite(writes, fatEntryOffset(geometry, j, clus), bytes, mask, length);
+    }
+    setFatEntry(fat, clus, value);
+    fat->owner[clus] = owner;
+    return;
+}
+// link each cluster of a contiguous run to the next one
+void linkClusterRun(WriteSet* writes, FatTable* fat, Geometry* geometry, unsigned int firstClus, unsigned int clusterCount, unsigned int owner){
+    for(unsigned int k = 0; k < clusterCount; k++){
+        linkCluster(writes, fat, geometry, firstClus+k, k == clusterCount-1 ? (unsigned int) FAT_END_OF_CHAIN : firstClus+k+1, owner);
+    }
+    return;
+}
+// link each cluster to the next one of chain
+void linkClusterChain(WriteSet* writes, FatTable* fat, Geometry* geometry, unsigned int* chain, unsigned int chainLength, unsigned int owner){
+    for(unsigned int k = 0; k < chainLength; k++){
+        linkCluster(writes, fat, geometry, chain[k], k == chainLength-1 ? (unsigned int) FAT_END_OF_CHAIN : chain[k+1], owner);
+    }
+    return;
+}
+// every deleted entry whose name matches (excluding the first character), in index order
+unsigned int collectDeletedEntries(DirIndex* index, NameQuery* query, IndexEntry*** candidates){
+    IndexEntry** matches = NULL;
+    unsigned int matchCount = 0;
+    for(unsigned int i = 0; i < index->count; i++){
+        IndexEntry* entry = &index->entries[i];
+        if(matchesDeletedName(entry, query)){
+            matches = (IndexEntry**) realloc(matches, sizeof(IndexEntry*)*(matchCount+1));
+            matches[matchCount++] = entry;
+        }
+    }
+    *candidates = matches;
+    return matchCount;
+}
+// digest of every candidate's contiguous content; only those the scan index doesn't know are read
+void hashDeletedEntries(DirIndex* index, ContentReader* reader, IndexEntry** candidates, unsigned int candidateCount){
+    countStat(STAT_CANDIDATES, candidateCount);
+    HashJob* jobs = (HashJob*) malloc(sizeof(HashJob)*(candidateCount ? candidateCount : 1));
+    IndexEntry** unknown = (IndexEntry**) malloc(sizeof(IndexEntry*)*(candidateCount ? candidateCount : 1));
+    unsigned int unknownCount = 0;
+    for(unsigned int k = 0; k < candidateCount; k++){
+        if(candidates[k]->hashState == HASH_UNKNOWN){
+            jobs[unknownCount].firstClus = candidates[k]->firstCluster;
+            jobs[unknownCount].fileSize = candidates[k]->fileSize;
+            unknown[unknownCount++] = candidates[k];
+        }
+    }
+    hashContiguousFiles(reader, jobs, unknownCount);
+    for(unsigned int k = 0; k < unknownCount; k++){
+        unknown[k]->hashState = jobs[k].ok ? HASH_KNOWN : HASH_UNREADABLE;
+        memcpy(unknown[k]->digest, jobs[k].digest, SHA_DIGEST_LENGTH);
+    }
+    if(unknownCount > 0){
+        index->hashesAdded = TRUE;
+    }
+    free(jobs);
+    free(unknown);
+    return;
+}
+// the deleted file a recovery by name means: with a target digest the first candidate (in index order)
+// whose contiguous content has it, otherwise the only candidate - NYU_ERR_AMBIGUOUS when there are several
+int findDeletedEntry(DirIndex* index, ContentReader* reader, NameQuery* query, unsigned char* target, IndexEntry** found){
+    IndexEntry** candidates;
+    unsigned int candidateCount = collectDeletedEntries(index, query, &candidates);
+    int status = NYU_ERR_NOT_FOUND;
+    *found = NULL;
+    if(target){
+        // every candidate is hashed in one batch so their reads overlap
+        hashDeletedEntries(index, reader, candidates, candidateCount);
+        for(unsigned int k = 0; k < candidateCount; k++){
+            if(candidates[k]->hashState == HASH_KNOWN && memcmp(candidates[k]->digest, target, SHA_DIGEST_LENGTH) == 0){
+                *found = candidates[k];
+                status = NYU_OK;
+                break;
+            }
+        }
+    }
+    else if(candidateCount > 0){
+        *found = candidates[0];
+        status = candidateCount == 1 ? NYU_OK : NYU_ERR_AMBIGUOUS;
+    }
+    free(candidates);
+    return status;
+}
+// restore a deleted file's name and link its contiguous clusters, in writes and the decoded FAT; FALSE
+// (nothing queued) when a cluster of the run was reused. *firstChar is what markRecovered needs
+int claimContiguousEntry(WriteSet* writes, DirIndex* index, FatTable* fat, Geometry* geometry, unsigned char* fileName, IndexEntry* entry, 
+unsigned char* firstChar){
+    unsigned int clusterCount = clustersFor(geometry, entry->fileSize);
+    // every cluster we are about to claim must still be unallocated
+    if(clusterCount > 0 && !isFreeRun(fat, entry->firstCluster, clusterCount)){
+        return FALSE;
+    }
+    // recover first character in filename (and the long name, if any)
+    *firstChar = restoreDeletedEntry(writes, fileName, entry);
+    // link each cluster to the next one, in every FAT (an empty file has none)
+    if(clusterCount > 0){
+        linkClusterRun(writes, fat, geometry, entry->firstCluster, clusterCount, entry-index->entries);
+    }
+    return TRUE;
+}
@@ -0,0 +1,22 @@
+#ifndef RESTORE_H
+#define RESTORE_H
+
+#include "nyufile.h"
+#include "dirindex.h"
+#include "fat.h"
+#include "geometry.h"
+#include "writeset.h"
+#include "content.h"
+
+int parseShaHash(unsigned char* shaHash, unsigned char* digest);
+unsigned char restoredFirstChar(unsigned char* fileName, IndexEntry* entry);
+unsigned char restoreDeletedEntry(WriteSet* writes, unsigned char* fileName, IndexEntry* entry);
+void linkClusterRun(WriteSet* writes, FatTable* fat, Geometry* geometry, unsigned int firstClus, unsigned int clusterCount, unsigned int owner);
+void linkClusterChain(WriteSet* writes, FatTable* fat, Geometry* geometry, unsigned int* chain, unsigned int chainLength, unsigned int owner);
+unsigned int collectDeletedEntries(DirIndex* index, NameQuery* query, IndexEntry*** candidates);
+void hashDeletedEntries(DirIndex* index, ContentReader* reader, IndexEntry** candidates, unsigned int candidateCount);
+int findDeletedEntry(DirIndex* index, ContentReader* reader, NameQuery* query, unsigned char* target, IndexEntry** found);
+int claimContiguousEntry(WriteSet* writes, DirIndex* index, FatTable* fat, Geometry* geometry, unsigned char* fileName, IndexEntry* entry, 
+unsigned char* firstChar);
+
+#endif
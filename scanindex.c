@@ -0,0 +1,189 @@
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "scanindex.h"
+
+// FNV-1a over the decoded FAT; recovering a file changes it, so does any other allocation
+unsigned long long fatChecksum(FatTable* fat){
+    unsigned long long hash = 0xcbf29ce484222325ULL;
+    for(unsigned int c = 0; c < fat->totalClusters+2; c++){
+        hash = (hash ^ fat->entries[c])*0x100000001b3ULL;
+    }
+    return hash;
+}
+// map image.nyuidx and answer from it if it was built from this exact image
+// (same size, mtime and FAT); the strings stay in the private mapping
+int loadScanIndex(char* indexPath, Storage* storage, FatTable* fat, DirIndex* index){
+    struct stat imageStat;
+    struct stat indexStat;
+    // a block device's mtime doesn't follow writes, so it never gets an index
+    if(storage->isDevice || fstat(storage->fd, &imageStat) == -1){
+        return FALSE;
+    }
+    int fd = open(indexPath, O_RDONLY);
+    if(fd == -1){
+        return FALSE;
+    }
+    if(fstat(fd, &indexStat) == -1 || (unsigned long long) indexStat.st_size < sizeof(ScanIndexHeader)){
+        close(fd);
+        return FALSE;
+    }
+    size_t size = indexStat.st_size;
+    unsigned char* map = (unsigned char*) mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(map == MAP_FAILED){
+        return FALSE;
+    }
+    ScanIndexHeader* header = (ScanIndexHeader*) map;
+    unsigned long long expected = sizeof(ScanIndexHeader)+(unsigned long long) header->entryCount*sizeof(ScanIndexRecord)
+    +(unsigned long long) header->lfnOffsetCount*sizeof(unsigned long long)+header->stringBytes;
+    int valid = memcmp(header->magic, SCAN_INDEX_MAGIC, 8) == 0
+    && header->imageSize == storage->size
+    && header->mtimeSec == (long long) imageStat.st_mtim.tv_sec
+    && header->mtimeNsec == (long long) imageStat.st_mtim.tv_nsec
+    && header->totalClusters == fat->totalClusters
+    && expected == size && header->stringBytes > 0 && map[size-1] == '\0'
+    && header->fatChecksum == fatChecksum(fat);
+    ScanIndexRecord* records = (ScanIndexRecord*) &map[sizeof(ScanIndexHeader)];
+    unsigned long long* lfnOffsets = (unsigned long long*) &records[valid ? header->entryCount : 0];
+    unsigned char* strings = (unsigned char*) &lfnOffsets[valid ? header->lfnOffsetCount : 0];
+    // every offset must land inside the file before we hand out pointers
+    for(unsigned int i = 0; valid && i < header->entryCount; i++){
+        ScanIndexRecord* record = &records[i];
+        valid = record->pathOffset < header->stringBytes
+        && (record->longNameOffset == SCAN_INDEX_NONE || record->longNameOffset < header->stringBytes)
+        && record->lfnCount <= MAX_LFN_ENTRIES
+        && (unsigned long long) record->lfnIndex+record->lfnCount <= header->lfnOffsetCount;
+    }
+    if(!valid){
+        munmap(map, size);
+        return FALSE;
+    }
+    index->count = header->entryCount;
+    index->capacity = header->entryCount;
+    index->entries = (IndexEntry*) malloc(sizeof(IndexEntry)*(index->count ? index->count : 1));
+    for(unsigned int i = 0; i < index->count; i++){
+        ScanIndexRecord* record = &records[i];
+        IndexEntry* entry = &index->entries[i];
+        memcpy(entry->name, record->name, sizeof(entry->name));
+        entry->name[sizeof(entry->name)-1] = '\0';
+        memcpy(entry->dirName, record->dirName, sizeof(record->dirName));
+        entry->longName = record->longNameOffset == SCAN_INDEX_NONE ? NULL : &strings[record->longNameOffset];
+        entry->lfnOffsets = record->lfnCount ? &lfnOffsets[record->lfnIndex] : NULL;
+        entry->lfnCount = record->lfnCount;
+        entry->lfnFirstChar = record->lfnFirstChar;
+        entry->path = &strings[record->pathOffset];
+        entry->parentLength = record->parentLength;
+        entry->stalePath = NULL;
+        entry->firstCluster = record->firstCluster;
+        entry->fileSize = record->fileSize;
+        entry->writeTime = record->writeTime;
+        entry->writeDate = record->writeDate;
+        entry->createTime = record->createTime;
+        entry->createDate = record->createDate;
+        entry->attr = record->attr;
+        entry->deleted = record->deleted;
+        entry->entryOffset = record->entryOffset;
+        entry->hashState = record->hashState;
+        memcpy(entry->digest, record->digest, SHA_DIGEST_LENGTH);
+    }
+    index->mapping = map;
+    index->mappingSize = size;
+    index->hashesAdded = FALSE;
+    return TRUE;
+}
+// append a string to the pool and return where it starts
+unsigned int poolString(unsigned char* strings, unsigned int* used, unsigned char* string){
+    unsigned int offset = *used;
+    unsigned int length = strlen((char*) string)+1;
+    memcpy(&strings[offset], string, length);
+    *used += length;
+    return offset;
+}
+// write the index for the image as it is now (written aside, then renamed over the old one)
+int saveScanIndex(char* indexPath, Storage* storage, FatTable* fat, DirIndex* index){
+    struct stat imageStat;
+    if(storage->isDevice || fstat(storage->fd, &imageStat) == -1){
+        return FALSE;
+    }
+    // the pool starts with an empty string so it is never empty
+    unsigned long long stringBytes = 1;
+    unsigned long long lfnOffsetCount = 0;
+    for(unsigned int i = 0; i < index->count; i++){
+        IndexEntry* entry = &index->entries[i];
+        stringBytes += strlen((char*) entry->path)+1;
+        if(entry->longName){
+            stringBytes += strlen((char*) entry->longName)+1;
+        }
+        lfnOffsetCount += entry->lfnCount;
+    }
+    if(stringBytes >= SCAN_INDEX_NONE || lfnOffsetCount >= SCAN_INDEX_NONE){
+        return FALSE;
+    }
+    ScanIndexHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SCAN_INDEX_MAGIC, 8);
+    header.imageSize = storage->size;
+    header.mtimeSec = imageStat.st_mtim.tv_sec;
+    header.mtimeNsec = imageStat.st_mtim.tv_nsec;
+    header.fatChecksum = fatChecksum(fat);
+    header.totalClusters = fat->totalClusters;
+    header.entryCount = index->count;
+    header.lfnOffsetCount = (unsigned int) lfnOffsetCount;
+    header.stringBytes = (unsigned int) stringBytes;
+    ScanIndexRecord* records = (ScanIndexRecord*) calloc(index->count ? index->count : 1, sizeof(ScanIndexRecord));
+    unsigned long long* lfnOffsets = (unsigned long long*) malloc(sizeof(unsigned long long)*(lfnOffsetCount ? lfnOffsetCount : 1));
+    unsigned char* strings = (unsigned char*) malloc(stringBytes);
+    unsigned int stringsUsed = 1;
+    unsigned int lfnUsed = 0;
+    strings[0] = '\0';
+    for(unsigned int i = 0; i < index->count; i++){
+        IndexEntry* entry = &index->entries[i];
+        ScanIndexRecord* record = &records[i];
+        record->entryOffset = entry->entryOffset;
+        record->pathOffset = poolString(strings, &stringsUsed, entry->path);
+        record->longNameOffset = entry->longName ? poolString(strings, &stringsUsed, entry->longName) : SCAN_INDEX_NONE;
+        record->lfnIndex = lfnUsed;
+        record->lfnCount = entry->lfnCount;
+        memcpy(&lfnOffsets[lfnUsed], entry->lfnOffsets, sizeof(unsigned long long)*entry->lfnCount);
+        lfnUsed += entry->lfnCount;
+        record->parentLength = entry->parentLength;
+        record->firstCluster = entry->firstCluster;
+        record->fileSize = entry->fileSize;
+        record->writeTime = entry->writeTime;
+        record->writeDate = entry->writeDate;
+        record->createTime = entry->createTime;
+        record->createDate = entry->createDate;
+        memcpy(record->name, entry->name, sizeof(record->name));
+        memcpy(record->dirName, entry->dirName, sizeof(record->dirName));
+        record->lfnFirstChar = entry->lfnFirstChar;
+        record->attr = entry->attr;
+        record->deleted = (unsigned char) entry->deleted;
+        record->hashState = entry->hashState;
+        memcpy(record->digest, entry->digest, SHA_DIGEST_LENGTH);
+    }
+    char tempPath[4096];
+    snprintf(tempPath, sizeof(tempPath), "%s.tmp", indexPath);
+    FILE* out = fopen(tempPath, "wb");
+    int ok = out != NULL;
+    ok = ok && fwrite(&header, sizeof(header), 1, out) == 1;
+    ok = ok && (index->count == 0 || fwrite(records, sizeof(ScanIndexRecord), index->count, out) == index->count);
+    ok = ok && (lfnOffsetCount == 0 || fwrite(lfnOffsets, sizeof(unsigned long long), lfnOffsetCount, out) == lfnOffsetCount);
+    ok = ok && fwrite(strings, stringBytes, 1, out) == 1;
+    if(out){
+        ok = fclose(out) == 0 && ok;
+    }
+    // a missing index only costs the next run a rebuild
+    ok = ok && rename(tempPath, indexPath) == 0;
+    if(!ok){
+        unlink(tempPath);
+    }
+    free(records);
+    free(lfnOffsets);
+    free(strings);
+    return ok;
+}
@@ -0,0 +1,54 @@
+#ifndef SCANINDEX_H
+#define SCANINDEX_H
+
+#include "nyufile.h"
+#include "dirindex.h"
+#include "fat.h"
+#include "storage.h"
+
+// bump the version whenever IndexEntry or the walk that fills it changes
+#define SCAN_INDEX_MAGIC "NYUIDX03"
+#define SCAN_INDEX_NONE 0xffffffff
+
+// start of image.nyuidx; the index only answers for the exact image it was built from
+typedef struct ScanIndexHeader {
+    char magic[8];
+    unsigned long long imageSize;
+    long long mtimeSec;
+    long long mtimeNsec;
+    unsigned long long fatChecksum;
+    unsigned int totalClusters;
+    unsigned int entryCount;
+    unsigned int lfnOffsetCount;
+    unsigned int stringBytes;
+} ScanIndexHeader;
+
+// one IndexEntry with its pointers turned into offsets
+// (followed in the file by the long name entry offsets, then the string pool)
+typedef struct ScanIndexRecord {
+    unsigned long long entryOffset;
+    unsigned int pathOffset;
+    unsigned int longNameOffset;        // SCAN_INDEX_NONE without a long name
+    unsigned int lfnIndex;              // first of this entry's lfnCount offsets
+    unsigned int lfnCount;
+    unsigned int parentLength;
+    unsigned int firstCluster;
+    unsigned int fileSize;
+    unsigned short writeTime;
+    unsigned short writeDate;
+    unsigned short createTime;
+    unsigned short createDate;
+    unsigned char name[13];
+    unsigned char dirName[11];
+    unsigned char lfnFirstChar;
+    unsigned char attr;
+    unsigned char deleted;
+    unsigned char hashState;
+    unsigned char digest[SHA_DIGEST_LENGTH];
+} ScanIndexRecord;
+
+unsigned long long fatChecksum(FatTable* fat);
+int loadScanIndex(char* indexPath, Storage* storage, FatTable* fat, DirIndex* index);
+int saveScanIndex(char* indexPath, Storage* storage, FatTable* fat, DirIndex* index);
+
+#endif
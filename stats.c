@@ -0,0 +1,98 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include "stats.h"
+
+Stats stats;
+
+const char* counterNames[NUM_STAT_COUNTERS] = {"clusters read", "bytes hashed", "candidates evaluated", "FAT entries touched"};
+const char* phaseNames[NUM_STAT_PHASES] = {"FAT load", "scan index", "directory walk", "hashing", "chain search", "carving",
+"write-back"};
+
+unsigned long long statClock(){
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (unsigned long long) now.tv_sec*1000000000ULL+(unsigned long long) now.tv_nsec;
+}
+void initStats(int printReport, char* tracePath){
+    memset(&stats, 0, sizeof(Stats));
+    stats.enabled = printReport || tracePath;
+    stats.printReport = printReport;
+    stats.tracePath = tracePath;
+    stats.startTime = statClock();
+    pthread_mutex_init(&stats.lock, NULL);
+    return;
+}
+// add the time since started (from beginPhase) to phase
+void endPhase(unsigned int phase, unsigned long long started){
+    if(!stats.enabled){
+        return;
+    }
+    unsigned long long duration = statClock()-started;
+    __atomic_fetch_add(&stats.phaseTime[phase], duration, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&stats.phaseCalls[phase], 1, __ATOMIC_RELAXED);
+    if(!stats.tracePath){
+        return;
+    }
+    pthread_mutex_lock(&stats.lock);
+    if(stats.eventCount == stats.eventCapacity){
+        stats.eventCapacity = stats.eventCapacity ? stats.eventCapacity*2 : 256;
+        stats.events = (TraceEvent*) realloc(stats.events, sizeof(TraceEvent)*stats.eventCapacity);
+    }
+    TraceEvent* event = &stats.events[stats.eventCount++];
+    event->phase = phase;
+    event->thread = (unsigned int) syscall(SYS_gettid);
+    event->start = started-stats.startTime;
+    event->duration = duration;
+    pthread_mutex_unlock(&stats.lock);
+    return;
+}
+// Chrome trace-event format: one complete ("X") event per phase, the counters at the end
+int writeTrace(char* tracePath, unsigned long long elapsed){
+    FILE* trace = fopen(tracePath, "w");
+    if(!trace){
+        return FALSE;
+    }
+    int pid = (int) getpid();
+    fprintf(trace, "{\"traceEvents\":[\n");
+    for(unsigned int i = 0; i < stats.eventCount; i++){
+        TraceEvent* event = &stats.events[i];
+        fprintf(trace, "{\"name\":\"%s\",\"cat\":\"nyufile\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%u},\n",
+        phaseNames[event->phase], event->start/1000.0, event->duration/1000.0, pid, event->thread);
+    }
+    fprintf(trace, "{\"name\":\"counters\",\"ph\":\"C\",\"ts\":%.3f,\"pid\":%d,\"args\":{", elapsed/1000.0, pid);
+    for(unsigned int c = 0; c < NUM_STAT_COUNTERS; c++){
+        fprintf(trace, "%s\"%s\":%llu", c ? "," : "", counterNames[c], stats.counters[c]);
+    }
+    fprintf(trace, "}}\n]}\n");
+    return fclose(trace) == 0;
+}
+// print the per-phase breakdown (stderr, so it never mixes with -j records) and write the trace
+void finishStats(){
+    if(!stats.enabled){
+        return;
+    }
+    unsigned long long elapsed = statClock()-stats.startTime;
+    if(stats.printReport){
+        fprintf(stderr, "%-22s %8s %12s\n", "phase", "calls", "time (ms)");
+        for(unsigned int p = 0; p < NUM_STAT_PHASES; p++){
+            if(stats.phaseCalls[p] > 0){
+                fprintf(stderr, "%-22s %8llu %12.3f\n", phaseNames[p], stats.phaseCalls[p], stats.phaseTime[p]/1e6);
+            }
+        }
+        fprintf(stderr, "%-22s %8s %12.3f\n", "total", "", elapsed/1e6);
+        for(unsigned int c = 0; c < NUM_STAT_COUNTERS; c++){
+            fprintf(stderr, "%-22s %21llu\n", counterNames[c], stats.counters[c]);
+        }
+    }
+    if(stats.tracePath && !writeTrace(stats.tracePath, elapsed)){
+        fprintf(stderr, "%s: could not be written\n", stats.tracePath);
+    }
+    free(stats.events);
+    stats.events = NULL;
+    pthread_mutex_destroy(&stats.lock);
+    return;
+}
@@ -0,0 +1,63 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <pthread.h>
+#include "nyufile.h"
+
+// what the hot paths count
+#define STAT_CLUSTERS_READ 0
+#define STAT_BYTES_HASHED 1
+#define STAT_CANDIDATES 2                // deleted entries and non-contiguous chains whose content was judged
+#define STAT_FAT_ENTRIES 3
+#define NUM_STAT_COUNTERS 4
+// where the time goes
+#define STAT_PHASE_FAT 0
+#define STAT_PHASE_INDEX 1
+#define STAT_PHASE_DIR_WALK 2
+#define STAT_PHASE_HASH 3
+#define STAT_PHASE_SEARCH 4
+#define STAT_PHASE_CARVE 5
+#define STAT_PHASE_WRITE_BACK 6
+#define NUM_STAT_PHASES 7
+
+// one timed phase, kept for the trace file
+typedef struct TraceEvent {
+    unsigned int phase;
+    unsigned int thread;
+    unsigned long long start;           // nanoseconds since the run started
+    unsigned long long duration;
+} TraceEvent;
+
+// counters and phase timers of the whole run (--stats, --trace); while disabled every hook is one branch
+typedef struct Stats {
+    int enabled;
+    int printReport;
+    char* tracePath;                    // NULL when no trace is written
+    unsigned long long startTime;
+    unsigned long long counters[NUM_STAT_COUNTERS];
+    unsigned long long phaseTime[NUM_STAT_PHASES];
+    unsigned long long phaseCalls[NUM_STAT_PHASES];
+    TraceEvent* events;
+    unsigned int eventCount;
+    unsigned int eventCapacity;
+    pthread_mutex_t lock;
+} Stats;
+
+extern Stats stats;
+
+void initStats(int printReport, char* tracePath);
+void finishStats();
+unsigned long long statClock();
+void endPhase(unsigned int phase, unsigned long long started);
+
+static inline void countStat(unsigned int counter, unsigned long long amount){
+    if(__builtin_expect(stats.enabled, 0)){
+        __atomic_fetch_add(&stats.counters[counter], amount, __ATOMIC_RELAXED);
+    }
+}
+// pair with endPhase (0 while disabled, so nothing is timed)
+static inline unsigned long long beginPhase(){
+    return __builtin_expect(stats.enabled, 0) ? statClock() : 0;
+}
+
+#endif
@@ -0,0 +1,173 @@
+// O_DIRECT
+#define _GNU_SOURCE
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <linux/fs.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "storage.h"
+
+// open an image file or a block device and pick how to read it
+int openStorage(char* path, int writable, Storage* storage){
+    struct stat st;
+    storage->fd = open(path, writable ? O_RDWR : O_RDONLY);
+    storage->directFd = -1;
+    storage->useDirect = FALSE;
+    storage->directAlign = STORAGE_DIRECT_ALIGN;
+    storage->map = NULL;
+    storage->isSparse = FALSE;
+    if(storage->fd == -1){
+        return FALSE;
+    }
+    // a descriptor we opened is closed again on every failure below
+    if(fstat(storage->fd, &st) == -1){
+        closeStorage(storage);
+        return FALSE;
+    }
+    storage->isDevice = S_ISBLK(st.st_mode);
+    if(storage->isDevice){
+        // st_size is 0 for devices, ask the driver
+        unsigned long long size = 0;
+        int sectorSize = 0;
+        if(ioctl(storage->fd, BLKGETSIZE64, &size) == -1){
+            closeStorage(storage);
+            return FALSE;
+        }
+        storage->size = size;
+        if(ioctl(storage->fd, BLKSSZGET, &sectorSize) == 0 && (unsigned int) sectorSize > storage->directAlign){
+            storage->directAlign = (unsigned int) sectorSize;
+        }
+    }
+    else if(S_ISREG(st.st_mode)){
+        storage->size = st.st_size;
+        storage->isSparse = (unsigned long long) st.st_blocks*512 < storage->size;
+    }
+    else{
+        closeStorage(storage);
+        return FALSE;
+    }
+    // devices and very large images are read with pread so nothing big is mapped
+    storage->backend = STORAGE_PREAD;
+    if(!storage->isDevice && storage->size > 0 && storage->size <= MAX_MAPPED_IMAGE){
+        void* map = mmap(NULL, storage->size, PROT_READ, MAP_SHARED, storage->fd, 0);
+        if(map != MAP_FAILED){
+            storage->map = (unsigned char*) map;
+            storage->backend = STORAGE_MMAP;
+        }
+    }
+    if(storage->backend == STORAGE_PREAD){
+        // bulk reads skip the page cache when the filesystem allows it
+        storage->directFd = open(path, O_RDONLY | O_DIRECT);
+        storage->useDirect = storage->directFd != -1;
+    }
+    return TRUE;
+}
+void closeStorage(Storage* storage){
+    if(storage->map){
+        munmap(storage->map, storage->size);
+        storage->map = NULL;
+    }
+    if(storage->directFd != -1){
+        close(storage->directFd);
+        storage->directFd = -1;
+    }
+    if(storage->fd != -1){
+        close(storage->fd);
+        storage->fd = -1;
+    }
+    return;
+}
+// alignment a caller should round pread requests to (1 when O_DIRECT isn't used)
+unsigned int storageAlign(Storage* storage){
+    return __atomic_load_n(&storage->useDirect, __ATOMIC_RELAXED) ? storage->directAlign : 1;
+}
+// one pread; aligned requests go through O_DIRECT, anything else through the page cache
+ssize_t preadStorage(Storage* storage, void* buffer, unsigned long long length, unsigned long long offset){
+    unsigned long long mask = storage->directAlign-1;
+    if(__atomic_load_n(&storage->useDirect, __ATOMIC_RELAXED)
+    && (offset & mask) == 0 && (length & mask) == 0 && ((unsigned long) buffer & mask) == 0){
+        ssize_t count = pread(storage->directFd, buffer, length, offset);
+        if(count != -1 || errno != EINVAL){
+            return count;
+        }
+        // the filesystem wants a different alignment - stay buffered from now on
+        __atomic_store_n(&storage->useDirect, FALSE, __ATOMIC_RELAXED);
+    }
+    return pread(storage->fd, buffer, length, offset);
+}
+// copy exactly length bytes at offset into buffer
+int readStorage(Storage* storage, unsigned long long offset, void* buffer, unsigned long long length){
+    if(offset > storage->size || length > storage->size-offset){
+        return FALSE;
+    }
+    if(storage->map){
+        memcpy(buffer, &storage->map[offset], length);
+        return TRUE;
+    }
+    unsigned char* out = (unsigned char*) buffer;
+    while(length > 0){
+        ssize_t count = preadStorage(storage, out, length, offset);
+        if(count <= 0){
+            return FALSE;
+        }
+        out += count;
+        offset += count;
+        length -= count;
+    }
+    return TRUE;
+}
+// bytes at offset: straight from the mapping, or read into scratch (NULL if out of range)
+const unsigned char* viewStorage(Storage* storage, unsigned long long offset, unsigned long long length, unsigned char* scratch){
+    if(offset > storage->size || length > storage->size-offset){
+        return NULL;
+    }
+    if(storage->map){
+        return &storage->map[offset];
+    }
+    return readStorage(storage, offset, scratch, length) ? scratch : NULL;
+}
+// first offset at or after offset that holds data (the image size if only a hole follows)
+unsigned long long nextStorageData(Storage* storage, unsigned long long offset){
+    if(!storage->isSparse || offset >= storage->size){
+        return offset;
+    }
+    off_t data = lseek(storage->fd, offset, SEEK_DATA);
+    if(data == -1){
+        return errno == ENXIO ? storage->size : offset;
+    }
+    return data;
+}
+// first offset at or after offset inside a hole (the image size if there is none)
+unsigned long long nextStorageHole(Storage* storage, unsigned long long offset){
+    if(!storage->isSparse || offset >= storage->size){
+        return storage->size;
+    }
+    off_t hole = lseek(storage->fd, offset, SEEK_HOLE);
+    return hole == -1 ? storage->size : (unsigned long long) hole;
+}
+// the file next to the image that keeps suffix; for a block device a file in the state directory named
+// after the device path ("/dev/sdb1" keeps "dev_sdb1.nyujournal")
+void storageSidecarPath(Storage* storage, char* path, char* suffix, char* sidecarPath, size_t size){
+    if(!storage->isDevice){
+        snprintf(sidecarPath, size, "%s%s", path, suffix);
+        return;
+    }
+    char* stateDir = getenv(STORAGE_STATE_ENV);
+    if(!stateDir || !stateDir[0]){
+        stateDir = STORAGE_STATE_DIR;
+    }
+    mkdir(stateDir, 0700);
+    int length = snprintf(sidecarPath, size, "%s/", stateDir);
+    length = length < (int) size ? length : (int) size-1;
+    for(char* c = path[0] == '/' ? path+1 : path; *c && length+1 < (int) size; c++){
+        sidecarPath[length++] = *c == '/' ? '_' : *c;
+    }
+    sidecarPath[length] = '\0';
+    snprintf(&sidecarPath[length], size-length, "%s", suffix);
+    return;
+}
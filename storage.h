@@ -0,0 +1,43 @@
+#ifndef STORAGE_H
+#define STORAGE_H
+
+#include <sys/types.h>
+#include "nyufile.h"
+
+// how the image is read
+#define STORAGE_MMAP 0
+#define STORAGE_PREAD 1
+// images (and devices) larger than this are read with pread instead of being mapped
+#ifndef MAX_MAPPED_IMAGE
+#define MAX_MAPPED_IMAGE (8ULL << 30)
+#endif
+// O_DIRECT alignment when the device doesn't tell us a larger one
+#define STORAGE_DIRECT_ALIGN 4096
+// where the recovery journal of a block device is kept (its own directory, /dev, doesn't survive a reboot)
+#define STORAGE_STATE_ENV "NYUFILE_STATE_DIR"
+#define STORAGE_STATE_DIR "/var/lib/nyufile"
+
+// an image file or a block device, read through a mapping or through pread
+typedef struct Storage {
+    int fd;                             // buffered descriptor, also used for every write
+    int directFd;                       // O_DIRECT descriptor for aligned reads, -1 if unavailable
+    int useDirect;                      // cleared if the filesystem rejects our alignment
+    unsigned int directAlign;           // offset, length and buffer alignment O_DIRECT needs
+    unsigned long long size;
+    int isDevice;
+    int isSparse;                       // regular file with fewer blocks than bytes
+    int backend;
+    unsigned char* map;                 // whole image, only with STORAGE_MMAP
+} Storage;
+
+int openStorage(char* path, int writable, Storage* storage);
+void closeStorage(Storage* storage);
+ssize_t preadStorage(Storage* storage, void* buffer, unsigned long long length, unsigned long long offset);
+int readStorage(Storage* storage, unsigned long long offset, void* buffer, unsigned long long length);
+const unsigned char* viewStorage(Storage* storage, unsigned long long offset, unsigned long long length, unsigned char* scratch);
+unsigned int storageAlign(Storage* storage);
+unsigned long long nextStorageData(Storage* storage, unsigned long long offset);
+unsigned long long nextStorageHole(Storage* storage, unsigned long long offset);
+void storageSidecarPath(Storage* storage, char* path, char* suffix, char* sidecarPath, size_t size);
+
+#endif
@@ -0,0 +1,107 @@
+#include <stdio.h>
+#include <unistd.h>
+#include "volume.h"
+#include "fatcheck.h"
+#include "scanindex.h"
+#include "writeset.h"
+#include "stats.h"
+
+// open the image, check its geometry and decode a FAT; NYU_OK or why not
+int openVolume(char* path, unsigned int flags, NyuVolume* volume){
+    volume->writable = (flags & VOLUME_WRITABLE) != 0;
+    // the image is only ever read, recovery writes go out with pwrite
+    if(!openStorage(path, volume->writable, &volume->storage)){
+        return NYU_ERR_OPEN;
+    }
+    snprintf(volume->indexPath, sizeof(volume->indexPath), "%s.nyuidx", path);
+    // a block device keeps its journal in the state directory (/dev doesn't survive the reboot it is there for)
+    storageSidecarPath(&volume->storage, path, ".nyujournal", volume->journalPath, sizeof(volume->journalPath));
+    volume->rolledBack = FALSE;
+    volume->journalPending = FALSE;
+    int status = NYU_OK;
+    if(!readStorage(&volume->storage, 0, &volume->bootSector, sizeof(BootEntry))){
+        status = NYU_ERR_TRUNCATED;
+    }
+    else if(!loadGeometry(&volume->bootSector, &volume->geometry)){
+        status = NYU_ERR_NOT_FAT;
+    }
+    else{
+        // undo a recovery that was interrupted before it finished writing (only into a FAT volume,
+        // and before its FAT is decoded)
+        volume->rolledBack = volume->writable && rollbackJournal(volume->storage.fd, volume->journalPath);
+        volume->journalPending = !volume->writable && access(volume->journalPath, F_OK) == 0;
+        if(!loadFatTable(&volume->storage, &volume->geometry, 0, &volume->fat)){
+            status = NYU_ERR_TRUNCATED;
+        }
+    }
+    if(status != NYU_OK){
+        closeStorage(&volume->storage);
+        return status;
+    }
+    volume->fatCopy = 0;
+    // damaged media: when the FAT copies disagree, recover with the most plausible one
+    if((flags & VOLUME_PLAUSIBLE_FAT) && volume->geometry.numOfFats > 1){
+        FatCheck check;
+        initFatCheck(&check, &volume->storage, &volume->geometry);
+        if(!compareFatCopies(&check)){
+            DirIndex walked;
+            buildDirIndex(&volume->storage, &volume->geometry, &volume->fat, &walked);
+            scoreFatCopies(&check, &walked);
+            freeDirIndex(&walked);
+            if(check.best != 0){
+                freeFatTable(&volume->fat);
+                volume->fatCopy = check.best;
+                if(!loadFatTable(&volume->storage, &volume->geometry, check.best, &volume->fat)){
+                    status = NYU_ERR_TRUNCATED;
+                }
+            }
+        }
+        freeFatCheck(&check);
+        if(status != NYU_OK){
+            closeStorage(&volume->storage);
+            return status;
+        }
+    }
+    volume->indexReady = FALSE;
+    volume->indexLoaded = FALSE;
+    volume->indexChanged = FALSE;
+    pthread_rwlock_init(&volume->lock, NULL);
+    pthread_mutex_init(&volume->indexLock, NULL);
+    return NYU_OK;
+}
+// the directory tree, from image.nyuidx while the image is unchanged, else walked; once per volume
+void loadVolumeIndex(NyuVolume* volume){
+    if(__atomic_load_n(&volume->indexReady, __ATOMIC_ACQUIRE)){
+        return;
+    }
+    pthread_mutex_lock(&volume->indexLock);
+    if(!volume->indexReady){
+        unsigned long long started = beginPhase();
+        volume->indexLoaded = loadScanIndex(volume->indexPath, &volume->storage, &volume->fat, &volume->index);
+        endPhase(STAT_PHASE_INDEX, started);
+        if(!volume->indexLoaded){
+            buildDirIndex(&volume->storage, &volume->geometry, &volume->fat, &volume->index);
+        }
+        __atomic_store_n(&volume->indexReady, TRUE, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&volume->indexLock);
+    return;
+}
+// keep image.nyuidx in step with the image (recovered entries, new content digests)
+void saveVolumeIndex(NyuVolume* volume){
+    unsigned long long started = beginPhase();
+    sortDirIndex(&volume->index);
+    saveScanIndex(volume->indexPath, &volume->storage, &volume->fat, &volume->index);
+    endPhase(STAT_PHASE_INDEX, started);
+    return;
+}
+void closeVolume(NyuVolume* volume){
+    if(volume->indexReady){
+        freeDirIndex(&volume->index);
+    }
+    freeFatTable(&volume->fat);
+    closeStorage(&volume->storage);
+    pthread_rwlock_destroy(&volume->lock);
+    pthread_mutex_destroy(&volume->indexLock);
+    return;
+}
@@ -0,0 +1,41 @@
+#ifndef VOLUME_H
+#define VOLUME_H
+
+#include <pthread.h>
+#include "nyufile.h"
+#include "storage.h"
+#include "geometry.h"
+#include "fat.h"
+#include "dirindex.h"
+#include "libnyufile.h"
+
+// what openVolume does beyond opening the image and decoding its first FAT
+#define VOLUME_WRITABLE 1               // recover in place (an interrupted recovery is rolled back first)
+#define VOLUME_PLAUSIBLE_FAT 2          // when the FAT copies differ, decode the most plausible one
+
+// an open image with everything derived from it; the nyufile commands and libnyufile share it
+struct NyuVolume {
+    Storage storage;
+    BootEntry bootSector;
+    Geometry geometry;
+    FatTable fat;
+    unsigned int fatCopy;               // FAT the table was decoded from (0 is the first)
+    DirIndex index;
+    int indexReady;                     // index loaded or walked (on first use)
+    int indexLoaded;                    // from image.nyuidx, not walked
+    int indexChanged;                   // entries recovered since the index was loaded
+    int writable;
+    int rolledBack;                     // an interrupted recovery was undone on open
+    int journalPending;                 // one is waiting, but the image was opened read-only
+    char indexPath[4096];
+    char journalPath[4096];
+    pthread_rwlock_t lock;              // readers share the FAT and the index, a recovery in place has them alone
+    pthread_mutex_t indexLock;          // the index is loaded once
+};
+
+int openVolume(char* path, unsigned int flags, NyuVolume* volume);
+void loadVolumeIndex(NyuVolume* volume);
+void saveVolumeIndex(NyuVolume* volume);
+void closeVolume(NyuVolume* volume);
+
+#endif
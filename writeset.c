@@ -0,0 +1,189 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "writeset.h"
+
+void initWriteSet(WriteSet* writes){
+    writes->ops = NULL;
+    writes->count = 0;
+    writes->capacity = 0;
+    writes->extractor = NULL;
+    writes->report = NULL;
+    return;
+}
+void freeWriteSet(WriteSet* writes){
+    free(writes->ops);
+    initWriteSet(writes);
+    return;
+}
+void addWrite(WriteSet* writes, unsigned long long offset, const void* data, unsigned int length){
+    const unsigned char mask[4] = {0xff, 0xff, 0xff, 0xff};
+    addMaskedWrite(writes, offset, data, mask, length);
+    return;
+}
+// store only the bits set in mask; ops that share a byte are merged, whatever order they were added in
+void addMaskedWrite(WriteSet* writes, unsigned long long offset, const void* data, const unsigned char* mask, unsigned int length){
+    if(writes->count == writes->capacity){
+        writes->capacity = writes->capacity ? writes->capacity*2 : 64;
+        writes->ops = (WriteOp*) realloc(writes->ops, sizeof(WriteOp)*writes->capacity);
+    }
+    WriteOp* op = &writes->ops[writes->count++];
+    op->offset = offset;
+    op->length = length;
+    memcpy(op->data, data, length);
+    memcpy(op->mask, mask, length);
+    return;
+}
+int compareWriteOps(const void* a, const void* b){
+    const WriteOp* opA = *(const WriteOp* const*) a;
+    const WriteOp* opB = *(const WriteOp* const*) b;
+    if(opA->offset != opB->offset){
+        return (opA->offset > opB->offset)-(opA->offset < opB->offset);
+    }
+    // same offset - keep the order they were added in
+    return (opA > opB)-(opA < opB);
+}
+int writeAll(int fd, unsigned char* data, unsigned int length, unsigned long long offset){
+    while(length > 0){
+        ssize_t count = pwrite(fd, data, length, offset);
+        if(count <= 0){
+            return FALSE;
+        }
+        data += count;
+        length -= count;
+        offset += count;
+    }
+    return TRUE;
+}
+// save what every range is about to overwrite; the end marker says the journal is complete
+// make a newly created file's directory entry durable
+int syncParentDir(char* path){
+    char dirPath[4096];
+    char* slash = strrchr(path, '/');
+    if(!slash){
+        snprintf(dirPath, sizeof(dirPath), ".");
+    }
+    else{
+        snprintf(dirPath, sizeof(dirPath), "%.*s", slash == path ? 1 : (int) (slash-path), path);
+    }
+    int dirFd = open(dirPath, O_RDONLY | O_DIRECTORY);
+    if(dirFd == -1){
+        return FALSE;
+    }
+    int ok = fsync(dirFd) == 0;
+    close(dirFd);
+    return ok;
+}
+int writeJournal(char* journalPath, WriteRange* ranges, unsigned int rangeCount){
+    FILE* journal = fopen(journalPath, "wb");
+    if(!journal){
+        return FALSE;
+    }
+    int ok = fwrite(JOURNAL_MAGIC, 8, 1, journal) == 1 && fwrite(&rangeCount, sizeof(rangeCount), 1, journal) == 1;
+    for(unsigned int r = 0; r < rangeCount && ok; r++){
+        ok = fwrite(&ranges[r].offset, sizeof(ranges[r].offset), 1, journal) == 1
+        && fwrite(&ranges[r].length, sizeof(ranges[r].length), 1, journal) == 1
+        && fwrite(ranges[r].original, ranges[r].length, 1, journal) == 1;
+    }
+    ok = ok && fwrite(JOURNAL_END, 8, 1, journal) == 1 && fflush(journal) == 0 && fsync(fileno(journal)) == 0;
+    fclose(journal);
+    // without its directory entry a crash could lose the journal but keep the image writes
+    return ok && syncParentDir(journalPath);
+}
+// coalesce the write set into ranges, journal the old bytes, write each range once and flush once
+int commitWriteSet(WriteSet* writes, Storage* storage, char* journalPath){
+    if(writes->count == 0){
+        return TRUE;
+    }
+    WriteOp** sorted = (WriteOp**) malloc(sizeof(WriteOp*)*writes->count);
+    for(unsigned int i = 0; i < writes->count; i++){
+        sorted[i] = &writes->ops[i];
+    }
+    qsort(sorted, writes->count, sizeof(WriteOp*), compareWriteOps);
+    WriteRange* ranges = (WriteRange*) malloc(sizeof(WriteRange)*writes->count);
+    unsigned int rangeCount = 0;
+    int ok = TRUE;
+    for(unsigned int i = 0; i < writes->count;){
+        unsigned long long start = sorted[i]->offset;
+        unsigned long long end = start+sorted[i]->length;
+        unsigned int first = i;
+        for(i++; i < writes->count && sorted[i]->offset <= end+WRITE_MERGE_GAP; i++){
+            if(sorted[i]->offset+sorted[i]->length > end){
+                end = sorted[i]->offset+sorted[i]->length;
+            }
+        }
+        WriteRange* range = &ranges[rangeCount++];
+        range->offset = start;
+        range->length = (unsigned int) (end-start);
+        range->original = (unsigned char*) malloc(range->length);
+        range->data = (unsigned char*) malloc(range->length);
+        ok = ok && readStorage(storage, start, range->original, range->length);
+        memcpy(range->data, range->original, range->length);
+        for(unsigned int k = first; k < i; k++){
+            unsigned char* at = &range->data[sorted[k]->offset-start];
+            for(unsigned int b = 0; b < sorted[k]->length; b++){
+                at[b] = (unsigned char) ((at[b] & ~sorted[k]->mask[b]) | (sorted[k]->data[b] & sorted[k]->mask[b]));
+            }
+        }
+    }
+    free(sorted);
+    // nothing is written unless the journal is safely on disk
+    ok = ok && writeJournal(journalPath, ranges, rangeCount);
+    for(unsigned int r = 0; r < rangeCount && ok; r++){
+        ok = writeAll(storage->fd, ranges[r].data, ranges[r].length, ranges[r].offset);
+    }
+    ok = ok && fdatasync(storage->fd) == 0;
+    if(ok){
+        unlink(journalPath);
+    }
+    else{
+        // put back whatever made it to the image
+        rollbackJournal(storage->fd, journalPath);
+    }
+    for(unsigned int r = 0; r < rangeCount; r++){
+        free(ranges[r].data);
+        free(ranges[r].original);
+    }
+    free(ranges);
+    return ok;
+}
+// undo an interrupted commit; TRUE if the image was restored from a complete journal
+int rollbackJournal(int fd, char* journalPath){
+    FILE* journal = fopen(journalPath, "rb");
+    if(!journal){
+        return FALSE;
+    }
+    char magic[8];
+    unsigned int rangeCount = 0;
+    int ok = fread(magic, 8, 1, journal) == 1 && memcmp(magic, JOURNAL_MAGIC, 8) == 0
+    && fread(&rangeCount, sizeof(rangeCount), 1, journal) == 1;
+    WriteRange* ranges = ok ? (WriteRange*) calloc(rangeCount ? rangeCount : 1, sizeof(WriteRange)) : NULL;
+    unsigned int loaded = 0;
+    for(; ok && loaded < rangeCount; loaded++){
+        WriteRange* range = &ranges[loaded];
+        ok = fread(&range->offset, sizeof(range->offset), 1, journal) == 1
+        && fread(&range->length, sizeof(range->length), 1, journal) == 1;
+        if(ok){
+            range->original = (unsigned char*) malloc(range->length ? range->length : 1);
+            ok = fread(range->original, range->length, 1, journal) == 1;
+        }
+    }
+    int complete = ok && fread(magic, 8, 1, journal) == 1 && memcmp(magic, JOURNAL_END, 8) == 0;
+    fclose(journal);
+    ok = complete;
+    for(unsigned int r = 0; r < rangeCount && ok; r++){
+        ok = writeAll(fd, ranges[r].original, ranges[r].length, ranges[r].offset);
+    }
+    ok = ok && fdatasync(fd) == 0;
+    for(unsigned int r = 0; ranges && r < loaded; r++){
+        free(ranges[r].original);
+    }
+    free(ranges);
+    // an incomplete journal means the image was never touched; a failed restore keeps it for the next run
+    if(ok || !complete){
+        unlink(journalPath);
+    }
+    return ok;
+}
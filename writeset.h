@@ -0,0 +1,48 @@
+#ifndef WRITESET_H
+#define WRITESET_H
+
+#include "nyufile.h"
+#include "storage.h"
+
+// writes closer together than this are merged into one range (the gap is rewritten unchanged)
+#define WRITE_MERGE_GAP 512
+// journal file markers
+#define JOURNAL_MAGIC "NYUJRNL1"
+#define JOURNAL_END "NYUJEND1"
+
+// one pending store into the image (a directory name byte or a FAT entry)
+typedef struct WriteOp {
+    unsigned long long offset;
+    unsigned int length;
+    unsigned char data[4];
+    unsigned char mask[4];              // bits of data that are written (the rest is kept from the image)
+} WriteOp;
+
+struct Extractor;
+struct Report;
+
+// every modification of a recovery (or a batch of them), applied together
+typedef struct WriteSet {
+    WriteOp* ops;
+    unsigned int count;
+    unsigned int capacity;
+    struct Extractor* extractor;        // recovered files go here and the image is left alone (NULL to recover in place)
+    struct Report* report;              // where the outcome of each recovery is printed
+} WriteSet;
+
+// a coalesced run of bytes written with one pwrite
+typedef struct WriteRange {
+    unsigned long long offset;
+    unsigned int length;
+    unsigned char* data;
+    unsigned char* original;            // bytes it replaces, kept in the undo journal
+} WriteRange;
+
+void initWriteSet(WriteSet* writes);
+void freeWriteSet(WriteSet* writes);
+void addWrite(WriteSet* writes, unsigned long long offset, const void* data, unsigned int length);
+void addMaskedWrite(WriteSet* writes, unsigned long long offset, const void* data, const unsigned char* mask, unsigned int length);
+int commitWriteSet(WriteSet* writes, Storage* storage, char* journalPath);
+int rollbackJournal(int fd, char* journalPath);
+
+#endif